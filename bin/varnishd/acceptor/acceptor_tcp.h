@@ -34,6 +34,8 @@
 
 struct listen_arg;
 
+#define VCA_TCP_MAX_SHARD	64
+
 int vca_tcp_config(void);
 int vca_tcp_open(char **, struct listen_arg *, const char **);
 int vca_tcp_reopen(void);
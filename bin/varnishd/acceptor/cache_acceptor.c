@@ -142,6 +142,25 @@ VCA_DestroyPool(struct pool *pp)
 	}
 }
 
+/*--------------------------------------------------------------------
+ * The reuseport shards are handed out to the pools by their number
+ * when the pools are created, so none of them can be removed without
+ * leaving sockets nobody accepts from.
+ */
+
+int
+VCA_PoolsRemovable(void)
+{
+	struct listen_sock *ls;
+
+	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+		if (ls->nshard > 1)
+			return (0);
+	}
+	return (1);
+}
+
 /*--------------------------------------------------------------------*/
 
 static void * v_matchproto_()
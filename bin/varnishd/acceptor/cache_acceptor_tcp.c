@@ -36,6 +36,11 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+#  include <linux/filter.h>
+#  define VCA_TCP_STEER_CPU
+#endif
+
 #include "cache/cache_varnishd.h"
 
 #include "acceptor/cache_acceptor.h"
@@ -51,6 +56,20 @@
 #include "vtcp.h"
 #include "vtim.h"
 
+#include "VSC_lsock.h"
+
+/*--------------------------------------------------------------------
+ * Per socket state for the reuseport shards, in ls->vca_priv
+ */
+
+struct vca_tcp_shard {
+	unsigned		magic;
+#define VCA_TCP_SHARD_MAGIC	0x4f1e08b3
+	struct lock		mtx;
+	struct VSC_lsock	*vsc;
+	struct vsc_seg		*vsc_seg;
+};
+
 /*--------------------------------------------------------------------
  * TCP options we want to control
  */
@@ -256,6 +275,70 @@ vca_tcp_init(void)
 
 }
 
+/*--------------------------------------------------------------------
+ * With reuseport=N, the kernel spreads the connections for an address
+ * over N sockets.  Each pool accepts from one of them, or from several
+ * of them if there are fewer pools than sockets, so that every socket
+ * has a pool accepting from it.  Pools are therefore never dropped,
+ * see VCA_PoolsRemovable().
+ */
+
+static int
+vca_tcp_shard_match(const struct listen_sock *ls, const struct pool *pp)
+{
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+
+	if (ls->nshard < 2)
+		return (1);
+	n = vmin(ls->nshard, cache_param->wthread_pools);
+	assert(n > 0);
+	return (ls->shard % n == pp->pool_no % n);
+}
+
+static void
+vca_tcp_shard_init(struct listen_sock *ls)
+{
+	struct vca_tcp_shard *vs;
+
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+	assert(ls->nshard > 1);
+	AZ(ls->vca_priv);
+
+	ALLOC_OBJ(vs, VCA_TCP_SHARD_MAGIC);
+	AN(vs);
+	Lck_New(&vs->mtx, lck_lsock);
+	vs->vsc = VSC_lsock_New(NULL, &vs->vsc_seg, "%s.%u",
+	    ls->name, ls->shard);
+	ls->vca_priv = vs;
+}
+
+#ifdef VCA_TCP_STEER_CPU
+/*
+ * Send each connection to the socket indexed by the CPU which received
+ * it, modulo the number of sockets.  The index of a socket in the group
+ * is the order in which they started listening, which is shard order.
+ */
+
+static int
+vca_tcp_steer_cpu(const struct listen_sock *ls)
+{
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, ls->nshard },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof code / sizeof code[0];
+	prog.filter = code;
+	return (setsockopt(ls->sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+	    &prog, sizeof prog));
+}
+#endif
+
 static int
 vca_tcp_listen(struct cli *cli, struct listen_sock *ls)
 {
@@ -289,6 +372,17 @@ vca_tcp_listen(struct cli *cli, struct listen_sock *ls)
 		    "Kernel filtering: sock=%d, errno=%d %s",
 		    ls->sock, errno, VAS_errtxt(errno));
 
+	if (ls->nshard > 1)
+		vca_tcp_shard_init(ls);
+
+#ifdef VCA_TCP_STEER_CPU
+	if (ls->steer_cpu && ls->shard + 1 == ls->nshard &&
+	    vca_tcp_steer_cpu(ls))
+		VSL(SLT_Error, NO_VXID,
+		    "Reuseport CPU steering: sock=%d, errno=%d %s",
+		    ls->sock, errno, VAS_errtxt(errno));
+#endif
+
 	return (0);
 }
 
@@ -317,6 +411,9 @@ vca_tcp_event(struct cli *cli, struct listen_sock *ls, enum vca_event event)
 	(void) ls; // XXX const?
 	switch (event) {
 	case VCA_EVENT_LADDR:
+		/* The shards of an address are listed once */
+		if (ls->shard > 0)
+			break;
 		VTCP_myname(ls->sock, h, sizeof h, p, sizeof p);
 		VCLI_Out(cli, "%s %s %s\n", ls->name, h, p);
 		break;
@@ -430,6 +527,7 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 	struct listen_sock *ls;
 	struct wrk_accept wa;
 	struct poolsock *ps;
+	struct vca_tcp_shard *vs;
 	int i;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -441,6 +539,9 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 	while (!pool_accepting)
 		VTIM_sleep(.1);
 
+	/* Set up by vca_tcp_listen() */
+	CAST_OBJ(vs, ls->vca_priv, VCA_TCP_SHARD_MAGIC);
+
 	/* Dont hold on to (possibly) discarded VCLs */
 	if (wrk->wpriv->vcl != NULL)
 		VCL_Rel(&wrk->wpriv->vcl);
@@ -508,6 +609,12 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 
 		wa.acceptsock = i;
 
+		if (vs != NULL) {
+			Lck_Lock(&vs->mtx);
+			vs->vsc->accept++;
+			Lck_Unlock(&vs->mtx);
+		}
+
 		if (!Pool_Task_Arg(wrk, TASK_QUEUE_REQ,
 		    vca_tcp_make_session, &wa, sizeof wa)) {
 			/*
@@ -540,6 +647,9 @@ vca_tcp_accept(struct pool *pp)
 	VTAILQ_FOREACH(ls, &TCP_acceptor.socks, vcalist) {
 		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
 
+		if (!vca_tcp_shard_match(ls, pp))
+			continue;
+
 		ALLOC_OBJ(ps, POOLSOCK_MAGIC);
 		AN(ps);
 		ps->lsock = ls;
@@ -551,11 +661,46 @@ vca_tcp_accept(struct pool *pp)
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Update the accept queue gauges of the reuseport shards.  For a socket
+ * in the listen state, Linux reports the current and maximum length of
+ * the accept queue in tcpi_unacked and tcpi_sacked.
+ */
+
+static void
+vca_tcp_shard_stats(pthread_mutex_t *shut_mtx)
+{
+#if defined(HAVE_STRUCT_TCP_INFO_TCPI_UNACKED) && defined(TCP_INFO)
+	struct listen_sock *ls;
+	struct vca_tcp_shard *vs;
+	struct tcp_info ti;
+	socklen_t l;
+
+	PTOK(pthread_mutex_lock(shut_mtx));
+	VTAILQ_FOREACH(ls, &TCP_acceptor.socks, vcalist) {
+		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+		CAST_OBJ(vs, ls->vca_priv, VCA_TCP_SHARD_MAGIC);
+		if (vs == NULL || ls->sock < 0)
+			continue;
+		l = sizeof ti;
+		if (getsockopt(ls->sock, IPPROTO_TCP, TCP_INFO, &ti, &l))
+			continue;
+		vs->vsc->queue = ti.tcpi_unacked;
+		vs->vsc->queue_max = ti.tcpi_sacked;
+	}
+	PTOK(pthread_mutex_unlock(shut_mtx));
+#else
+	(void)shut_mtx;
+#endif
+}
+
 static void
 vca_tcp_update(pthread_mutex_t *shut_mtx)
 {
 	struct listen_sock *ls;
 
+	vca_tcp_shard_stats(shut_mtx);
+
 	if (!vca_tcp_sockopt_init())
 		return;
 
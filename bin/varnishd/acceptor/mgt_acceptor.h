@@ -41,6 +41,8 @@ struct listen_arg {
 	VTAILQ_HEAD(,listen_sock)	socks;
 	const struct transport		*transport;
 	const struct uds_perms		*perms;
+	unsigned			reuseport;
+	unsigned			steer_cpu;
 };
 
 void VCA_Add(struct acceptor *);
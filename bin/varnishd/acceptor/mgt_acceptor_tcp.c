@@ -71,7 +71,10 @@ vca_tcp_opensocket(struct listen_sock *ls)
 		closefd(&ls->sock);
 	}
 
-	ls->sock = VTCP_bind(ls->addr, NULL);
+	if (ls->nshard > 1)
+		ls->sock = VTCP_bind_reuseport(ls->addr, NULL);
+	else
+		ls->sock = VTCP_bind(ls->addr, NULL);
 	fail = errno;
 
 	if (ls->sock < 0) {
@@ -92,6 +95,7 @@ vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
 	struct listen_sock *ls;
 	char abuf[VTCP_ADDRBUFSIZE], pbuf[VTCP_PORTBUFSIZE];
 	char nbuf[VTCP_ADDRBUFSIZE+VTCP_PORTBUFSIZE+2];
+	unsigned u, n;
 	int fail;
 
 	CAST_OBJ_NOTNULL(la, priv, LISTEN_ARG_MAGIC);
@@ -104,57 +108,69 @@ vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
 			    ls->endpoint, la->endpoint);
 	}
 
-	ALLOC_OBJ(ls, LISTEN_SOCK_MAGIC);
-	AN(ls);
+	/*
+	 * With reuseport=N, we open N sockets with SO_REUSEPORT on the
+	 * same address, and the thread pools share them out between them.
+	 */
+	n = vmax(la->reuseport, 1U);
+	for (u = 0; u < n; u++) {
+		ALLOC_OBJ(ls, LISTEN_SOCK_MAGIC);
+		AN(ls);
+
+		ls->sock = -1;
+		ls->vca = &TCP_acceptor;
+
+		ls->addr = VSA_Clone(sa);
+		AN(ls->addr);
+
+		REPLACE(ls->endpoint, la->endpoint);
+		ls->name = la->name;
+		ls->transport = la->transport;
+		ls->perms = la->perms;
+		ls->shard = u;
+		ls->nshard = n;
+		ls->steer_cpu = la->steer_cpu;
 
-	ls->sock = -1;
-	ls->vca = &TCP_acceptor;
-
-	ls->addr = VSA_Clone(sa);
-	AN(ls->addr);
-
-	REPLACE(ls->endpoint, la->endpoint);
-	ls->name = la->name;
-	ls->transport = la->transport;
-	ls->perms = la->perms;
+		VJ_master(JAIL_MASTER_PRIVPORT);
+		fail = vca_tcp_opensocket(ls);
+		VJ_master(JAIL_MASTER_LOW);
 
-	VJ_master(JAIL_MASTER_PRIVPORT);
-	fail = vca_tcp_opensocket(ls);
-	VJ_master(JAIL_MASTER_LOW);
+		if (fail) {
+			VSA_free(&ls->addr);
+			free(ls->endpoint);
+			FREE_OBJ(ls);
+			if (fail != EAFNOSUPPORT || u > 0)
+				ARGV_ERR("Could not get socket %s: %s\n",
+				    la->endpoint, VAS_errtxt(fail));
+			return (0);
+		}
 
-	if (fail) {
-		VSA_free(&ls->addr);
-		free(ls->endpoint);
-		FREE_OBJ(ls);
-		if (fail != EAFNOSUPPORT)
-			ARGV_ERR("Could not get socket %s: %s\n",
-			    la->endpoint, VAS_errtxt(fail));
-		return (0);
-	}
+		AZ(ls->uds);
+
+		if (VSA_Port(ls->addr) == 0) {
+			/*
+			 * If the argv port number is zero, we adopt whatever
+			 * port number this VTCP_bind() found us, as if
+			 * it was specified by the argv.  The other shards
+			 * then bind to the same port.
+			 */
+			VSA_free(&ls->addr);
+			ls->addr = VTCP_my_suckaddr(ls->sock);
+			VTCP_myname(ls->sock, abuf, sizeof abuf,
+			    pbuf, sizeof pbuf);
+			if (VSA_Get_Proto(sa) == AF_INET6)
+				bprintf(nbuf, "[%s]:%s", abuf, pbuf);
+			else
+				bprintf(nbuf, "%s:%s", abuf, pbuf);
+			REPLACE(ls->endpoint, nbuf);
+			sa = ls->addr;
+		}
 
-	AZ(ls->uds);
-
-	if (VSA_Port(ls->addr) == 0) {
-		/*
-		 * If the argv port number is zero, we adopt whatever
-		 * port number this VTCP_bind() found us, as if
-		 * it was specified by the argv.
-		 */
-		VSA_free(&ls->addr);
-		ls->addr = VTCP_my_suckaddr(ls->sock);
-		VTCP_myname(ls->sock, abuf, sizeof abuf,
-		    pbuf, sizeof pbuf);
-		if (VSA_Get_Proto(sa) == AF_INET6)
-			bprintf(nbuf, "[%s]:%s", abuf, pbuf);
-		else
-			bprintf(nbuf, "%s:%s", abuf, pbuf);
-		REPLACE(ls->endpoint, nbuf);
+		VTAILQ_INSERT_TAIL(&la->socks, ls, arglist);
+		VTAILQ_INSERT_TAIL(&heritage.socks, ls, list);
+		VTAILQ_INSERT_TAIL(&TCP_acceptor.socks, ls, vcalist);
 	}
 
-	VTAILQ_INSERT_TAIL(&la->socks, ls, arglist);
-	VTAILQ_INSERT_TAIL(&heritage.socks, ls, list);
-	VTAILQ_INSERT_TAIL(&TCP_acceptor.socks, ls, vcalist);
-
 	return (0);
 }
 
@@ -174,6 +190,8 @@ vca_tcp_open(char **av, struct listen_arg *la, const char **err)
 		    " absolute paths in -a (%s)\n", la->endpoint);
 
 	for (int i = 0; av[i] != NULL; i++) {
+		const char *val;
+
 		if (strchr(av[i], '=') == NULL) {
 			if (xp != NULL)
 				ARGV_ERR("Too many protocol sub-args"
@@ -184,9 +202,47 @@ vca_tcp_open(char **av, struct listen_arg *la, const char **err)
 			continue;
 		}
 
+		val = keyval(av[i], "reuseport=");
+		if (val != NULL && la->reuseport != 0)
+			ARGV_ERR("Too many reuseport sub-args in -a (%s)\n",
+			    av[i]);
+		if (val != NULL) {
+			unsigned long n;
+			char *p;
+
+			n = strtoul(val, &p, 10);
+			if (*val == '\0' || *p != '\0' || n < 1 ||
+			    n > VCA_TCP_MAX_SHARD)
+				ARGV_ERR("Invalid reuseport sub-arg %s in -a"
+				    " (1 to %d)\n", val, VCA_TCP_MAX_SHARD);
+#ifndef SO_REUSEPORT
+			ARGV_ERR("SO_REUSEPORT is not supported on this"
+			    " platform (-a %s)\n", av[i]);
+#endif
+			la->reuseport = n;
+			continue;
+		}
+
+		val = keyval(av[i], "reuseport_steer=");
+		if (val != NULL) {
+			if (strcmp(val, "cpu"))
+				ARGV_ERR("Invalid reuseport_steer sub-arg %s"
+				    " in -a (only 'cpu')\n", val);
+#if !defined(SO_ATTACH_REUSEPORT_CBPF) || !defined(HAVE_LINUX_FILTER_H)
+			ARGV_ERR("reuseport_steer is not supported on this"
+			    " platform (-a %s)\n", av[i]);
+#endif
+			la->steer_cpu = 1;
+			continue;
+		}
+
 		ARGV_ERR("Invalid sub-arg %s in -a\n", av[i]);
 	}
 
+	if (la->steer_cpu && la->reuseport < 2)
+		ARGV_ERR("reuseport_steer requires reuseport=2 or more"
+		    " in -a (%s)\n", la->endpoint);
+
 	if (xp == NULL)
 		xp = XPORT_Find("http");
 
@@ -527,8 +527,14 @@ vbe_dir_http1pipe(VRT_CTX, VCL_BACKEND d)
 				deadline = cache_param->pipe_task_deadline;
 			if (deadline > 0.)
 				deadline += ctx->req->sp->t_idle;
+			/*
+			 * A connection stolen from the pool is still
+			 * watched by its waiter, and it is shut down
+			 * when we are done with it, so it cannot be
+			 * handed off to a tunnel thread.
+			 */
 			retval = V1P_Process(ctx->req, *PFD_Fd(pfd), &v1a,
-			    deadline);
+			    deadline, PFD_State(pfd) == PFD_STATE_USED);
 		}
 		VSLb_ts_req(ctx->req, "PipeSess", W_TIM_real(ctx->req->wrk));
 		ctx->bo->htc->doclose = retval;
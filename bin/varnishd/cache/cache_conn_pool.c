@@ -357,7 +357,7 @@ VCP_Recycle(const struct worker *wrk, struct pfd **pfdp)
 	pfd->state = PFD_STATE_AVAIL;
 	pfd->waited->func = vcp_handle;
 	pfd->waited->tmo = cache_param->backend_idle_timeout;
-	if (Wait_Enter(wrk->pool->waiter, pfd->waited)) {
+	if (Wait_Enter(Pool_Waiter(wrk->pool, pfd->fd), pfd->waited)) {
 		cp->methods->close(pfd);
 		memset(pfd, 0x33, sizeof *pfd);
 		free(pfd);
@@ -31,6 +31,8 @@
 
 #include "config.h"
 
+#include <sys/uio.h>
+
 #include "cache_varnishd.h"
 #include "cache_filter.h"
 #include "cache_objhead.h"
@@ -124,11 +126,25 @@ VDP_Init(struct vdp_ctx *vdc, struct worker *wrk, struct vsl_log *vsl,
  * r < 0:  Error, breaks out early on an error condition
  * r == 0: Continue
  * r > 0:  Stop, breaks out early without error condition
+ *
+ * VDP_extent
+ *
+ * Like VDP_bytes, but the bytes can also be read from the file
+ * descriptor fd at offset off.  They are passed as a file extent to
+ * the next delivery processor if it has the capability, as bytes
+ * otherwise.  A negative fd means there is no file.
+ *
+ * VDP_bytesv
+ *
+ * Like VDP_bytes, for the bytes of several buffers in one call.  If
+ * the next delivery processor cannot take them at once, it gets one
+ * call per buffer, with act on the last one only.
  */
 
-int
-VDP_bytes(struct vdp_ctx *vdc, enum vdp_action act,
-    const void *ptr, ssize_t len)
+static int
+vdp_call(struct vdp_ctx *vdc, enum vdp_action act,
+    const void *ptr, ssize_t len, int fd, off_t off,
+    const struct iovec *iov, int niov)
 {
 	int retval;
 	struct vdp_entry *vdpe;
@@ -153,7 +169,13 @@ VDP_bytes(struct vdp_ctx *vdc, enum vdp_action act,
 	vdc->nxt = VTAILQ_NEXT(vdpe, list);
 	vdpe->calls++;
 	vdc->bytes_done = len;
-	retval = vdpe->vdp->bytes(vdc, act, &vdpe->priv, ptr, len);
+	if (iov != NULL)
+		retval = vdpe->vdp->bytesv(vdc, act, &vdpe->priv, iov, niov);
+	else if (fd >= 0 && vdpe->vdp->extent != NULL)
+		retval = vdpe->vdp->extent(vdc, act, &vdpe->priv, ptr, len,
+		    fd, off);
+	else
+		retval = vdpe->vdp->bytes(vdc, act, &vdpe->priv, ptr, len);
 	vdpe->bytes_in += vdc->bytes_done;
 	if (retval && (vdc->retval == 0 || retval < vdc->retval))
 		vdc->retval = retval; /* Latch error value */
@@ -161,6 +183,56 @@ VDP_bytes(struct vdp_ctx *vdc, enum vdp_action act,
 	return (vdc->retval);
 }
 
+int
+VDP_bytes(struct vdp_ctx *vdc, enum vdp_action act,
+    const void *ptr, ssize_t len)
+{
+
+	return (vdp_call(vdc, act, ptr, len, -1, 0, NULL, 0));
+}
+
+int
+VDP_extent(struct vdp_ctx *vdc, enum vdp_action act,
+    const void *ptr, ssize_t len, int fd, off_t off)
+{
+
+	assert(fd >= 0);
+	assert(off >= 0);
+	return (vdp_call(vdc, act, ptr, len, fd, off, NULL, 0));
+}
+
+int
+VDP_bytesv(struct vdp_ctx *vdc, enum vdp_action act,
+    const struct iovec *iov, int niov)
+{
+	struct vdp_entry *vdpe;
+	ssize_t len = 0;
+	int i;
+
+	CHECK_OBJ_NOTNULL(vdc, VDP_CTX_MAGIC);
+	AN(iov);
+	assert(niov > 0);
+	if (vdc->retval)
+		return (vdc->retval);
+	vdpe = vdc->nxt;
+	CHECK_OBJ_NOTNULL(vdpe, VDP_ENTRY_MAGIC);
+
+	if (vdpe->vdp->bytesv == NULL) {
+		for (i = 0; i < niov; i++) {
+			if (VDP_bytes(vdc, i + 1 < niov ? VDP_NULL : act,
+			    iov[i].iov_base, iov[i].iov_len))
+				break;
+		}
+		return (vdc->retval);
+	}
+
+	for (i = 0; i < niov; i++) {
+		assert(iov[i].iov_len > 0);
+		len += iov[i].iov_len;
+	}
+	return (vdp_call(vdc, act, NULL, len, -1, 0, iov, niov));
+}
+
 int
 VDP_Push(VRT_CTX, struct vdp_ctx *vdc, struct ws *ws, const struct vdp *vdp,
     void *priv)
@@ -244,25 +316,45 @@ VDP_Close(struct vdp_ctx *vdc, struct objcore *oc, struct boc *boc)
 
 /*--------------------------------------------------------------------*/
 
-int v_matchproto_(objiterate_f)
-VDP_ObjIterate(void *priv, unsigned flush, const void *ptr, ssize_t len)
+static enum vdp_action
+vdp_flush2action(unsigned flush)
 {
-	enum vdp_action act;
 
 	if (flush == 0)
-		act = VDP_NULL;
+		return (VDP_NULL);
 	else if ((flush & OBJ_ITER_END) != 0)
-		act = VDP_END;
+		return (VDP_END);
 	else
-		act = VDP_FLUSH;
+		return (VDP_FLUSH);
+}
 
-	return (VDP_bytes(priv, act, ptr, len));
+int v_matchproto_(objiterate_f)
+VDP_ObjIterate(void *priv, unsigned flush, const void *ptr, ssize_t len)
+{
+
+	return (VDP_bytes(priv, vdp_flush2action(flush), ptr, len));
+}
+
+static int v_matchproto_(objextent_f)
+vdp_objextent(void *priv, unsigned flush, const void *ptr, ssize_t len,
+    int fd, off_t off)
+{
+
+	return (VDP_extent(priv, vdp_flush2action(flush), ptr, len, fd, off));
+}
+
+static int v_matchproto_(objiteratev_f)
+vdp_objiteratev(void *priv, unsigned flush, const struct iovec *iov, int niov)
+{
+
+	return (VDP_bytesv(priv, vdp_flush2action(flush), iov, niov));
 }
 
 
 int
 VDP_DeliverObj(struct vdp_ctx *vdc, struct objcore *oc)
 {
+	struct vdp_entry *vdpe;
 	int r, final;
 
 	CHECK_OBJ_NOTNULL(vdc, VDP_CTX_MAGIC);
@@ -273,7 +365,17 @@ VDP_DeliverObj(struct vdp_ctx *vdc, struct objcore *oc)
 	vdc->hp = NULL;
 	vdc->clen = NULL;
 	final = oc->flags & OC_F_TRANSIENT ? 1 : 0;
-	r = ObjIterate(vdc->wrk, oc, vdc, VDP_ObjIterate, final);
+	vdpe = VTAILQ_FIRST(&vdc->vdp);
+	/* Storage freed as it is delivered cannot be handed out as extents */
+	if (vdpe != NULL && vdpe->vdp->bytesv != NULL)
+		r = ObjIterateV(vdc->wrk, oc, vdc, VDP_ObjIterate,
+		    vdpe->vdp->extent != NULL && !final ? vdp_objextent : NULL,
+		    vdp_objiteratev, final);
+	else if (vdpe != NULL && vdpe->vdp->extent != NULL && !final)
+		r = ObjIterateExtent(vdc->wrk, oc, vdc, VDP_ObjIterate,
+		    vdp_objextent, final);
+	else
+		r = ObjIterate(vdc->wrk, oc, vdc, VDP_ObjIterate, final);
 	if (r < 0)
 		return (r);
 	return (0);
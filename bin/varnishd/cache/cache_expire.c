@@ -41,6 +41,27 @@
 
 #include "vbh.h"
 #include "vtim.h"
+#include "vtw.h"
+
+#include "VSC_exp.h"
+
+/*--------------------------------------------------------------------
+ * The expiry machinery is split into exp_partitions partitions, each
+ * with its own inbox, binheap and thread.  Objects are assigned to a
+ * partition by a hash of their objcore address.
+ *
+ * With exp_wheel_tick set, a timer wheel is used instead of the binheap.
+ * Objects are then expired up to one tick late.
+ *
+ * The MAIN counters are kept in the worker stats of the partition
+ * threads.  Those updated by other threads are counted in the partition
+ * under its lock and collected by its thread.
+ *
+ * For the lag gauge one inbox entry at a time is marked along with its
+ * enqueue time.  When the thread takes the marked entry, its age is
+ * reported and the last entry added to the tail, enqueued at t_tail,
+ * is marked next.  Entries added to the head are taken before it.
+ */
 
 struct exp_priv {
 	unsigned			magic;
@@ -49,17 +70,46 @@ struct exp_priv {
 	struct lock			mtx;
 	VSTAILQ_HEAD(,objcore)		inbox;
 	pthread_cond_t			condvar;
+	struct objcore			*lag_oc;
+	struct objcore			*tail_oc;
+	vtim_real			t_lag;
+	vtim_real			t_tail;
+	uint64_t			n_mailed;
+	uint64_t			n_superseded;
+	struct VSC_exp			*vsc;
+	struct vsc_seg			*vsc_seg;
 
 	/* owned by exp thread */
 	struct worker			*wrk;
 	struct vsl_log			vsl;
 	struct vbh			*heap;
+	struct vtw			*wheel;
 	pthread_t			thread;
 };
 
-static struct exp_priv *exphdl;
+static struct exp_priv **exphdl;
+static unsigned exp_npart;
+static vtim_dur exp_tick;
 static int exp_shutdown = 0;
 
+static struct exp_priv *
+exp_priv_get(const struct objcore *oc)
+{
+	struct exp_priv *ep;
+	uint64_t h;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(exphdl);
+	if (exp_npart == 1) {
+		ep = exphdl[0];
+	} else {
+		h = (uint64_t)(uintptr_t)oc * 0x9e3779b97f4a7c15ULL;
+		ep = exphdl[(h >> 32) % exp_npart];
+	}
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
+	return (ep);
+}
+
 /*--------------------------------------------------------------------
  * Calculate an object's effective ttl time, taking req.ttl into account
  * if it is available.
@@ -101,26 +151,41 @@ EXP_Ttl_grace(const struct req *req, const struct objcore *oc)
  */
 
 static void
-exp_mail_it(struct objcore *oc, uint8_t cmds)
+exp_mail_it(struct exp_priv *ep, struct objcore *oc, uint8_t cmds)
 {
+	vtim_real now;
+
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
 	AZ(cmds & OC_EF_REFD);
 
-	Lck_AssertHeld(&exphdl->mtx);
+	Lck_AssertHeld(&ep->mtx);
 
 	if (oc->exp_flags & OC_EF_REFD) {
 		if (!(oc->exp_flags & OC_EF_POSTED)) {
-			if (cmds & OC_EF_REMOVE)
-				VSTAILQ_INSERT_HEAD(&exphdl->inbox,
+			now = VTIM_real();
+			if (VSTAILQ_EMPTY(&ep->inbox)) {
+				ep->lag_oc = oc;
+				ep->t_lag = now;
+				ep->tail_oc = oc;
+				ep->t_tail = now;
+			}
+			if (cmds & OC_EF_REMOVE) {
+				VSTAILQ_INSERT_HEAD(&ep->inbox,
 				    oc, exp_list);
-			else
-				VSTAILQ_INSERT_TAIL(&exphdl->inbox,
+			} else {
+				VSTAILQ_INSERT_TAIL(&ep->inbox,
 				    oc, exp_list);
-			VSC_C_main->exp_mailed++;
+				ep->tail_oc = oc;
+				ep->t_tail = now;
+			}
+			ep->n_mailed++;
+			ep->vsc->mailed++;
+			ep->vsc->inbox++;
 		}
 		oc->exp_flags |= cmds | OC_EF_POSTED;
-		PTOK(pthread_cond_signal(&exphdl->condvar));
+		PTOK(pthread_cond_signal(&ep->condvar));
 	}
 }
 
@@ -151,14 +216,16 @@ EXP_RefNewObjcore(struct objcore *oc)
 void
 EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 {
+	struct exp_priv *ep;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_ORNULL(new_oc, OBJCORE_MAGIC);
 
 	if (oc->exp_flags & OC_EF_REFD) {
-		Lck_Lock(&exphdl->mtx);
+		ep = exp_priv_get(oc);
+		Lck_Lock(&ep->mtx);
 		if (new_oc != NULL)
-			VSC_C_main->n_superseded++;
+			ep->n_superseded++;
 		if (oc->exp_flags & OC_EF_NEW) {
 			/* EXP_Insert has not been called for this object
 			 * yet. Mark it for removal, and EXP_Insert will
@@ -166,8 +233,8 @@ EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 			AZ(oc->exp_flags & OC_EF_POSTED);
 			oc->exp_flags |= OC_EF_REMOVE;
 		} else
-			exp_mail_it(oc, OC_EF_REMOVE);
-		Lck_Unlock(&exphdl->mtx);
+			exp_mail_it(ep, oc, OC_EF_REMOVE);
+		Lck_Unlock(&ep->mtx);
 	}
 }
 
@@ -182,6 +249,7 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 {
 	unsigned remove_race = 0;
 	struct objcore *tmpoc;
+	struct exp_priv *ep;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -197,7 +265,8 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 
 	ObjSendEvent(wrk, oc, OEV_INSERT);
 
-	Lck_Lock(&exphdl->mtx);
+	ep = exp_priv_get(oc);
+	Lck_Lock(&ep->mtx);
 	AN(oc->exp_flags & OC_EF_NEW);
 	oc->exp_flags &= ~OC_EF_NEW;
 	AZ(oc->exp_flags & (OC_EF_INSERT | OC_EF_MOVE | OC_EF_POSTED));
@@ -206,8 +275,8 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 		remove_race = 1;
 		oc->exp_flags &= ~(OC_EF_REFD | OC_EF_REMOVE);
 	} else
-		exp_mail_it(oc, OC_EF_INSERT | OC_EF_MOVE);
-	Lck_Unlock(&exphdl->mtx);
+		exp_mail_it(ep, oc, OC_EF_INSERT | OC_EF_MOVE);
+	Lck_Unlock(&ep->mtx);
 
 	if (remove_race) {
 		ObjSendEvent(wrk, oc, OEV_EXPIRE);
@@ -250,6 +319,7 @@ void
 EXP_Rearm(struct objcore *oc, vtim_real now,
     vtim_dur ttl, vtim_dur grace, vtim_dur keep)
 {
+	struct exp_priv *ep;
 	vtim_real when;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -271,17 +341,36 @@ EXP_Rearm(struct objcore *oc, vtim_real now,
 	    oc->timer_when, when, oc->flags);
 
 	if (when < oc->t_origin || when < oc->timer_when) {
-		Lck_Lock(&exphdl->mtx);
+		ep = exp_priv_get(oc);
+		Lck_Lock(&ep->mtx);
 		if (oc->exp_flags & OC_EF_NEW) {
 			/* EXP_Insert has not been called yet, do nothing
 			 * as the initial insert will execute the move
 			 * operation. */
 		} else
-			exp_mail_it(oc, OC_EF_MOVE);
-		Lck_Unlock(&exphdl->mtx);
+			exp_mail_it(ep, oc, OC_EF_MOVE);
+		Lck_Unlock(&ep->mtx);
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Remove an object from the binheap or timer wheel
+ */
+
+static void
+exp_delete(struct exp_priv *ep, struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (ep->wheel != NULL)
+		VTW_delete(ep->wheel, oc->timer_idx);
+	else
+		VBH_delete(ep->heap, oc->timer_idx);
+	assert(oc->timer_idx == VBH_NOIDX);
+	ep->vsc->objects--;
+}
+
 /*--------------------------------------------------------------------
  * Handle stuff in the inbox
  */
@@ -300,7 +389,7 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, double now)
 	if (flags & OC_EF_REMOVE) {
 		if (!(flags & OC_EF_INSERT)) {
 			assert(oc->timer_idx != VBH_NOIDX);
-			VBH_delete(ep->heap, oc->timer_idx);
+			exp_delete(ep, oc);
 		}
 		assert(oc->timer_idx == VBH_NOIDX);
 		assert(oc->refcnt > 0);
@@ -329,11 +418,18 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, double now)
 
 	if (flags & OC_EF_INSERT) {
 		assert(oc->timer_idx == VBH_NOIDX);
-		VBH_insert(exphdl->heap, oc);
+		if (ep->wheel != NULL)
+			VTW_insert(ep->wheel, oc, oc->timer_when);
+		else
+			VBH_insert(ep->heap, oc);
+		ep->vsc->objects++;
 		assert(oc->timer_idx != VBH_NOIDX);
 	} else if (flags & OC_EF_MOVE) {
 		assert(oc->timer_idx != VBH_NOIDX);
-		VBH_reorder(exphdl->heap, oc->timer_idx);
+		if (ep->wheel != NULL)
+			VTW_reorder(ep->wheel, oc->timer_idx, oc->timer_when);
+		else
+			VBH_reorder(ep->heap, oc->timer_idx);
 		assert(oc->timer_idx != VBH_NOIDX);
 	} else {
 		WRONG("Objcore state wrong in inbox");
@@ -341,19 +437,26 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, double now)
 }
 
 /*--------------------------------------------------------------------
- * Expire stuff from the binheap
+ * Expire stuff from the binheap or timer wheel
  */
 
 static vtim_real
 exp_expire(struct exp_priv *ep, vtim_real now)
 {
 	struct objcore *oc;
+	vtim_real tnext;
 
 	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 
-	oc = VBH_root(ep->heap);
-	if (oc == NULL)
-		return (now + 355. / 113.);
+	if (ep->wheel != NULL) {
+		oc = VTW_next(ep->wheel, now, &tnext);
+		if (oc == NULL)
+			return (tnext > 0. ? tnext : now + 355. / 113.);
+	} else {
+		oc = VBH_root(ep->heap);
+		if (oc == NULL)
+			return (now + 355. / 113.);
+	}
 	VSLb(&ep->vsl, SLT_ExpKill, "EXP_Inspect p=%p e=%.6f f=0x%x", oc,
 	    oc->timer_when - now, oc->flags);
 
@@ -363,7 +466,8 @@ exp_expire(struct exp_priv *ep, vtim_real now)
 	if (oc->timer_when > now)
 		return (oc->timer_when);
 
-	VSC_C_main->n_expired++;
+	ep->wrk->stats->n_expired++;
+	ep->vsc->expired++;
 
 	Lck_Lock(&ep->mtx);
 	if (oc->exp_flags & OC_EF_POSTED) {
@@ -377,10 +481,9 @@ exp_expire(struct exp_priv *ep, vtim_real now)
 		if (!(oc->flags & OC_F_DYING))
 			HSH_Kill(oc);
 
-		/* Remove from binheap */
+		/* Remove from binheap or timer wheel */
 		assert(oc->timer_idx != VBH_NOIDX);
-		VBH_delete(ep->heap, oc->timer_idx);
-		assert(oc->timer_idx == VBH_NOIDX);
+		exp_delete(ep, oc);
 
 		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 		VSLb(&ep->vsl, SLT_ExpKill, "EXP_Expired x=%ju t=%.0f h=%jd",
@@ -431,17 +534,40 @@ exp_thread(struct worker *wrk, void *priv)
 	VSL_Setup(&ep->vsl, NULL, 0);
 	AZ(wrk->vsl);
 	wrk->vsl = &ep->vsl;
-	ep->heap = VBH_new(NULL, object_cmp, object_update);
-	AN(ep->heap);
+	if (exp_tick > 0.) {
+		ep->wheel = VTW_new(NULL, object_update, exp_tick,
+		    VTIM_real());
+		AN(ep->wheel);
+	} else {
+		ep->heap = VBH_new(NULL, object_cmp, object_update);
+		AN(ep->heap);
+	}
 	while (exp_shutdown == 0) {
 
 		Lck_Lock(&ep->mtx);
+		wrk->stats->exp_mailed += ep->n_mailed;
+		wrk->stats->n_superseded += ep->n_superseded;
+		ep->n_mailed = 0;
+		ep->n_superseded = 0;
 		oc = VSTAILQ_FIRST(&ep->inbox);
 		CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
 		if (oc != NULL) {
 			assert(oc->refcnt >= 1);
 			VSTAILQ_REMOVE(&ep->inbox, oc, objcore, exp_list);
-			VSC_C_main->exp_received++;
+			wrk->stats->exp_received++;
+			ep->vsc->received++;
+			ep->vsc->inbox--;
+			if (oc == ep->lag_oc) {
+				ep->vsc->lag = (uint64_t)
+				    ((VTIM_real() - ep->t_lag) * 1e6);
+				ep->lag_oc = ep->tail_oc;
+				ep->t_lag = ep->t_tail;
+			}
+			if (VSTAILQ_EMPTY(&ep->inbox)) {
+				ep->vsc->lag = 0;
+				ep->lag_oc = NULL;
+				ep->tail_oc = NULL;
+			}
 			tnext = 0;
 			flags = oc->exp_flags;
 			if (flags & OC_EF_REMOVE)
@@ -473,33 +599,52 @@ EXP_Init(void)
 {
 	struct exp_priv *ep;
 	pthread_t pt;
-
-	ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
-	AN(ep);
-
-	Lck_New(&ep->mtx, lck_exp);
-	PTOK(pthread_cond_init(&ep->condvar, NULL));
-	VSTAILQ_INIT(&ep->inbox);
-	WRK_BgThread(&pt, "cache-exp", exp_thread, ep);
-	ep->thread = pt;
-	exphdl = ep;
+	unsigned u;
+
+	exp_npart = cache_param->exp_partitions;
+	exp_tick = cache_param->exp_wheel_tick;
+	assert(exp_npart > 0);
+	exphdl = calloc(exp_npart, sizeof *exphdl);
+	AN(exphdl);
+
+	for (u = 0; u < exp_npart; u++) {
+		ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
+		AN(ep);
+
+		Lck_New(&ep->mtx, lck_exp);
+		PTOK(pthread_cond_init(&ep->condvar, NULL));
+		VSTAILQ_INIT(&ep->inbox);
+		ep->vsc = VSC_exp_New(NULL, &ep->vsc_seg, "%u", u);
+		AN(ep->vsc);
+		exphdl[u] = ep;
+		WRK_BgThread(&pt, "cache-exp", exp_thread, ep);
+		ep->thread = pt;
+	}
 }
 
 void
 EXP_Shutdown(void)
 {
-	struct exp_priv *ep = exphdl;
+	struct exp_priv *ep;
 	void *status;
+	unsigned u;
 
-	Lck_Lock(&ep->mtx);
-	exp_shutdown = 1;
-	PTOK(pthread_cond_signal(&ep->condvar));
-	Lck_Unlock(&ep->mtx);
+	for (u = 0; u < exp_npart; u++) {
+		ep = exphdl[u];
+		CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
+		Lck_Lock(&ep->mtx);
+		exp_shutdown = 1;
+		PTOK(pthread_cond_signal(&ep->condvar));
+		Lck_Unlock(&ep->mtx);
+	}
 
-	AN(ep->thread);
-	PTOK(pthread_join(ep->thread, &status));
-	AZ(status);
-	memset(&ep->thread, 0, sizeof ep->thread);
+	for (u = 0; u < exp_npart; u++) {
+		ep = exphdl[u];
+		AN(ep->thread);
+		PTOK(pthread_join(ep->thread, &status));
+		AZ(status);
+		memset(&ep->thread, 0, sizeof ep->thread);
+	}
 
 	/* XXX could cleanup more - not worth it for now */
 }
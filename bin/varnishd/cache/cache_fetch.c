@@ -99,7 +99,10 @@ vbf_allocobj(struct busyobj *bo, unsigned l)
 	if (stv == NULL)
 		return (0);
 
-	if (STV_NewObject(bo->wrk, oc, stv, l))
+	/* Transient is the fallback, admission does not apply to it */
+	if ((stv == stv_transient ||
+	    LRU_Admit(bo->wrk, stv, oc, http_GetContentLength(bo->beresp))) &&
+	    STV_NewObject(bo->wrk, oc, stv, l))
 		return (1);
 
 	if (stv == stv_transient)
@@ -164,7 +167,7 @@ Bereq_Rollback(VRT_CTX)
 static int
 vbf_beresp2obj(struct busyobj *bo)
 {
-	unsigned l, l2;
+	unsigned l, l2, l3 = 0;
 	const char *b;
 	uint8_t *bp;
 	struct vsb *vary = NULL;
@@ -203,6 +206,11 @@ vbf_beresp2obj(struct busyobj *bo)
 	    bo->uncacheable ? HTTPH_A_PASS : HTTPH_A_INS);
 	l += l2;
 
+	if (cache_param->http1_hdr_block && !bo->uncacheable) {
+		l3 = HTTP1_EstimateBlock(bo->beresp, HTTPH_A_INS);
+		l += PRNDUP(l3);
+	}
+
 	if (bo->uncacheable)
 		oc->flags |= OC_F_HFM;
 
@@ -229,6 +237,12 @@ vbf_beresp2obj(struct busyobj *bo)
 	HTTP_Encode(bo->beresp, bp, l2,
 	    bo->uncacheable ? HTTPH_A_PASS : HTTPH_A_INS);
 
+	if (l3 > 0) {
+		bp = ObjSetAttr(bo->wrk, oc, OA_HTTP1HDR, l3, NULL);
+		AN(bp);
+		HTTP1_EncodeBlock(bo->beresp, bp, l3, HTTPH_A_INS);
+	}
+
 	if (http_GetHdr(bo->beresp, H_Last_Modified, &b))
 		AZ(ObjSetDouble(bo->wrk, oc, OA_LASTMODIFIED, VTIM_parse(b)));
 	else
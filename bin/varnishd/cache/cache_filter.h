@@ -29,6 +29,7 @@
  *
  */
 
+struct iovec;
 struct req;
 struct vfp_entry;
 struct vfp_ctx;
@@ -125,12 +126,30 @@ typedef int vdp_fini_f(struct vdp_ctx *, void **priv);
 typedef int vdp_bytes_f(struct vdp_ctx *, enum vdp_action, void **priv,
     const void *ptr, ssize_t len);
 
+/*
+ * Optional: Like vdp_bytes_f, but the len bytes at ptr can also be found
+ * at offset off of file descriptor fd, so the VDP may send them from
+ * there.  VDPs without an extent function get the bytes.
+ */
+typedef int vdp_extent_f(struct vdp_ctx *, enum vdp_action, void **priv,
+    const void *ptr, ssize_t len, int fd, off_t off);
+
+/*
+ * Optional: Like vdp_bytes_f, but for the bytes of niov (> 0) non-empty
+ * buffers, in order.  VDPs without a bytesv function get one bytes call
+ * per buffer.
+ */
+typedef int vdp_bytesv_f(struct vdp_ctx *, enum vdp_action, void **priv,
+    const struct iovec *iov, int niov);
+
 struct vdp {
 	const char		*name;
 	vdp_init_f		*init;
 	vdp_bytes_f		*bytes;
 	vdp_fini_f		*fini;
 	const void		*priv1;
+	vdp_extent_f		*extent;
+	vdp_bytesv_f		*bytesv;
 };
 
 struct vdp_entry {
@@ -163,6 +182,10 @@ struct vdp_ctx {
 };
 
 int VDP_bytes(struct vdp_ctx *, enum vdp_action act, const void *, ssize_t);
+int VDP_extent(struct vdp_ctx *, enum vdp_action act, const void *, ssize_t,
+    int fd, off_t off);
+int VDP_bytesv(struct vdp_ctx *, enum vdp_action act, const struct iovec *,
+    int niov);
 
 void v_deprecated_ VRT_AddVDP(VRT_CTX, const struct vdp *);
 void v_deprecated_ VRT_RemoveVDP(VRT_CTX, const struct vdp *);
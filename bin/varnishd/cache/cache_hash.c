@@ -158,6 +158,8 @@ HSH_Cleanup(const struct worker *wrk)
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(wrk->wpriv, WORKER_PRIV_MAGIC);
+	if (hash->cleanup != NULL)
+		hash->cleanup(wrk);
 	if (wrk->wpriv->nobjcore != NULL)
 		ObjDestroy(wrk, &wrk->wpriv->nobjcore);
 
@@ -402,6 +404,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 		Lck_Lock(&oh->mtx);
 		req->hash_objhead = NULL;
 	} else {
+		LFU_Access(req->digest);
 		AN(wrk->wpriv->nobjhead);
 		oh = hash->lookup(wrk, req->digest, &wrk->wpriv->nobjhead);
 	}
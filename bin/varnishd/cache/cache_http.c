@@ -42,6 +42,7 @@
 #include "vct.h"
 #include "vend.h"
 #include "vnum.h"
+#include "vsha256.h"
 #include "vtim.h"
 
 #define BODYSTATUS(U, l, n, a, k)				\
@@ -57,11 +58,26 @@
 #define HTTPH(a, b, c) char b[] = "*" a ":";
 #include "tbl/http_headers.h"
 
+enum http_hdx_e {
+#define HTTPH(a, b, c) HDX_##b,
+#include "tbl/http_headers.h"
+	HTTP_HDX_N
+};
+
+static hdr_t http_hdx_hdr[HTTP_HDX_N] = {
+#define HTTPH(a, b, c) [HDX_##b] = b,
+#include "tbl/http_headers.h"
+};
+
+#define HTTP_HDX_SZ	PRNDUP(sizeof(uint8_t) * HTTP_HDX_N)
+#define HTTP_HDX_FAR	UINT8_MAX
+
 const char H__Status[]	= "\010:status:";
 const char H__Proto[]	= "\007:proto:";
 const char H__Reason[]	= "\010:reason:";
 
 static char * via_hdr;
+static uint32_t http_hdx_key;	/* Identifies tbl/http_headers.h */
 
 /*--------------------------------------------------------------------
  * Perfect hash to rapidly recognize headers from tbl/http_headers.h
@@ -111,6 +127,7 @@ static const unsigned char http_asso_values[256] = {
 static struct http_hdrflg {
 	char		*hdr;
 	unsigned	flag;
+	enum http_hdx_e	hdx;
 } http_hdrflg[GPERF_MAX_HASH_VALUE + 1] = {
 	{ NULL }, { NULL }, { NULL }, { NULL },
 	{ H_Date },
@@ -199,6 +216,9 @@ http_hdr_flags(const char *b, const char *e)
 	retval = &http_hdrflg[u];
 	if (retval->hdr == NULL)
 		return (NULL);
+	/* Only a prefix would match otherwise, "Conten" for Content-Encoding */
+	if (e - b != retval->hdr[0] - 1)
+		return (NULL);
 	if (!http_hdr_at(retval->hdr + 1, b, e - b))
 		return (NULL);
 	return (retval);
@@ -207,7 +227,7 @@ http_hdr_flags(const char *b, const char *e)
 /*--------------------------------------------------------------------*/
 
 static void
-http_init_hdr(char *hdr, int flg)
+http_init_hdr(char *hdr, int flg, enum http_hdx_e hdx)
 {
 	struct http_hdrflg *f;
 
@@ -216,16 +236,91 @@ http_init_hdr(char *hdr, int flg)
 	AN(f);
 	assert(f->hdr == hdr);
 	f->flag = flg;
+	f->hdx = hdx;
+}
+
+/*--------------------------------------------------------------------
+ * Index of the well-known headers from tbl/http_headers.h
+ *
+ * hp->hdx[] has the position of the first instance of each well-known
+ * header in hp->hd[], or zero if there is none, so that looking them
+ * up does not need a linear search.  Positions from HTTP_HDX_FAR on do
+ * not fit in a slot, which then only says that the search can start
+ * there.  Anything changing the header fields from position n onwards
+ * must call http_hdx_reindex(hp, n).
+ *
+ * A struct http which was not made by HTTP_create() has no index.
+ */
+
+static struct http_hdrflg *
+http_hdx_flags(const txt *hh)
+{
+	const char *e;
+
+	Tcheck(*hh);
+	e = memchr(hh->b, ':', vmin_t(size_t, Tlen(*hh),
+	    GPERF_MAX_WORD_LENGTH + 1));
+	if (e == NULL)
+		return (NULL);
+	return (http_hdr_flags(hh->b, e));
+}
+
+static void
+http_hdx_add(const struct http *hp, unsigned u)
+{
+	const struct http_hdrflg *f;
+
+	assert(u >= HTTP_HDR_FIRST);
+	assert(u < hp->nhd);
+	f = http_hdx_flags(&hp->hd[u]);
+	if (f == NULL)
+		return;
+	if (hp->hdx[f->hdx] == 0 || hp->hdx[f->hdx] > u)
+		hp->hdx[f->hdx] = (uint8_t)vmin_t(unsigned, u, HTTP_HDX_FAR);
+}
+
+static void
+http_hdx_reindex(const struct http *hp, unsigned n)
+{
+	unsigned u;
+
+	if (hp->hdx == NULL)
+		return;
+	n = vmin_t(unsigned, n, HTTP_HDX_FAR);
+	for (u = 0; u < HTTP_HDX_N; u++)
+		if (hp->hdx[u] >= n)
+			hp->hdx[u] = 0;
+	for (u = vmax_t(unsigned, n, HTTP_HDR_FIRST); u < hp->nhd; u++)
+		http_hdx_add(hp, u);
+}
+
+/* For the protocol parsers, which append header fields themselves */
+
+void
+HTTP_IndexHdr(struct http *hp, unsigned u)
+{
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	if (hp->hdx != NULL)
+		http_hdx_add(hp, u);
 }
 
 void
 HTTP_Init(void)
 {
 	struct vsb *vsb;
+	VSHA256_CTX sha256ctx;
+	unsigned char digest[VSHA256_LEN];
 
-#define HTTPH(a, b, c) http_init_hdr(b, c);
+#define HTTPH(a, b, c) http_init_hdr(b, c, HDX_##b);
 #include "tbl/http_headers.h"
 
+	VSHA256_Init(&sha256ctx);
+#define HTTPH(a, b, c) VSHA256_Update(&sha256ctx, a, sizeof a);
+#include "tbl/http_headers.h"
+	VSHA256_Final(digest, &sha256ctx);
+	http_hdx_key = vbe32dec(digest);
+
 	vsb = VSB_new_auto();
 	AN(vsb);
 	VSB_printf(vsb, "1.1 %s (Varnish/" PACKAGE_BRANCH ")",
@@ -335,7 +430,8 @@ HTTP_estimate(unsigned nhttp)
 {
 
 	/* XXX: We trust the structs to size-aligned as necessary */
-	return (PRNDUP(sizeof(struct http) + sizeof(txt) * nhttp + nhttp));
+	return (PRNDUP(sizeof(struct http) + sizeof(txt) * nhttp +
+	    HTTP_HDX_SZ + nhttp));
 }
 
 struct http *
@@ -347,7 +443,8 @@ HTTP_create(void *p, uint16_t nhttp, unsigned len)
 	hp->magic = HTTP_MAGIC;
 	hp->hd = (void*)(hp + 1);
 	hp->shd = nhttp;
-	hp->hdf = (void*)(hp->hd + nhttp);
+	hp->hdx = (void*)(hp->hd + nhttp);
+	hp->hdf = (unsigned char *)hp->hdx + HTTP_HDX_SZ;
 	assert((unsigned char*)p + len == hp->hdf + PRNDUP(nhttp));
 	return (hp);
 }
@@ -380,6 +477,8 @@ http_Teardown(struct http *hp)
 	memset(&hp->nhd, 0, sizeof *hp - offsetof(struct http, nhd));
 	memset(hp->hd, 0, sizeof *hp->hd * hp->shd);
 	memset(hp->hdf, 0, sizeof *hp->hdf * hp->shd);
+	if (hp->hdx != NULL)
+		memset(hp->hdx, 0, sizeof *hp->hdx * HTTP_HDX_N);
 }
 
 /*--------------------------------------------------------------------
@@ -396,6 +495,10 @@ HTTP_Dup(struct http *to, const struct http * fm)
 	memcpy(to->hd, fm->hd, fm->nhd * sizeof *to->hd);
 	memcpy(to->hdf, fm->hdf, fm->nhd * sizeof *to->hdf);
 	to->nhd = fm->nhd;
+	if (to->hdx != NULL && fm->hdx != NULL)
+		memcpy(to->hdx, fm->hdx, sizeof *to->hdx * HTTP_HDX_N);
+	else
+		http_hdx_reindex(to, 0);
 	to->logtag = fm->logtag;
 	to->status = fm->status;
 	to->protover = fm->protover;
@@ -454,6 +557,8 @@ http_SetH(struct http *to, unsigned n, const char *header)
 	http_VSLH(to, n);
 	if (n == HTTP_HDR_PROTO)
 		http_Proto(to);
+	if (n >= HTTP_HDR_FIRST)
+		http_hdx_reindex(to, n);
 }
 
 /*--------------------------------------------------------------------*/
@@ -494,9 +599,22 @@ http_IsHdr(const txt *hh, hdr_t hdr)
 static unsigned
 http_findhdr(const struct http *hp, unsigned l, const char *hdr)
 {
-	unsigned u;
+	const struct http_hdrflg *f;
+	unsigned u = HTTP_HDR_FIRST;
+
+	if (hp->hdx != NULL) {
+		f = http_hdr_flags(hdr, hdr + l);
+		if (f != NULL && hp->hdx[f->hdx] < HTTP_HDX_FAR) {
+			u = hp->hdx[f->hdx];
+			assert(u == 0 || u < hp->nhd);
+			assert(u == 0 || http_hdr_at(hdr, hp->hd[u].b, l + 1));
+			return (u);
+		}
+		if (f != NULL)
+			u = HTTP_HDX_FAR;
+	}
 
-	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+	for (; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
 		if (hp->hd[u].e < hp->hd[u].b + l + 1)
 			continue;
@@ -521,7 +639,10 @@ http_CountHdr(const struct http *hp, hdr_t hdr)
 
 	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
 
-	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+	u = http_findhdr(hp, hdr[0] - 1, hdr + 1);
+	if (u == 0)
+		return (0);
+	for (; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
 		if (http_IsHdr(&hp->hd[u], hdr))
 			retval++;
@@ -590,6 +711,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 				VSLbs(hp->vsl, SLT_LostHeader,
 				    TOSTRAND(hdr + 1));
 				WS_Release(hp->ws, 0);
+				http_hdx_reindex(hp, f + 1);
 				return;
 			}
 			memcpy(b, hp->hd[f].b, x);
@@ -612,6 +734,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 			http_fail(hp);
 			VSLbs(hp->vsl, SLT_LostHeader, TOSTRAND(hdr + 1));
 			WS_Release(hp->ws, 0);
+			http_hdx_reindex(hp, f + 1);
 			return;
 		}
 		memcpy(b, sep, lsep);
@@ -622,6 +745,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 	if (b == NULL)
 		return;
 	hp->nhd = (uint16_t)d;
+	http_hdx_reindex(hp, f + 1);
 	AN(e);
 	*b = '\0';
 	hp->hd[f].b = WS_Reservation(hp->ws);
@@ -1221,6 +1345,64 @@ http_IsFiltered(const struct http *fm, unsigned u, unsigned how)
 	return (http_isfiltered(fm, u, how));
 }
 
+/*--------------------------------------------------------------------
+ * The packed headers of an object (OA_HEADERS) are:
+ *
+ *	be16	zero
+ *	be16	status
+ *	u8	HTTP_PACK_VERSION
+ *	be32	key of the well-known header table, http_hdx_key
+ *	be16	number of fields, n
+ *	be32	offset of each field from the first one, and of the end, n + 1
+ *	u8	well-known header index of each field or HTTP_PACK_NOHDX, n
+ *	:proto:, :status:, :reason: and the headers, NUL terminated
+ *	'\0'
+ *
+ * The original format started with the number of fields plus one
+ * instead of zero, and had neither the version nor the tables.  It is
+ * no longer decoded, persistent silos which could hold it are not
+ * loaded (SMP_MAJOR_VERSION).  The index table is only used if it was
+ * built from the same tbl/http_headers.h, which the key, a hash of the
+ * names in table order, tells.
+ */
+
+#define HTTP_PACK_VERSION	1
+#define HTTP_PACK_HDR		11
+#define HTTP_PACK_NOHDX		0xff
+
+v_static_assert(HTTP_HDX_N < HTTP_PACK_NOHDX, "too many well-known headers");
+
+struct http_pack {
+	const char		*fields;
+	unsigned		n;
+	const uint8_t		*off;
+	const uint8_t		*hdx;
+};
+
+static void
+http_pack_open(struct http_pack *hpk, const uint8_t *ptr)
+{
+
+	AN(ptr);
+	memset(hpk, 0, sizeof *hpk);
+	AZ(vbe16dec(ptr));
+	assert(ptr[4] == HTTP_PACK_VERSION);
+	hpk->n = vbe16dec(ptr + 9);
+	assert(hpk->n >= HTTP_HDR_FIRST - HTTP_HDR_PROTO);
+	hpk->off = ptr + HTTP_PACK_HDR;
+	if (vbe32dec(ptr + 5) == http_hdx_key)
+		hpk->hdx = hpk->off + 4 * (hpk->n + 1);
+	hpk->fields = (const char *)(hpk->off + 5 * hpk->n + 4);
+}
+
+static inline const char *
+http_pack_field(const struct http_pack *hpk, unsigned i)
+{
+
+	assert(i <= hpk->n);
+	return (hpk->fields + vbe32dec(hpk->off + 4 * i));
+}
+
 /*--------------------------------------------------------------------
  * Estimate how much workspace we need to Filter this header according
  * to 'how'.
@@ -1231,7 +1413,7 @@ http_EstimateWS(const struct http *fm, unsigned how)
 {
 	unsigned u, l;
 
-	l = 4;
+	l = HTTP_PACK_HDR + 4;
 	CHECK_OBJ_NOTNULL(fm, HTTP_MAGIC);
 	for (u = 0; u < fm->nhd; u++) {
 		if (u == HTTP_HDR_METHOD || u == HTTP_HDR_URL)
@@ -1239,89 +1421,155 @@ http_EstimateWS(const struct http *fm, unsigned how)
 		Tcheck(fm->hd[u]);
 		if (http_isfiltered(fm, u, how))
 			continue;
-		l += Tlen(fm->hd[u]) + 1L;
+		l += Tlen(fm->hd[u]) + 6L;
 	}
 	return (PRNDUP(l + 1L));
 }
 
 /*--------------------------------------------------------------------
  * Encode http struct as byte string.
- *
- * XXX: We could save considerable special-casing below by encoding also
- * XXX: H__Status, H__Reason and H__Proto into the string, but it would
- * XXX: add 26-30 bytes to all encoded objects to save a little code.
- * XXX: It could possibly be a good idea for later HTTP versions.
  */
 
 void
 HTTP_Encode(const struct http *fm, uint8_t *p0, unsigned l, unsigned how)
 {
-	unsigned u, w;
-	uint16_t n;
-	uint8_t *p, *e;
+	const struct http_hdrflg *f;
+	unsigned u, w, n, i;
+	uint8_t *p, *e, *off, *hdx;
+	const uint8_t *f0;
 
 	AN(p0);
 	AN(l);
+	CHECK_OBJ_NOTNULL(fm, HTTP_MAGIC);
+	assert(fm->nhd <= fm->shd);
+
+	for (n = u = 0; u < fm->nhd; u++) {
+		if (u == HTTP_HDR_METHOD || u == HTTP_HDR_URL)
+			continue;
+		if (!http_isfiltered(fm, u, how))
+			n++;
+	}
+	assert(n <= UINT16_MAX);
+
 	p = p0;
 	e = p + l;
-	assert(p + 5 <= e);
-	assert(fm->nhd <= fm->shd);
-	n = HTTP_HDR_FIRST - 3;
+	assert(p + HTTP_PACK_HDR + 5 * n + 5 <= e);
+	vbe16enc(p, 0);
 	vbe16enc(p + 2, fm->status);
-	p += 4;
-	CHECK_OBJ_NOTNULL(fm, HTTP_MAGIC);
-	for (u = 0; u < fm->nhd; u++) {
+	p[4] = HTTP_PACK_VERSION;
+	vbe32enc(p + 5, http_hdx_key);
+	vbe16enc(p + 9, n);
+	off = p + HTTP_PACK_HDR;
+	hdx = off + 4 * (n + 1);
+	f0 = p = hdx + n;
+
+	for (i = u = 0; u < fm->nhd; u++) {
 		if (u == HTTP_HDR_METHOD || u == HTTP_HDR_URL)
 			continue;
 		Tcheck(fm->hd[u]);
 		if (http_isfiltered(fm, u, how))
 			continue;
 		http_VSLH(fm, u);
+		f = NULL;
+		if (u >= HTTP_HDR_FIRST)
+			f = http_hdx_flags(&fm->hd[u]);
+		assert(i < n);
+		vbe32enc(off + 4 * i, p - f0);
+		hdx[i] = f == NULL ? HTTP_PACK_NOHDX : f->hdx;
 		w = Tlen(fm->hd[u]) + 1L;
 		assert(p + w + 1 <= e);
 		memcpy(p, fm->hd[u].b, w);
 		p += w;
-		n++;
+		i++;
 	}
+	assert(i == n);
+	vbe32enc(off + 4 * n, p - f0);
 	*p++ = '\0';
 	assert(p <= e);
-	vbe16enc(p0, n + 1);
 }
 
 /*--------------------------------------------------------------------
  * Decode byte string into http struct
+ *
+ * The fields are referenced in place, and the well-known header index
+ * is filled in from the packed table instead of looking at the names.
  */
 
 int
 HTTP_Decode(struct http *to, const uint8_t *fm)
 {
+	struct http_pack hpk[1];
+	unsigned i, u;
+	uint8_t x;
 
 	CHECK_OBJ_NOTNULL(to, HTTP_MAGIC);
 	AN(to->vsl);
 	AN(fm);
-	if (vbe16dec(fm) <= to->shd) {
-		to->status = vbe16dec(fm + 2);
-		fm += 4;
-		for (to->nhd = 0; to->nhd < to->shd; to->nhd++) {
-			if (to->nhd == HTTP_HDR_METHOD ||
-			    to->nhd == HTTP_HDR_URL) {
-				to->hd[to->nhd].b = NULL;
-				to->hd[to->nhd].e = NULL;
-				continue;
-			}
-			if (*fm == '\0')
-				return (0);
-			to->hd[to->nhd].b = (const void*)fm;
-			fm = (const void*)strchr((const void*)fm, '\0');
-			to->hd[to->nhd].e = (const void*)fm;
-			fm++;
-			http_VSLH(to, to->nhd);
-		}
+
+	http_pack_open(hpk, fm);
+	if (hpk->n + HTTP_HDR_PROTO > to->shd) {
+		VSLb(to->vsl, SLT_Error,
+		    "Too many headers to Decode object (%u vs. %u)",
+		    hpk->n + HTTP_HDR_PROTO, to->shd);
+		return (-1);
+	}
+
+	to->nhd = 0;
+	http_hdx_reindex(to, 0);
+	to->status = vbe16dec(fm + 2);
+	to->hd[HTTP_HDR_METHOD].b = NULL;
+	to->hd[HTTP_HDR_METHOD].e = NULL;
+	to->hd[HTTP_HDR_URL].b = NULL;
+	to->hd[HTTP_HDR_URL].e = NULL;
+	for (i = 0; i < hpk->n; i++) {
+		u = i + HTTP_HDR_PROTO;
+		to->hd[u].b = http_pack_field(hpk, i);
+		to->hd[u].e = http_pack_field(hpk, i + 1) - 1;
+		AZ(*to->hd[u].e);
+		to->hdf[u] = 0;
+		http_VSLH(to, u);
+		if (to->hdx == NULL || hpk->hdx == NULL)
+			continue;
+		x = hpk->hdx[i];
+		if (x == HTTP_PACK_NOHDX || to->hdx[x] != 0)
+			continue;
+		assert(x < HTTP_HDX_N);
+		/* Trust the stored index no further than the name */
+		if (http_IsHdr(&to->hd[u], http_hdx_hdr[x]))
+			to->hdx[x] = (uint8_t)vmin_t(unsigned, u,
+			    HTTP_HDX_FAR);
+	}
+	to->nhd = (uint16_t)(hpk->n + HTTP_HDR_PROTO);
+	if (hpk->hdx == NULL)
+		http_hdx_reindex(to, 0);
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Check that the status line and the headers of a decoded http are
+ * still the packed fields themselves, and return how many headers
+ * follow them, or -1 if any of them was changed.
+ */
+
+int
+HTTP_DecodedPrefix(const struct http *hp, const uint8_t *fm)
+{
+	struct http_pack hpk[1];
+	unsigned i, u;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	AN(fm);
+
+	http_pack_open(hpk, fm);
+	if (hpk->n + HTTP_HDR_PROTO > hp->nhd)
+		return (-1);
+	for (i = HTTP_HDR_STATUS - HTTP_HDR_PROTO; i < hpk->n; i++) {
+		u = i + HTTP_HDR_PROTO;
+		if (hp->hd[u].b != http_pack_field(hpk, i) ||
+		    hp->hd[u].e != http_pack_field(hpk, i + 1) - 1)
+			return (-1);
 	}
-	VSLb(to->vsl, SLT_Error,
-	    "Too many headers to Decode object (%u vs. %u)",
-	    vbe16dec(fm), to->shd);
-	return (-1);
+	return (hp->nhd - (hpk->n + HTTP_HDR_PROTO));
 }
 
 /*--------------------------------------------------------------------*/
@@ -1342,6 +1590,7 @@ HTTP_GetStatusPack(struct worker *wrk, struct objcore *oc)
 int
 HTTP_IterHdrPack(struct worker *wrk, struct objcore *oc, const char **p)
 {
+	struct http_pack hpk[1];
 	const char *ptr;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -1350,12 +1599,8 @@ HTTP_IterHdrPack(struct worker *wrk, struct objcore *oc, const char **p)
 
 	if (*p == NULL) {
 		ptr = ObjGetAttr(wrk, oc, OA_HEADERS, NULL);
-		AN(ptr);
-		ptr += 4;	/* Skip nhd and status */
-		ptr = strchr(ptr, '\0') + 1;	/* Skip :proto: */
-		ptr = strchr(ptr, '\0') + 1;	/* Skip :status: */
-		ptr = strchr(ptr, '\0') + 1;	/* Skip :reason: */
-		*p = ptr;
+		http_pack_open(hpk, (const void *)ptr);
+		*p = http_pack_field(hpk, HTTP_HDR_FIRST - HTTP_HDR_PROTO);
 	} else {
 		*p = strchr(*p, '\0') + 1;	/* Skip to next header */
 	}
@@ -1367,6 +1612,9 @@ HTTP_IterHdrPack(struct worker *wrk, struct objcore *oc, const char **p)
 const char *
 HTTP_GetHdrPack(struct worker *wrk, struct objcore *oc, hdr_t hdr)
 {
+	struct http_pack hpk[1];
+	const struct http_hdrflg *f;
+	const uint8_t *x;
 	const char *ptr;
 	unsigned l;
 
@@ -1380,11 +1628,12 @@ HTTP_GetHdrPack(struct worker *wrk, struct objcore *oc, hdr_t hdr)
 	assert(hdr[l] == ':');
 	hdr++;
 
+	ptr = ObjGetAttr(wrk, oc, OA_HEADERS, NULL);
+	http_pack_open(hpk, (const void *)ptr);
+
 	if (hdr[0] == ':') {
 		/* Special cases */
-		ptr = ObjGetAttr(wrk, oc, OA_HEADERS, NULL);
-		AN(ptr);
-		ptr += 4;	/* Skip nhd and status */
+		ptr = hpk->fields;
 
 		/* XXX: should we also have h2_hdr_eq() ? */
 		if (!strcmp(hdr, ":proto:"))
@@ -1398,6 +1647,22 @@ HTTP_GetHdrPack(struct worker *wrk, struct objcore *oc, hdr_t hdr)
 		WRONG("Unknown magic packed header");
 	}
 
+	f = NULL;
+	if (hpk->hdx != NULL)
+		f = http_hdr_flags(hdr, hdr + l - 1);
+	if (f != NULL) {
+		x = memchr(hpk->hdx, f->hdx, hpk->n);
+		if (x == NULL)
+			return (NULL);
+		ptr = http_pack_field(hpk, x - hpk->hdx);
+		if (http_hdr_at(ptr, hdr, l)) {
+			ptr += l;
+			while (vct_islws(*ptr))
+				ptr++;
+			return (ptr);
+		}
+	}
+
 	HTTP_FOREACH_PACK(wrk, oc, ptr) {
 		if (http_hdr_at(ptr, hdr, l)) {
 			ptr += l;
@@ -1418,6 +1683,7 @@ HTTP_GetHdrPack(struct worker *wrk, struct objcore *oc, hdr_t hdr)
 void
 HTTP_Merge(struct worker *wrk, struct objcore *oc, struct http *to)
 {
+	struct http_pack hpk[1];
 	const char *ptr;
 	unsigned u;
 	const char *p;
@@ -1428,10 +1694,10 @@ HTTP_Merge(struct worker *wrk, struct objcore *oc, struct http *to)
 	CHECK_OBJ_NOTNULL(to, HTTP_MAGIC);
 
 	ptr = ObjGetAttr(wrk, oc, OA_HEADERS, NULL);
-	AN(ptr);
+	http_pack_open(hpk, (const void *)ptr);
 
 	to->status = vbe16dec(ptr + 2);
-	ptr += 4;
+	ptr = hpk->fields;
 
 	for (u = 0; u < HTTP_HDR_FIRST; u++) {
 		if (u == HTTP_HDR_METHOD || u == HTTP_HDR_URL)
@@ -1490,6 +1756,7 @@ http_FilterReq(struct http *to, const struct http *fm, unsigned how)
 		http_VSLH(to, to->nhd);
 		to->nhd++;
 	}
+	http_hdx_reindex(to, 0);
 }
 
 /*--------------------------------------------------------------------
@@ -1627,9 +1894,12 @@ http_ViaHeader(void)
 void
 http_Unset(struct http *hp, hdr_t hdr)
 {
-	uint16_t u, v;
+	uint16_t f, u, v;
 
-	for (v = u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+	f = http_findhdr(hp, hdr[0] - 1, hdr + 1);
+	if (f == 0)
+		return;
+	for (v = u = f; u < hp->nhd; u++) {
 		Tcheck(hp->hd[u]);
 		if (http_IsHdr(&hp->hd[u], hdr)) {
 			http_VSLH_del(hp, u);
@@ -1642,4 +1912,5 @@ http_Unset(struct http *hp, hdr_t hdr)
 		v++;
 	}
 	hp->nhd = v;
+	http_hdx_reindex(hp, f);
 }
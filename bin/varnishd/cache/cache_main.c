@@ -462,7 +462,6 @@ child_main(int sigmagic, size_t altstksz)
 	VBE_InitCfg();
 	Pool_Init();
 	V1P_Init();
-	V2D_Init();
 
 	EXP_Init();
 	HSH_Init(heritage.hash);
@@ -470,6 +469,7 @@ child_main(int sigmagic, size_t altstksz)
 
 	VCA_Init();
 
+	LFU_Init();
 	STV_open();
 
 	VMOD_Init();
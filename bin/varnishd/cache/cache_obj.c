@@ -183,6 +183,52 @@ ObjIterate(struct worker *wrk, struct objcore *oc,
 	return (om->objiterator(wrk, oc, priv, func, final));
 }
 
+/*====================================================================
+ * ObjIterateExtent()
+ *
+ * Like ObjIterate(), but chunks which the storage can locate in a file
+ * are passed to efunc with the file descriptor and offset, so they can
+ * be sent without going through user space.  Other chunks, and all of
+ * them if the storage has no notion of files, go to func.
+ */
+
+int
+ObjIterateExtent(struct worker *wrk, struct objcore *oc,
+    void *priv, objiterate_f *func, objextent_f *efunc, int final)
+{
+	const struct obj_methods *om = obj_getmethods(oc);
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(func);
+	AN(efunc);
+	if (om->objiterextent == NULL)
+		return (ObjIterate(wrk, oc, priv, func, final));
+	return (om->objiterextent(wrk, oc, priv, func, efunc, final));
+}
+
+/*====================================================================
+ * ObjIterateV()
+ *
+ * Like ObjIterateExtent(), but the storage may pass several chunks to
+ * vfunc at once.  efunc is optional here.
+ */
+
+int
+ObjIterateV(struct worker *wrk, struct objcore *oc, void *priv,
+    objiterate_f *func, objextent_f *efunc, objiteratev_f *vfunc, int final)
+{
+	const struct obj_methods *om = obj_getmethods(oc);
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(func);
+	AN(vfunc);
+	if (om->objiterv != NULL)
+		return (om->objiterv(wrk, oc, priv, func, efunc, vfunc, final));
+	if (efunc != NULL)
+		return (ObjIterateExtent(wrk, oc, priv, func, efunc, final));
+	return (ObjIterate(wrk, oc, priv, func, final));
+}
+
 /*====================================================================
  * ObjGetSpace()
  *
@@ -38,6 +38,10 @@ typedef void objsetstate_f(struct worker *, const struct objcore *,
 
 typedef int objiterator_f(struct worker *, struct objcore *,
     void *priv, objiterate_f *func, int final);
+typedef int objiterextent_f(struct worker *, struct objcore *,
+    void *priv, objiterate_f *func, objextent_f *efunc, int final);
+typedef int objiterv_f(struct worker *, struct objcore *, void *priv,
+    objiterate_f *func, objextent_f *efunc, objiteratev_f *vfunc, int final);
 typedef int objgetspace_f(struct worker *, struct objcore *,
      ssize_t *sz, uint8_t **ptr);
 typedef void objextend_f(struct worker *, struct objcore *, ssize_t l);
@@ -64,5 +68,7 @@ struct obj_methods {
 	objslim_f	*objslim;
 	objtouch_f	*objtouch;
 	objsetstate_f	*objsetstate;
+	objiterextent_f	*objiterextent;
+	objiterv_f	*objiterv;
 };
 
@@ -110,6 +110,21 @@ Pool_PurgeStat(unsigned nobj)
 	Lck_Unlock(&wstat_mtx);
 }
 
+/*--------------------------------------------------------------------
+ * Pick the waiter of a pool for a file descriptor
+ */
+
+struct waiter *
+Pool_Waiter(const struct pool *pp, int fd)
+{
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	AN(pp->waiter);
+	assert(pp->nwaiter > 0);
+	assert(fd >= 0);
+	return (pp->waiter[(unsigned)fd % pp->nwaiter]);
+}
+
 /*--------------------------------------------------------------------
  * Special function to summ stats
  */
@@ -154,6 +169,7 @@ pool_mkpool(unsigned pool_no)
 	ALLOC_OBJ(pp, POOL_MAGIC);
 	if (pp == NULL)
 		return (NULL);
+	pp->pool_no = pool_no;
 	pp->a_stat = calloc(1, sizeof *pp->a_stat);
 	AN(pp->a_stat);
 	pp->b_stat = calloc(1, sizeof *pp->b_stat);
@@ -187,7 +203,7 @@ pool_mkpool(unsigned pool_no)
 static void * v_matchproto_()
 pool_poolherder(void *priv)
 {
-	unsigned nwq;
+	unsigned nwq, refused = 0;
 	struct pool *pp, *ppx;
 	uint64_t u;
 	void *rvp;
@@ -208,6 +224,14 @@ pool_poolherder(void *priv)
 				nwq++;
 				continue;
 			}
+		} else if (nwq > cache_param->wthread_pools &&
+				EXPERIMENT(EXPERIMENT_DROP_POOLS) &&
+				!VCA_PoolsRemovable()) {
+			if (!refused)
+				VSL(SLT_Error, NO_VXID,
+				    "Thread pools cannot be dropped"
+				    " with reuseport sockets");
+			refused = 1;
 		} else if (nwq > cache_param->wthread_pools &&
 				EXPERIMENT(EXPERIMENT_DROP_POOLS)) {
 			Lck_Lock(&pool_mtx);
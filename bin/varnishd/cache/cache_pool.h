@@ -42,6 +42,7 @@ struct pool {
 	VTAILQ_HEAD(,poolsock)		poolsocks;
 
 	int				die;
+	unsigned			pool_no;
 	pthread_cond_t			herder_cond;
 	pthread_t			herder_thr;
 
@@ -58,7 +59,8 @@ struct pool {
 
 	struct mempool			*mpl_req;
 	struct mempool			*mpl_sess;
-	struct waiter			*waiter;
+	unsigned			nwaiter;
+	struct waiter			**waiter;
 };
 
 void *pool_herder(void*);
@@ -66,3 +68,4 @@ task_func_t pool_stat_summ;
 extern struct lock			pool_mtx;
 void VCA_NewPool(struct pool *);
 void VCA_DestroyPool(struct pool *);
+int VCA_PoolsRemovable(void);
@@ -31,6 +31,8 @@
 
 #include "config.h"
 
+#include <sys/uio.h>
+
 #include "cache_varnishd.h"
 #include "cache_filter.h"
 
@@ -99,6 +101,50 @@ vrg_range_bytes(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
 	return (retval || act == VDP_END ? 1 : 0);
 }
 
+/*
+ * Buffers entirely within the range, short of its end, are passed on
+ * together, the others are trimmed one by one.
+ */
+
+static int v_matchproto_(vdp_bytesv_f)
+vrg_range_bytesv(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
+    const struct iovec *iov, int niov)
+{
+	int i, first = 0, n = 0, retval = 0;
+	struct vrg_priv *vrg_priv;
+	ssize_t len;
+
+	CHECK_OBJ_NOTNULL(vdc, VDP_CTX_MAGIC);
+	AN(priv);
+	CAST_OBJ_NOTNULL(vrg_priv, *priv, VRG_PRIV_MAGIC);
+	AN(iov);
+	assert(niov > 0);
+
+	for (i = 0; i < niov; i++) {
+		len = iov[i].iov_len;
+		if (vrg_priv->range_off >= vrg_priv->range_low &&
+		    vrg_priv->range_off + len < vrg_priv->range_high) {
+			if (n++ == 0)
+				first = i;
+			vrg_priv->range_off += len;
+			continue;
+		}
+		if (n > 0) {
+			retval = VDP_bytesv(vdc, VDP_NULL, iov + first, n);
+			n = 0;
+			if (retval)
+				break;
+		}
+		retval = vrg_range_bytes(vdc, i + 1 < niov ? VDP_NULL : act,
+		    priv, iov[i].iov_base, len);
+		if (retval)
+			return (retval);
+	}
+	if (retval == 0 && n > 0)
+		retval = VDP_bytesv(vdc, act, iov + first, n);
+	return (retval || act == VDP_END ? 1 : 0);
+}
+
 /*--------------------------------------------------------------------*/
 
 static const char *
@@ -237,6 +283,7 @@ const struct vdp VDP_range = {
 	.name =		"range",
 	.init =		vrg_range_init,
 	.bytes =	vrg_range_bytes,
+	.bytesv =	vrg_range_bytesv,
 	.fini =		vrg_range_fini,
 };
 
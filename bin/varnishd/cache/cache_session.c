@@ -539,7 +539,7 @@ SES_Wait(struct sess *sp, const struct transport *xp)
 	wp->idle = sp->t_idle;
 	wp->func = ses_handle;
 	wp->tmo = SESS_TMO(sp, timeout_idle);
-	if (Wait_Enter(pp->waiter, wp))
+	if (Wait_Enter(Pool_Waiter(pp, wp->fd), wp))
 		SES_Delete(sp, SC_PIPE_OVERFLOW, NAN);
 }
 
@@ -701,7 +701,8 @@ SES_Rel(struct sess *sp)
 void
 SES_NewPool(struct pool *pp, unsigned pool_no)
 {
-	char nb[4 /* "sess" */ + 10 /* "%u" */ + 1];
+	char nb[4 /* "pool" */ + 2 * 10 /* "%u" */ + 2];
+	unsigned u;
 
 	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 	bprintf(nb, "req%u", pool_no);
@@ -711,14 +712,29 @@ SES_NewPool(struct pool *pp, unsigned pool_no)
 	pp->mpl_sess = MPL_New(nb, &cache_param->pool_sess,
 	    &cache_param->workspace_session);
 
-	bprintf(nb, "pool%u", pool_no);
-	pp->waiter = Waiter_New(nb);
+	pp->nwaiter = cache_param->wthread_waiters;
+	assert(pp->nwaiter > 0);
+	pp->waiter = calloc(pp->nwaiter, sizeof *pp->waiter);
+	AN(pp->waiter);
+	for (u = 0; u < pp->nwaiter; u++) {
+		if (u == 0)
+			bprintf(nb, "pool%u", pool_no);
+		else
+			bprintf(nb, "pool%u.%u", pool_no, u);
+		pp->waiter[u] = Waiter_New(nb);
+	}
 }
 
 void
 SES_DestroyPool(struct pool *pp)
 {
+	unsigned u;
+
 	MPL_Destroy(&pp->mpl_req);
 	MPL_Destroy(&pp->mpl_sess);
-	Waiter_Destroy(&pp->waiter);
+	for (u = 0; u < pp->nwaiter; u++)
+		Waiter_Destroy(&pp->waiter[u]);
+	free(pp->waiter);
+	pp->waiter = NULL;
+	pp->nwaiter = 0;
 }
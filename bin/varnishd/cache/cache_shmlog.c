@@ -97,10 +97,23 @@ static pthread_mutex_t vsm_mtx;
 
 static struct VSL_head		*vsl_head;
 static const uint32_t		*vsl_end;
-static uint32_t			*vsl_ptr;
-static unsigned			vsl_segment_n;
 static ssize_t			vsl_segsize;
 
+/*
+ * Writers reserve space without a lock: vsl_res holds the number of laps
+ * through the log in the upper 32 bits, and the offset of the next record
+ * in the lower 32 bits.  The segment ahead of the writers is filled with
+ * end markers, so the end of every reservation is marked for the readers
+ * before any writer can get there.
+ */
+static volatile uint64_t	vsl_res;
+static unsigned			vsl_segment_0;	// segment_n of first lap
+static volatile unsigned	vsl_segment_ok;	// last segment cleared
+
+/* Statistics of threads without a worker, vsl_mtx protected */
+static struct VSC_main_wrk	vsl_nowrk;
+static volatile unsigned	vsl_nowrk_n;
+
 struct VSC_main *VSC_C_main;
 
 static void
@@ -179,77 +192,139 @@ vsl_space(const struct vsl_log *vsl)
 }
 
 /*--------------------------------------------------------------------
- * Wrap the VSL buffer
+ * Statistics go to the worker when there is one, to be summed with the
+ * other worker statistics.
  */
 
 static void
-vsl_wrap(void)
+vsl_stat(unsigned len, unsigned records, unsigned flushes, unsigned cont,
+    unsigned cycles)
 {
+	struct worker *wrk;
+	struct VSC_main_wrk *ds;
 
-	assert(vsl_ptr >= vsl_head->log);
-	assert(vsl_ptr < vsl_end);
-	vsl_segment_n += VSL_SEGMENTS - (vsl_segment_n % VSL_SEGMENTS);
-	assert(vsl_segment_n % VSL_SEGMENTS == 0);
-	vsl_head->offset[0] = 0;
-	vsl_head->log[0] = VSL_ENDMARKER;
-	VWMB();
-	if (vsl_ptr != vsl_head->log) {
-		*vsl_ptr = VSL_WRAPMARKER;
-		vsl_ptr = vsl_head->log;
+	wrk = THR_GetWorker();
+	CHECK_OBJ_ORNULL(wrk, WORKER_MAGIC);
+	if (wrk == NULL) {
+		PTOK(pthread_mutex_lock(&vsl_mtx));
+		ds = &vsl_nowrk;
+		vsl_nowrk_n = 1;
+	} else {
+		ds = wrk->stats;
+		AN(ds);
+		if (vsl_nowrk_n && !pthread_mutex_trylock(&vsl_mtx)) {
+			ds->shm_writes += vsl_nowrk.shm_writes;
+			ds->shm_flushes += vsl_nowrk.shm_flushes;
+			ds->shm_records += vsl_nowrk.shm_records;
+			ds->shm_bytes += vsl_nowrk.shm_bytes;
+			ds->shm_cont += vsl_nowrk.shm_cont;
+			ds->shm_cycles += vsl_nowrk.shm_cycles;
+			memset(&vsl_nowrk, 0, sizeof vsl_nowrk);
+			vsl_nowrk_n = 0;
+			PTOK(pthread_mutex_unlock(&vsl_mtx));
+		}
 	}
-	vsl_head->segment_n = vsl_segment_n;
-	VSC_C_main->shm_cycles++;
+
+	ds->shm_writes++;
+	ds->shm_flushes += flushes;
+	ds->shm_records += records;
+	ds->shm_bytes += VSL_BYTES(VSL_OVERHEAD + VSL_WORDS((uint64_t)len));
+	ds->shm_cont += cont;
+	ds->shm_cycles += cycles;
+
+	if (wrk == NULL)
+		PTOK(pthread_mutex_unlock(&vsl_mtx));
+}
+
+/*--------------------------------------------------------------------
+ * Segment bookkeeping
+ */
+
+static inline unsigned
+vsl_segment(uint64_t res)
+{
+	uint32_t off = (uint32_t)res;
+
+	return (vsl_segment_0 + (unsigned)(res >> 32) * VSL_SEGMENTS +
+	    (unsigned)(off / vsl_segsize));
+}
+
+static void
+vsl_clear(unsigned seg)
+{
+	uint32_t *p, *e;
+
+	p = vsl_head->log + (seg % VSL_SEGMENTS) * vsl_segsize;
+	e = p + vsl_segsize;
+	assert(e <= vsl_end);
+	while (p < e)
+		*p++ = VSL_ENDMARKER;
 }
 
 /*--------------------------------------------------------------------
  * Reserve bytes for a record, wrap if necessary
+ *
+ * The writer whose reservation is the first to reach into a segment
+ * announces it to the readers, and clears the segment after it.  Readers
+ * consider the two segments ahead of segment_n overrun, so that one can
+ * be cleared while other writers fill the new segment.
  */
 
 static uint32_t *
 vsl_get(unsigned len, unsigned records, unsigned flushes)
 {
-	uint32_t *p;
-	int err;
+	uint64_t o, n;
+	uint32_t off, words, *p;
+	unsigned seg, cont = 0, wrap;
+
+	words = VSL_OVERHEAD + VSL_WORDS(len);
+	assert(words < vsl_segsize);
+
+	o = vsl_res;
+	while (1) {
+		off = (uint32_t)o;
+		if (vsl_head->log + off + words >= vsl_end)
+			n = (((o >> 32) + 1) << 32) | words;
+		else
+			n = o + words;
+		if (__sync_bool_compare_and_swap(&vsl_res, o, n))
+			break;
+		cont = 1;
+		o = vsl_res;
+	}
+	wrap = (n >> 32) != (o >> 32);
+	p = vsl_head->log + (uint32_t)n - words;
+	AZ((uintptr_t)p & 0x3);
 
-	err = pthread_mutex_trylock(&vsl_mtx);
-	if (err == EBUSY) {
-		PTOK(pthread_mutex_lock(&vsl_mtx));
-		VSC_C_main->shm_cont++;
-	} else {
-		AZ(err);
+	/* Only write to segments cleared for it */
+	seg = vsl_segment(n);
+	while ((int)(seg - vsl_segment_ok) > 0) {
+		cont = 1;
+		(void)sched_yield();
 	}
-	assert(vsl_ptr < vsl_end);
-	AZ((uintptr_t)vsl_ptr & 0x3);
-
-	VSC_C_main->shm_writes++;
-	VSC_C_main->shm_flushes += flushes;
-	VSC_C_main->shm_records += records;
-	VSC_C_main->shm_bytes +=
-	    VSL_BYTES(VSL_OVERHEAD + VSL_WORDS((uint64_t)len));
-
-	/* Wrap if necessary */
-	if (VSL_END(vsl_ptr, len) >= vsl_end)
-		vsl_wrap();
-
-	p = vsl_ptr;
-	vsl_ptr = VSL_END(vsl_ptr, len);
-	assert(vsl_ptr < vsl_end);
-	AZ((uintptr_t)vsl_ptr & 0x3);
-
-	*vsl_ptr = VSL_ENDMARKER;
-
-	while ((vsl_ptr - vsl_head->log) / vsl_segsize >
-	    vsl_segment_n % VSL_SEGMENTS) {
-		vsl_segment_n++;
-		vsl_head->offset[vsl_segment_n % VSL_SEGMENTS] =
-		    vsl_ptr - vsl_head->log;
+	VRMB();
+
+	if (seg != vsl_segment(o)) {
+		assert(seg == vsl_segment(o) + 1);
+		if (wrap) {
+			AN(off);
+			vsl_head->offset[0] = 0;
+		} else {
+			vsl_head->offset[seg % VSL_SEGMENTS] = (uint32_t)n;
+		}
+		VWMB();
+		vsl_head->segment_n = seg;
+		if (wrap) {
+			/* Readers must see the new segment_n first */
+			VWMB();
+			vsl_head->log[off] = VSL_WRAPMARKER;
+		}
+		vsl_clear(seg + 1);
+		VWMB();
+		vsl_segment_ok = seg + 1;
 	}
 
-	PTOK(pthread_mutex_unlock(&vsl_mtx));
-	/* Implicit VWMB() in mutex op ensures ENDMARKER and new table
-	   values are seen before new segment number */
-	vsl_head->segment_n = vsl_segment_n;
-
+	vsl_stat(len, records, flushes, cont, wrap);
 	return (p);
 }
 
@@ -288,7 +363,7 @@ vslr(enum VSL_tag_e tag, vxid_t vxid, const char *b, unsigned len)
  * Add a unbuffered record to VSL
  *
  * NB: This variant should be used sparingly and only for low volume
- * NB: since it significantly adds to the mutex load on the VSL.
+ * NB: since it takes a reservation in the VSL for every record.
  */
 
 void
@@ -338,25 +413,50 @@ VSL(enum VSL_tag_e tag, vxid_t vxid, const char *fmt, ...)
 
 /*--------------------------------------------------------------------*/
 
+static void
+vsl_batch(const uint32_t *b, unsigned l, unsigned records, unsigned flushes)
+{
+	uint32_t *p;
+
+	assert(l >= 8);
+
+	p = vsl_get(l, records, flushes);
+
+	memcpy(p + VSL_OVERHEAD, b, l);
+	p[1] = l;
+	VWMB();
+	p[0] = ((((unsigned)SLT__Batch & 0xff) << VSL_IDSHIFT));
+}
+
 void
 VSL_Flush(struct vsl_log *vsl, int overflow)
 {
-	uint32_t *p;
-	unsigned l;
+	const uint32_t *b, *e;
+	unsigned l, n;
 
 	vsl_sanity(vsl);
 	l = pdiff(vsl->wlb, vsl->wlp);
 	if (l == 0)
 		return;
 
-	assert(l >= 8);
-
-	p = vsl_get(l, vsl->wlr, overflow);
+	/* Batches larger than a segment are split between records */
+	b = vsl->wlb;
+	while (VSL_OVERHEAD + VSL_WORDS(l) >= vsl_segsize) {
+		e = b;
+		n = 0;
+		do {
+			e = VSL_NEXT(e);
+			n++;
+		} while (VSL_OVERHEAD + (VSL_NEXT(e) - b) < vsl_segsize);
+		assert(n <= vsl->wlr);
+		vsl_batch(b, pdiff(b, e), n, overflow);
+		vsl->wlr -= n;
+		overflow = 0;
+		b = e;
+		l = pdiff(b, vsl->wlp);
+	}
 
-	memcpy(p + VSL_OVERHEAD, vsl->wlb, l);
-	p[1] = l;
-	VWMB();
-	p[0] = ((((unsigned)SLT__Batch & 0xff) << VSL_IDSHIFT));
+	vsl_batch(b, l, vsl->wlr, overflow);
 	vsl->wlp = vsl->wlb;
 	vsl->wlr = 0;
 }
@@ -676,17 +776,20 @@ VSM_Init(void)
 	vsl_segsize = ((cache_param->vsl_space - sizeof *vsl_head) /
 	    sizeof *vsl_end) / VSL_SEGMENTS;
 	vsl_end = vsl_head->log + vsl_segsize * VSL_SEGMENTS;
+	assert(vsl_segsize * VSL_SEGMENTS <= UINT32_MAX);
 	/* Make segment_n always overflow on first log wrap to make any
 	   problems with regard to readers on that event visible */
-	vsl_segment_n = UINT_MAX - (VSL_SEGMENTS - 1);
-	AZ(vsl_segment_n % VSL_SEGMENTS);
-	vsl_ptr = vsl_head->log;
-	*vsl_ptr = VSL_ENDMARKER;
+	vsl_segment_0 = UINT_MAX - (VSL_SEGMENTS - 1);
+	AZ(vsl_segment_0 % VSL_SEGMENTS);
+	vsl_res = 0;
+	vsl_clear(vsl_segment_0);
+	vsl_clear(vsl_segment_0 + 1);
+	vsl_segment_ok = vsl_segment_0 + 1;
 
 	memset(vsl_head, 0, sizeof *vsl_head);
 	vsl_head->segsize = vsl_segsize;
 	vsl_head->offset[0] = 0;
-	vsl_head->segment_n = vsl_segment_n;
+	vsl_head->segment_n = vsl_segment_0;
 	for (u = 1; u < VSL_SEGMENTS; u++)
 		vsl_head->offset[u] = -1;
 	VWMB();
@@ -80,6 +80,7 @@ struct worker_priv {
 	struct objhead		*nobjhead;
 	struct objcore		*nobjcore;
 	void			*nhashpriv;
+	void			*hashpriv;
 	struct vxid_pool	vxid_pool[1];
 	struct vcl		*vcl;
 };
@@ -293,6 +294,8 @@ extern const struct vfp VFP_esi_gzip;
 
 /* cache_http.c */
 void HTTP_Init(void);
+void HTTP_IndexHdr(struct http *, unsigned);
+int HTTP_DecodedPrefix(const struct http *, const uint8_t *);
 
 /* cache_http1_proto.c */
 
@@ -302,6 +305,10 @@ uint16_t HTTP1_DissectResponse(struct http_conn *, struct http *resp,
     const struct http *req);
 struct v1l;
 unsigned HTTP1_Write(struct v1l *v1l, const struct http *hp, const int*);
+unsigned HTTP1_EstimateBlock(const struct http *, unsigned how);
+void HTTP1_EncodeBlock(const struct http *, uint8_t *, unsigned, unsigned how);
+unsigned HTTP1_WriteBlock(struct v1l *, const struct http *, unsigned u,
+    const void *, ssize_t);
 
 /* cache_main.c */
 vxid_t VXID_Get(const struct worker *, uint64_t marker);
@@ -335,6 +342,15 @@ struct objcore * ObjNew(const struct worker *);
 void ObjDestroy(const struct worker *, struct objcore **);
 int ObjGetSpace(struct worker *, struct objcore *, ssize_t *sz, uint8_t **ptr);
 void ObjExtend(struct worker *, struct objcore *, ssize_t l, int final);
+typedef int objextent_f(void *priv, unsigned flush, const void *ptr,
+    ssize_t len, int fd, off_t off);
+int ObjIterateExtent(struct worker *, struct objcore *, void *priv,
+    objiterate_f *func, objextent_f *efunc, int final);
+struct iovec;
+typedef int objiteratev_f(void *priv, unsigned flush, const struct iovec *iov,
+    int niov);
+int ObjIterateV(struct worker *, struct objcore *, void *priv,
+    objiterate_f *func, objextent_f *efunc, objiteratev_f *vfunc, int final);
 uint64_t ObjWaitExtend(const struct worker *, const struct objcore *,
     uint64_t l, enum boc_state_e *statep);
 void ObjSetState(struct worker *, const struct objcore *,
@@ -405,6 +421,7 @@ void Pool_Sumstat(const struct worker *w);
 int Pool_TrySumstat(const struct worker *wrk);
 void Pool_PurgeStat(unsigned nobj);
 int Pool_Task_Any(struct pool_task *task, enum task_prio prio);
+struct waiter *Pool_Waiter(const struct pool *, int fd);
 void pan_pool(struct vsb *);
 
 /* cache_range.c */
@@ -567,9 +584,6 @@ void WS_Rollback(struct ws *, uintptr_t);
 /* http1/cache_http1_pipe.c */
 void V1P_Init(void);
 
-/* cache_http2_deliver.c */
-void V2D_Init(void);
-
 /* stevedore.c */
 void STV_open(void);
 void STV_close(void);
@@ -587,6 +601,10 @@ struct stv_buffer *STV_AllocBuf(struct worker *wrk, const struct stevedore *stv,
 void STV_FreeBuf(struct worker *wrk, struct stv_buffer **pstvbuf);
 void *STV_GetBufPtr(struct stv_buffer *stvbuf, size_t *psize);
 
+/* storage_lfu.c */
+void LFU_Init(void);
+void LFU_Access(const uint8_t *digest);
+
 #ifdef WITH_PERSISTENT_STORAGE
 /* storage_persistent.c */
 void SMP_Ready(void);
@@ -56,6 +56,11 @@ struct listen_sock {
 	struct conn_heritage		*conn_heritage;
 	struct acceptor			*vca;
 	void				*vca_priv;
+
+	/* SO_REUSEPORT shards of the same address */
+	unsigned			shard;
+	unsigned			nshard;
+	unsigned			steer_cpu;
 };
 
 VTAILQ_HEAD(listen_sock_head, listen_sock);
@@ -28,6 +28,20 @@
  * SUCH DAMAGE.
  *
  * A Crit Bit tree based hash
+ *
+ * Lookups and inserts run without a global lock: Readers follow the tree
+ * pointers as they find them, and inserts publish a new node with a
+ * compare-and-swap of the tree pointer they found, after checking the
+ * crit bit of the new node against the subtree it splits.  Deletes are
+ * serialized by hcb_mtx, and mark the pointers they are about to drop
+ * so that inserts racing them fail their compare-and-swap and retry.
+ *
+ * Deleted nodes and objheads are reclaimed with quiescent state based
+ * reclamation: A thread goes "online" with the current epoch when it
+ * starts a lookup and "offline" once it holds a reference to the objhead
+ * it found, and does not look at the tree any more.  The
+ * cleaner thread bumps the epoch and frees what was deleted before it
+ * once no thread is online with an older epoch.
  */
 
 // #define PHK
@@ -41,9 +55,9 @@
 
 #include "hash/hash_slinger.h"
 #include "vmb.h"
-#include "vtim.h"
 
 static struct lock hcb_mtx;
+static pthread_cond_t hcb_cond;
 
 /*---------------------------------------------------------------------
  * Table for finding out how many bits two bytes have in common,
@@ -83,8 +97,9 @@ hcb_build_bittbl(void)
 /*---------------------------------------------------------------------
  * For space reasons we overload the two pointers with two different
  * kinds of of pointers.  We cast them to uintptr_t's and abuse the
- * low two bits to tell them apart, assuming that Varnish will never
- * run on machines with less than 32bit alignment.
+ * low two bits to tell them apart, and the third bit to mark pointers
+ * which are being deleted, assuming that Varnish will never run on
+ * machines with less than 64bit alignment of allocations.
  *
  * Asserts will explode if these assumptions are not met.
  */
@@ -101,6 +116,8 @@ struct hcb_y {
 
 #define HCB_BIT_NODE		(1<<0)
 #define HCB_BIT_Y		(1<<1)
+#define HCB_BIT_DEL		(1<<2)
+#define HCB_BITS		(HCB_BIT_NODE | HCB_BIT_Y | HCB_BIT_DEL)
 
 struct hcb_root {
 	volatile uintptr_t	origo;
@@ -113,6 +130,50 @@ static VSTAILQ_HEAD(, hcb_y)	dead_y = VSTAILQ_HEAD_INITIALIZER(dead_y);
 static VTAILQ_HEAD(, objhead)	cool_h = VTAILQ_HEAD_INITIALIZER(cool_h);
 static VTAILQ_HEAD(, objhead)	dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
 
+/*---------------------------------------------------------------------
+ * Per thread reclamation state
+ */
+
+struct hcb_thr {
+	unsigned		magic;
+#define HCB_THR_MAGIC		0x6ad1c3e5
+	volatile unsigned	epoch;
+	VTAILQ_ENTRY(hcb_thr)	list;
+};
+
+static VTAILQ_HEAD(, hcb_thr)	hcb_thrs = VTAILQ_HEAD_INITIALIZER(hcb_thrs);
+static volatile unsigned	hcb_epoch = 1;
+
+static int
+hcb_cas(volatile uintptr_t *p, uintptr_t o, uintptr_t n)
+{
+
+	return (__sync_bool_compare_and_swap(p, o, n));
+}
+
+static void
+hcb_online(const struct worker *wrk)
+{
+	struct hcb_thr *thr;
+
+	CAST_OBJ_NOTNULL(thr, wrk->wpriv->hashpriv, HCB_THR_MAGIC);
+	AZ(thr->epoch);
+	thr->epoch = hcb_epoch;
+	/* The tree must not be read before the epoch is visible */
+	__sync_synchronize();
+}
+
+static void
+hcb_offline(const struct worker *wrk)
+{
+	struct hcb_thr *thr;
+
+	CAST_OBJ_NOTNULL(thr, wrk->wpriv->hashpriv, HCB_THR_MAGIC);
+	AN(thr->epoch);
+	VWMB();
+	thr->epoch = 0;
+}
+
 /*---------------------------------------------------------------------
  * Pointer accessor functions
  */
@@ -134,7 +195,7 @@ static uintptr_t
 hcb_r_node(const struct objhead *n)
 {
 
-	AZ((uintptr_t)n & (HCB_BIT_NODE | HCB_BIT_Y));
+	AZ((uintptr_t)n & HCB_BITS);
 	return (HCB_BIT_NODE | (uintptr_t)n);
 }
 
@@ -144,7 +205,7 @@ hcb_l_node(uintptr_t u)
 
 	assert(u & HCB_BIT_NODE);
 	AZ(u & HCB_BIT_Y);
-	return ((struct objhead *)(u & ~HCB_BIT_NODE));
+	return ((struct objhead *)(u & ~HCB_BITS));
 }
 
 static uintptr_t
@@ -152,7 +213,7 @@ hcb_r_y(const struct hcb_y *y)
 {
 
 	CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
-	AZ((uintptr_t)y & (HCB_BIT_NODE | HCB_BIT_Y));
+	AZ((uintptr_t)y & HCB_BITS);
 	return (HCB_BIT_Y | (uintptr_t)y);
 }
 
@@ -162,7 +223,14 @@ hcb_l_y(uintptr_t u)
 
 	AZ(u & HCB_BIT_NODE);
 	assert(u & HCB_BIT_Y);
-	return ((struct hcb_y *)(u & ~HCB_BIT_Y));
+	return ((struct hcb_y *)(u & ~HCB_BITS));
+}
+
+static int
+hcb_is_del(uintptr_t u)
+{
+
+	return (u & HCB_BIT_DEL);
 }
 
 /*---------------------------------------------------------------------
@@ -186,13 +254,45 @@ hcb_crit_bit(const uint8_t *digest, const struct objhead *oh2, struct hcb_y *y)
 }
 
 /*---------------------------------------------------------------------
- * Unless we have the lock, we need to be very careful about pointer
- * references into the tree, we cannot trust things to be the same
- * in two consecutive memory accesses.
+ * The crit bit of a new node is found against the leaf of the first
+ * walk, but a delete can remove that leaf and splice its sibling up
+ * before the second walk.  Check it against a leaf of the subtree we
+ * are about to split instead: all of its leaves differ from the digest
+ * at the same bit, if the node belongs there.
+ */
+
+static int
+hcb_crit_bit_ok(const uint8_t *digest, uintptr_t pp, const struct hcb_y *y2)
+{
+	const struct hcb_y *y;
+	const struct objhead *oh;
+	unsigned u;
+
+	while (hcb_is_y(pp)) {
+		y = hcb_l_y(pp);
+		CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
+		assert(y->ptr < DIGEST_LEN);
+		pp = y->leaf[(digest[y->ptr] & y->bitmask) != 0];
+	}
+	AN(pp);
+	oh = hcb_l_node(pp);
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	for (u = 0; u < DIGEST_LEN && digest[u] == oh->digest[u]; u++)
+		;
+	if (u == DIGEST_LEN)
+		return (0);
+	return (u * 8 + hcb_bits(digest[u], oh->digest[u]) == y2->critbit);
+}
+
+/*---------------------------------------------------------------------
+ * We need to be very careful about pointer references into the tree,
+ * we cannot trust things to be the same in two consecutive memory
+ * accesses.  If an insert finds the tree changed under it, it starts
+ * over from the root.
  */
 
 static struct objhead *
-hcb_insert(const struct worker *wrk, struct hcb_root *root,
+hcb_insert(struct worker *wrk, struct hcb_root *root,
     const uint8_t *digest, struct objhead **noh)
 {
 	volatile uintptr_t *p;
@@ -201,119 +301,199 @@ hcb_insert(const struct worker *wrk, struct hcb_root *root,
 	struct objhead *oh2;
 	unsigned s, s2;
 
-	p = &root->origo;
-	pp = *p;
-	if (pp == 0) {
-		if (noh == NULL)
-			return (NULL);
-		oh2 = *noh;
-		*noh = NULL;
-		memcpy(oh2->digest, digest, sizeof oh2->digest);
-		*p = hcb_r_node(oh2);
-		return (oh2);
-	}
-
-	while (hcb_is_y(pp)) {
-		y = hcb_l_y(pp);
-		CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
-		assert(y->ptr < DIGEST_LEN);
-		s = (digest[y->ptr] & y->bitmask) != 0;
-		assert(s < 2);
-		p = &y->leaf[s];
+	while (1) {
+		p = &root->origo;
 		pp = *p;
-	}
-
-	if (pp == 0) {
-		/* We raced hcb_delete and got a NULL pointer */
-		assert(noh == NULL);
-		return (NULL);
-	}
+		if (pp == 0) {
+			if (noh == NULL)
+				return (NULL);
+			oh2 = *noh;
+			memcpy(oh2->digest, digest, sizeof oh2->digest);
+			if (hcb_cas(p, 0, hcb_r_node(oh2))) {
+				*noh = NULL;
+				return (oh2);
+			}
+			wrk->stats->hcb_retry++;
+			continue;
+		}
 
-	assert(hcb_is_node(pp));
+		while (hcb_is_y(pp)) {
+			y = hcb_l_y(pp);
+			CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
+			assert(y->ptr < DIGEST_LEN);
+			s = (digest[y->ptr] & y->bitmask) != 0;
+			assert(s < 2);
+			p = &y->leaf[s];
+			pp = *p;
+		}
 
-	/* We found a node, does it match ? */
-	oh2 = hcb_l_node(pp);
-	CHECK_OBJ_NOTNULL(oh2, OBJHEAD_MAGIC);
-	if (!memcmp(oh2->digest, digest, DIGEST_LEN))
-		return (oh2);
+		AN(pp);
+		assert(hcb_is_node(pp));
 
-	if (noh == NULL)
-		return (NULL);
+		/* We found a node, does it match ? */
+		oh2 = hcb_l_node(pp);
+		CHECK_OBJ_NOTNULL(oh2, OBJHEAD_MAGIC);
+		if (!memcmp(oh2->digest, digest, DIGEST_LEN))
+			return (oh2);
 
-	/* Insert */
+		if (noh == NULL)
+			return (NULL);
 
-	TAKE_OBJ_NOTNULL(y2, &wrk->wpriv->nhashpriv, HCB_Y_MAGIC);
-	(void)hcb_crit_bit(digest, oh2, y2);
-	s2 = (digest[y2->ptr] & y2->bitmask) != 0;
-	assert(s2 < 2);
-	oh2 = *noh;
-	*noh = NULL;
-	memcpy(oh2->digest, digest, sizeof oh2->digest);
-	y2->leaf[s2] = hcb_r_node(oh2);
-	s2 = 1-s2;
+		/* Insert */
 
-	p = &root->origo;
-	AN(*p);
+		CAST_OBJ_NOTNULL(y2, wrk->wpriv->nhashpriv, HCB_Y_MAGIC);
+		(void)hcb_crit_bit(digest, oh2, y2);
+		s2 = (digest[y2->ptr] & y2->bitmask) != 0;
+		assert(s2 < 2);
+		oh2 = *noh;
+		memcpy(oh2->digest, digest, sizeof oh2->digest);
+		y2->leaf[s2] = hcb_r_node(oh2);
+		s2 = 1-s2;
 
-	while (hcb_is_y(*p)) {
-		y = hcb_l_y(*p);
-		CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
-		assert(y->critbit != y2->critbit);
-		if (y->critbit > y2->critbit)
-			break;
-		assert(y->ptr < DIGEST_LEN);
-		s = (digest[y->ptr] & y->bitmask) != 0;
-		assert(s < 2);
-		p = &y->leaf[s];
+		p = &root->origo;
+		pp = *p;
+		while (hcb_is_y(pp)) {
+			y = hcb_l_y(pp);
+			CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
+			if (y->critbit >= y2->critbit)
+				break;
+			assert(y->ptr < DIGEST_LEN);
+			s = (digest[y->ptr] & y->bitmask) != 0;
+			assert(s < 2);
+			p = &y->leaf[s];
+			pp = *p;
+		}
+		if (pp != 0 && !hcb_is_del(pp) && (!hcb_is_y(pp) ||
+		    hcb_l_y(pp)->critbit != y2->critbit) &&
+		    hcb_crit_bit_ok(digest, pp, y2)) {
+			y2->leaf[s2] = pp;
+			if (hcb_cas(p, pp, hcb_r_y(y2))) {
+				wrk->wpriv->nhashpriv = NULL;
+				*noh = NULL;
+				return (oh2);
+			}
+		}
+		wrk->stats->hcb_retry++;
 	}
-	y2->leaf[s2] = *p;
-	VWMB();
-	*p = hcb_r_y(y2);
-	return (oh2);
 }
 
-/*--------------------------------------------------------------------*/
+/*---------------------------------------------------------------------
+ * Deletes are serialized by hcb_mtx, but race inserts.  Both pointers
+ * of the node we remove are marked first, so no insert can add to it
+ * after we looked.
+ */
+
+static uintptr_t
+hcb_mark(volatile uintptr_t *p)
+{
+	uintptr_t pp;
+
+	do {
+		pp = *p;
+		AZ(hcb_is_del(pp));
+	} while (!hcb_cas(p, pp, pp | HCB_BIT_DEL));
+	return (pp);
+}
 
 static void
 hcb_delete(struct hcb_root *r, const struct objhead *oh)
 {
-	struct hcb_y *y;
+	struct hcb_y *y, *y2;
 	volatile uintptr_t *p;
+	uintptr_t pp;
 	unsigned s;
 
-	if (r->origo == hcb_r_node(oh)) {
-		r->origo = 0;
-		return;
-	}
-	p = &r->origo;
-	assert(hcb_is_y(*p));
-
-	y = NULL;
+	Lck_AssertHeld(&hcb_mtx);
 	while (1) {
+		p = &r->origo;
+		if (*p == hcb_r_node(oh)) {
+			if (hcb_cas(p, hcb_r_node(oh), 0))
+				return;
+			continue;
+		}
 		assert(hcb_is_y(*p));
-		y = hcb_l_y(*p);
-		assert(y->ptr < DIGEST_LEN);
-		s = (oh->digest[y->ptr] & y->bitmask) != 0;
-		assert(s < 2);
-		if (y->leaf[s] == hcb_r_node(oh)) {
-			*p = y->leaf[1 - s];
-			VSTAILQ_INSERT_TAIL(&cool_y, y, list);
-			return;
+		while (1) {
+			assert(hcb_is_y(*p));
+			y = hcb_l_y(*p);
+			CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
+			assert(y->ptr < DIGEST_LEN);
+			s = (oh->digest[y->ptr] & y->bitmask) != 0;
+			assert(s < 2);
+			if (y->leaf[s] == hcb_r_node(oh))
+				break;
+			p = &y->leaf[s];
 		}
-		p = &y->leaf[s];
+		if (hcb_cas(&y->leaf[s], hcb_r_node(oh),
+		    hcb_r_node(oh) | HCB_BIT_DEL))
+			break;
+		/* An insert went in below us, look again */
 	}
+
+	pp = hcb_mark(&y->leaf[1 - s]);
+	while (!hcb_cas(p, hcb_r_y(y), pp)) {
+		/* An insert went in above us, find our parent again */
+		p = &r->origo;
+		while (*p != hcb_r_y(y)) {
+			assert(hcb_is_y(*p));
+			y2 = hcb_l_y(*p);
+			CHECK_OBJ_NOTNULL(y2, HCB_Y_MAGIC);
+			s = (oh->digest[y2->ptr] & y2->bitmask) != 0;
+			p = &y2->leaf[s];
+		}
+	}
+	VSTAILQ_INSERT_TAIL(&cool_y, y, list);
 }
 
-/*--------------------------------------------------------------------*/
+/*--------------------------------------------------------------------
+ * Wait until no thread is online with an epoch before 'e'
+ */
+
+static void
+hcb_wait(struct worker *wrk, unsigned e)
+{
+	struct hcb_thr *thr;
+	unsigned u;
+
+	Lck_Lock(&hcb_mtx);
+	while (1) {
+		VTAILQ_FOREACH(thr, &hcb_thrs, list) {
+			CHECK_OBJ_NOTNULL(thr, HCB_THR_MAGIC);
+			u = thr->epoch;
+			if (u != 0 && (int)(u - e) < 0)
+				break;
+		}
+		if (thr == NULL)
+			break;
+		wrk->stats->hcb_reclaim_wait++;
+		(void)Lck_CondWaitTimeout(&hcb_cond, &hcb_mtx, 0.01);
+	}
+	Lck_Unlock(&hcb_mtx);
+}
 
 static void * v_matchproto_(bgthread_t)
 hcb_cleaner(struct worker *wrk, void *priv)
 {
 	struct hcb_y *y, *y2;
 	struct objhead *oh, *oh2;
+	unsigned e;
 
 	(void)priv;
 	while (1) {
+		Lck_Lock(&hcb_mtx);
+		while (VSTAILQ_EMPTY(&cool_y) && VTAILQ_EMPTY(&cool_h)) {
+			Pool_Sumstat(wrk);
+			(void)Lck_CondWait(&hcb_cond, &hcb_mtx);
+		}
+		VSTAILQ_CONCAT(&dead_y, &cool_y);
+		VTAILQ_CONCAT(&dead_h, &cool_h, hoh_list);
+		e = hcb_epoch + 1;
+		if (e == 0)
+			e++;
+		hcb_epoch = e;
+		Lck_Unlock(&hcb_mtx);
+
+		hcb_wait(wrk, e);
+
 		VSTAILQ_FOREACH_SAFE(y, &dead_y, list, y2) {
 			CHECK_OBJ_NOTNULL(y, HCB_Y_MAGIC);
 			VSTAILQ_REMOVE_HEAD(&dead_y, list);
@@ -324,12 +504,6 @@ hcb_cleaner(struct worker *wrk, void *priv)
 			VTAILQ_REMOVE(&dead_h, oh, hoh_list);
 			HSH_DeleteObjHead(wrk, oh);
 		}
-		Lck_Lock(&hcb_mtx);
-		VSTAILQ_CONCAT(&dead_y, &cool_y);
-		VTAILQ_CONCAT(&dead_h, &cool_h, hoh_list);
-		Lck_Unlock(&hcb_mtx);
-		Pool_Sumstat(wrk);
-		VTIM_sleep(cache_param->critbit_cooloff);
 	}
 	NEEDLESS(return (NULL));
 }
@@ -344,6 +518,7 @@ hcb_start(void)
 
 	(void)oh;
 	Lck_New(&hcb_mtx, lck_hcb);
+	PTOK(pthread_cond_init(&hcb_cond, NULL));
 	WRK_BgThread(&tp, "hcb-cleaner", hcb_cleaner, NULL);
 	memset(&hcb_root, 0, sizeof hcb_root);
 	hcb_build_bittbl();
@@ -362,10 +537,14 @@ hcb_deref(struct worker *wrk, struct objhead *oh)
 	if (oh->refcnt == 0) {
 		Lck_Lock(&hcb_mtx);
 		hcb_delete(&hcb_root, oh);
+		/* The cleaner may free it as soon as we let go */
+		Lck_Unlock(&oh->mtx);
+		if (VTAILQ_EMPTY(&cool_h))
+			PTOK(pthread_cond_signal(&hcb_cond));
 		VTAILQ_INSERT_TAIL(&cool_h, oh, hoh_list);
 		Lck_Unlock(&hcb_mtx);
-	}
-	Lck_Unlock(&oh->mtx);
+	} else
+		Lck_Unlock(&oh->mtx);
 #ifdef PHK
 	fprintf(stderr, "hcb_defef %d %d <%s>\n", __LINE__, r, oh->hash);
 #endif
@@ -376,7 +555,6 @@ static struct objhead * v_matchproto_(hash_lookup_f)
 hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 {
 	struct objhead *oh;
-	struct hcb_y *y;
 	unsigned u;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -386,7 +564,9 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		assert((*noh)->refcnt == 1);
 	}
 
-	/* First try in read-only mode without holding a lock */
+	hcb_online(wrk);
+
+	/* First try in read-only mode */
 
 	wrk->stats->hcb_nolock++;
 	oh = hcb_insert(wrk, &hcb_root, digest, NULL);
@@ -394,51 +574,53 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		Lck_Lock(&oh->mtx);
 		/*
 		 * A refcount of zero indicates that the tree changed
-		 * under us, so fall through and try with the lock held.
+		 * under us, so fall through and try again.
 		 */
 		u = oh->refcnt;
 		if (u > 0) {
 			oh->refcnt++;
+			hcb_offline(wrk);
 			return (oh);
 		}
 		Lck_Unlock(&oh->mtx);
 	}
 
 	while (1) {
-		/* No luck, try with lock held, so we can modify tree */
-		CAST_OBJ_NOTNULL(y, wrk->wpriv->nhashpriv, HCB_Y_MAGIC);
-		Lck_Lock(&hcb_mtx);
-		VSC_C_main->hcb_lock++;
+		/* No luck, try again, so we can modify tree */
+		wrk->stats->hcb_lock++;
 		oh = hcb_insert(wrk, &hcb_root, digest, noh);
-		Lck_Unlock(&hcb_mtx);
 
 		if (oh == NULL)
-			return (NULL);
+			break;
 
 		Lck_Lock(&oh->mtx);
 
 		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 		if (noh != NULL && *noh == NULL) {
 			assert(oh->refcnt > 0);
-			VSC_C_main->hcb_insert++;
-			return (oh);
+			wrk->stats->hcb_insert++;
+			break;
 		}
 		/*
 		 * A refcount of zero indicates that the tree changed
-		 * under us, so fall through and try with the lock held.
+		 * under us, so fall through and try again.
 		 */
 		u = oh->refcnt;
 		if (u > 0) {
 			oh->refcnt++;
-			return (oh);
+			break;
 		}
 		Lck_Unlock(&oh->mtx);
 	}
+
+	hcb_offline(wrk);
+	return (oh);
 }
 
 static void v_matchproto_(hash_prep_f)
 hcb_prep(struct worker *wrk)
 {
+	struct hcb_thr *thr;
 	struct hcb_y *y;
 
 	if (wrk->wpriv->nhashpriv == NULL) {
@@ -446,6 +628,29 @@ hcb_prep(struct worker *wrk)
 		AN(y);
 		wrk->wpriv->nhashpriv = y;
 	}
+	if (wrk->wpriv->hashpriv == NULL) {
+		ALLOC_OBJ(thr, HCB_THR_MAGIC);
+		AN(thr);
+		Lck_Lock(&hcb_mtx);
+		VTAILQ_INSERT_TAIL(&hcb_thrs, thr, list);
+		Lck_Unlock(&hcb_mtx);
+		wrk->wpriv->hashpriv = thr;
+	}
+}
+
+static void v_matchproto_(hash_cleanup_f)
+hcb_cleanup(const struct worker *wrk)
+{
+	struct hcb_thr *thr;
+
+	if (wrk->wpriv->hashpriv == NULL)
+		return;
+	TAKE_OBJ_NOTNULL(thr, &wrk->wpriv->hashpriv, HCB_THR_MAGIC);
+	assert(thr->epoch == 0);
+	Lck_Lock(&hcb_mtx);
+	VTAILQ_REMOVE(&hcb_thrs, thr, list);
+	Lck_Unlock(&hcb_mtx);
+	FREE_OBJ(thr);
 }
 
 const struct hash_slinger hcb_slinger = {
@@ -455,4 +660,5 @@ const struct hash_slinger hcb_slinger = {
 	.lookup =	hcb_lookup,
 	.prep =		hcb_prep,
 	.deref  =	hcb_deref,
+	.cleanup =	hcb_cleanup,
 };
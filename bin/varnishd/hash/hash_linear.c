@@ -0,0 +1,441 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * A linear hash with striped locks
+ *
+ * The table starts out with HLH_SEGSIZE buckets and grows one bucket at
+ * a time: When the load gets too high, bucket 's' is split into itself
+ * and a new bucket 's + low', where 'low' is the largest power of two
+ * not above the number of buckets.  Once all buckets below 'low' have
+ * been split, 'low' doubles and splitting starts over from bucket zero.
+ *
+ * Bucket 'b' is protected by the lock of stripe 'b % hlh_nstripe'.
+ * Because the number of stripes is a power of two not larger than 'low',
+ * a bucket and the bucket it splits into share their stripe, and the
+ * stripe of a digest can be found without knowing the size of the table.
+ * Under the stripe lock, the bucket of a digest does not change, even
+ * if buckets in other stripes are split at the same time.
+ *
+ * Buckets are allocated in segments which never move, so growing the
+ * table never has to stop the world to copy it.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include "hash/hash_slinger.h"
+#include "vtim.h"
+
+#include "VSC_hlh.h"
+
+static struct VSC_lck *lck_hlh;
+
+/*--------------------------------------------------------------------*/
+
+#define HLH_SEGSHIFT		10
+#define HLH_SEGSIZE		(1U << HLH_SEGSHIFT)
+#define HLH_NSEG		16384
+#define HLH_MAXBUCKET		(HLH_SEGSIZE * HLH_NSEG)
+
+/* Chain length histogram: 0, 1, 2, <=4, <=8, <=16, more */
+#define HLH_NHIST		7
+
+struct hlh_bucket {
+	VTAILQ_HEAD(, objhead)	head;
+	unsigned		len;
+};
+
+struct hlh_stripe {
+	unsigned		magic;
+#define HLH_STRIPE_MAGIC	0x5b1f4e27
+	struct lock		mtx;
+	unsigned		nobj;
+	unsigned		hist[HLH_NHIST];
+};
+
+static unsigned			hlh_nstripe = 64;
+static unsigned			hlh_load = 2;
+static struct hlh_stripe	*hlh_stripe;
+
+static struct hlh_bucket	*hlh_seg[HLH_NSEG];
+static volatile unsigned	hlh_nbucket;
+
+static struct lock		hlh_mtx;
+static struct VSC_hlh		*vsc;
+
+/*--------------------------------------------------------------------
+ * The ->init method allows the management process to pass arguments
+ */
+
+static void v_matchproto_(hash_init_f)
+hlh_init(int ac, char * const *av)
+{
+	unsigned u;
+
+	if (ac == 0)
+		return;
+	if (ac > 2)
+		ARGV_ERR("(-hlinear) too many arguments\n");
+	if (*av[0] != '\0') {
+		if (sscanf(av[0], "%u", &u) != 1 || u == 0 ||
+		    u > HLH_SEGSIZE || (u & (u - 1)))
+			ARGV_ERR("(-hlinear) stripes must be a power of two"
+			    " from 1 to %u\n", HLH_SEGSIZE);
+		hlh_nstripe = u;
+	}
+	if (ac > 1 && *av[1] != '\0') {
+		if (sscanf(av[1], "%u", &u) != 1 || u == 0)
+			ARGV_ERR("(-hlinear) load must be at least 1\n");
+		hlh_load = u;
+	}
+	fprintf(stderr, "Linear hash: %u stripes, load %u\n",
+	    hlh_nstripe, hlh_load);
+}
+
+/*--------------------------------------------------------------------*/
+
+static uint32_t
+hlh_hash(const uint8_t *digest)
+{
+	uint32_t h;
+
+	memcpy(&h, digest, sizeof h);
+	return (h);
+}
+
+static unsigned
+hlh_bin(unsigned len)
+{
+	unsigned u;
+
+	if (len <= 2)
+		return (len);
+	for (u = 3; u < HLH_NHIST - 1; u++)
+		if (len <= (1U << (u - 1)))
+			return (u);
+	return (HLH_NHIST - 1);
+}
+
+static unsigned
+hlh_low(unsigned n)
+{
+	unsigned low;
+
+	for (low = HLH_SEGSIZE; low * 2 <= n; low *= 2)
+		continue;
+	return (low);
+}
+
+static struct hlh_bucket *
+hlh_bucket(unsigned b)
+{
+	struct hlh_bucket *seg;
+
+	seg = hlh_seg[b >> HLH_SEGSHIFT];
+	AN(seg);
+	return (&seg[b & (HLH_SEGSIZE - 1)]);
+}
+
+/*
+ * Must be called with the stripe of the digest locked
+ */
+
+static struct hlh_bucket *
+hlh_find(uint32_t h)
+{
+	unsigned n, low, b;
+
+	n = hlh_nbucket;
+	low = hlh_low(n);
+	b = h & (low - 1);
+	if (b < n - low)
+		b = h & (low * 2 - 1);
+	return (hlh_bucket(b));
+}
+
+static void
+hlh_setlen(struct hlh_stripe *st, struct hlh_bucket *hb, unsigned len)
+{
+
+	st->hist[hlh_bin(hb->len)]--;
+	hb->len = len;
+	st->hist[hlh_bin(len)]++;
+}
+
+/*--------------------------------------------------------------------
+ * Split the next bucket.  Only one thread splits at a time, and if
+ * another one already does, there is no need to wait for it.
+ */
+
+static void
+hlh_split(void)
+{
+	struct hlh_stripe *st;
+	struct hlh_bucket *ob, *nb;
+	struct objhead *oh, *oh2;
+	unsigned n, low, s, u;
+
+	if (Lck_Trylock(&hlh_mtx))
+		return;
+	n = hlh_nbucket;
+	if (n == HLH_MAXBUCKET) {
+		Lck_Unlock(&hlh_mtx);
+		return;
+	}
+	if (hlh_seg[n >> HLH_SEGSHIFT] == NULL) {
+		nb = calloc(HLH_SEGSIZE, sizeof *nb);
+		if (nb == NULL) {
+			Lck_Unlock(&hlh_mtx);
+			return;
+		}
+		for (u = 0; u < HLH_SEGSIZE; u++)
+			VTAILQ_INIT(&nb[u].head);
+		hlh_seg[n >> HLH_SEGSHIFT] = nb;
+	}
+	low = hlh_low(n);
+	s = n - low;
+	assert((s % hlh_nstripe) == (n % hlh_nstripe));
+	st = &hlh_stripe[s % hlh_nstripe];
+	CHECK_OBJ(st, HLH_STRIPE_MAGIC);
+
+	Lck_Lock(&st->mtx);
+	ob = hlh_bucket(s);
+	nb = hlh_bucket(n);
+	AZ(nb->len);
+	st->hist[0]++;
+	VTAILQ_FOREACH_SAFE(oh, &ob->head, hoh_list, oh2) {
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		if ((hlh_hash(oh->digest) & (low * 2 - 1)) == s)
+			continue;
+		VTAILQ_REMOVE(&ob->head, oh, hoh_list);
+		VTAILQ_INSERT_TAIL(&nb->head, oh, hoh_list);
+		hlh_setlen(st, ob, ob->len - 1);
+		hlh_setlen(st, nb, nb->len + 1);
+	}
+	hlh_nbucket = n + 1;
+	Lck_Unlock(&st->mtx);
+
+	vsc->buckets = n + 1;
+	vsc->splits++;
+	Lck_Unlock(&hlh_mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Collect the per stripe statistics
+ */
+
+static void * v_matchproto_(bgthread_t)
+hlh_stats(struct worker *wrk, void *priv)
+{
+	struct hlh_stripe *st;
+	uint64_t hist[HLH_NHIST];
+	uint64_t nobj;
+	unsigned u, v;
+
+	(void)wrk;
+	(void)priv;
+	while (1) {
+		nobj = 0;
+		memset(hist, 0, sizeof hist);
+		for (u = 0; u < hlh_nstripe; u++) {
+			st = &hlh_stripe[u];
+			Lck_Lock(&st->mtx);
+			nobj += st->nobj;
+			for (v = 0; v < HLH_NHIST; v++)
+				hist[v] += st->hist[v];
+			Lck_Unlock(&st->mtx);
+		}
+		vsc->objheads = nobj;
+		vsc->load = nobj * 100 / hlh_nbucket;
+		vsc->chain_0 = hist[0];
+		vsc->chain_1 = hist[1];
+		vsc->chain_2 = hist[2];
+		vsc->chain_4 = hist[3];
+		vsc->chain_8 = hist[4];
+		vsc->chain_16 = hist[5];
+		vsc->chain_more = hist[6];
+		VTIM_sleep(1.0);
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------
+ * The ->start method is called during cache process start and allows
+ * initialization to happen before the first lookup.
+ */
+
+static void v_matchproto_(hash_start_f)
+hlh_start(void)
+{
+	struct hlh_stripe *st;
+	struct hlh_bucket *hb;
+	pthread_t tp;
+	unsigned u;
+
+	lck_hlh = Lck_CreateClass(NULL, "hlh");
+	Lck_New(&hlh_mtx, lck_hlh);
+
+	hlh_stripe = calloc(hlh_nstripe, sizeof *hlh_stripe);
+	AN(hlh_stripe);
+	for (u = 0; u < hlh_nstripe; u++) {
+		st = &hlh_stripe[u];
+		st->magic = HLH_STRIPE_MAGIC;
+		Lck_New(&st->mtx, lck_hlh);
+		st->hist[0] = HLH_SEGSIZE / hlh_nstripe;
+	}
+
+	hb = calloc(HLH_SEGSIZE, sizeof *hb);
+	AN(hb);
+	for (u = 0; u < HLH_SEGSIZE; u++)
+		VTAILQ_INIT(&hb[u].head);
+	hlh_seg[0] = hb;
+	hlh_nbucket = HLH_SEGSIZE;
+
+	vsc = VSC_hlh_New(NULL, NULL, "");
+	AN(vsc);
+	vsc->buckets = hlh_nbucket;
+	vsc->chain_0 = hlh_nbucket;
+
+	WRK_BgThread(&tp, "hlh-stats", hlh_stats, NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Lookup and possibly insert element.
+ * If nobj != NULL and the lookup does not find key, nobj is inserted.
+ * If nobj == NULL and the lookup does not find key, NULL is returned.
+ * A reference to the returned object is held.
+ */
+
+static struct objhead * v_matchproto_(hash_lookup_f)
+hlh_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
+{
+	struct objhead *oh;
+	struct hlh_stripe *st;
+	struct hlh_bucket *hb;
+	uint32_t h;
+	int i, split;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	if (noh != NULL)
+		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
+
+	h = hlh_hash(digest);
+	st = &hlh_stripe[h % hlh_nstripe];
+
+	Lck_Lock(&st->mtx);
+	hb = hlh_find(h);
+	VTAILQ_FOREACH(oh, &hb->head, hoh_list) {
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		i = memcmp(oh->digest, digest, sizeof oh->digest);
+		if (i < 0)
+			continue;
+		if (i > 0)
+			break;
+		oh->refcnt++;
+		Lck_Unlock(&st->mtx);
+		Lck_Lock(&oh->mtx);
+		return (oh);
+	}
+
+	if (noh == NULL) {
+		Lck_Unlock(&st->mtx);
+		return (NULL);
+	}
+
+	if (oh != NULL)
+		VTAILQ_INSERT_BEFORE(oh, *noh, hoh_list);
+	else
+		VTAILQ_INSERT_TAIL(&hb->head, *noh, hoh_list);
+	hlh_setlen(st, hb, hb->len + 1);
+	st->nobj++;
+
+	oh = *noh;
+	*noh = NULL;
+	memcpy(oh->digest, digest, sizeof oh->digest);
+
+	oh->hoh_head = st;
+
+	/* Our stripe stands in for the whole table */
+	split = (uint64_t)st->nobj * hlh_nstripe >
+	    (uint64_t)hlh_load * hlh_nbucket;
+
+	Lck_Unlock(&st->mtx);
+	if (split)
+		hlh_split();
+	Lck_Lock(&oh->mtx);
+	return (oh);
+}
+
+/*--------------------------------------------------------------------
+ * Dereference and if no references are left, free.
+ */
+
+static int v_matchproto_(hash_deref_f)
+hlh_deref(struct worker *wrk, struct objhead *oh)
+{
+	struct hlh_stripe *st;
+	struct hlh_bucket *hb;
+	int ret;
+
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	Lck_AssertHeld(&oh->mtx);
+	Lck_Unlock(&oh->mtx);
+
+	CAST_OBJ_NOTNULL(st, oh->hoh_head, HLH_STRIPE_MAGIC);
+	assert(oh->refcnt > 0);
+	Lck_Lock(&st->mtx);
+	if (--oh->refcnt == 0) {
+		hb = hlh_find(hlh_hash(oh->digest));
+		VTAILQ_REMOVE(&hb->head, oh, hoh_list);
+		hlh_setlen(st, hb, hb->len - 1);
+		st->nobj--;
+		ret = 0;
+	} else
+		ret = 1;
+	Lck_Unlock(&st->mtx);
+	if (!ret)
+		HSH_DeleteObjHead(wrk, oh);
+	return (ret);
+}
+
+/*--------------------------------------------------------------------*/
+
+const struct hash_slinger hlh_slinger = {
+	.magic	=	SLINGER_MAGIC,
+	.name	=	"linear",
+	.init	=	hlh_init,
+	.start	=	hlh_start,
+	.lookup =	hlh_lookup,
+	.deref	=	hlh_deref,
+};
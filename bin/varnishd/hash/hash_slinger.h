@@ -39,6 +39,7 @@ typedef void hash_prep_f(struct worker *);
 typedef struct objhead *hash_lookup_f(struct worker *, const void *digest,
     struct objhead **);
 typedef int hash_deref_f(struct worker *, struct objhead *);
+typedef void hash_cleanup_f(const struct worker *);
 
 struct hash_slinger {
 	unsigned		magic;
@@ -49,6 +50,7 @@ struct hash_slinger {
 	hash_prep_f		*prep;
 	hash_lookup_f		*lookup;
 	hash_deref_f		*deref;
+	hash_cleanup_f		*cleanup;
 };
 
 /* mgt_hash.c */
@@ -61,3 +63,4 @@ void HSH_Cleanup(const struct worker *);
 extern const struct hash_slinger hsl_slinger;
 extern const struct hash_slinger hcl_slinger;
 extern const struct hash_slinger hcb_slinger;
+extern const struct hash_slinger hlh_slinger;
@@ -128,3 +128,19 @@ enum vhd_ret_e  VHD_Decode(struct vhd_decode *, struct vht_table *,
     const uint8_t *in, size_t inlen, size_t *p_inused,
     char *out, size_t outlen, size_t *p_outused);
 const char *VHD_Error(enum vhd_ret_e);
+
+/* VHE - Varnish HPACK Encoder */
+
+struct vsb;
+
+enum vhe_index_e {
+	VHE_INDEX,	/* Literal with incremental indexing */
+	VHE_NONE,	/* Literal without indexing */
+	VHE_NEVER,	/* Literal never indexed */
+};
+
+void VHE_Integer(struct vsb *, uint8_t, unsigned prefix, size_t);
+void VHE_String(struct vsb *, const char *, size_t, int lower);
+void VHE_Field(struct vsb *, struct vht_table *, const char *name, size_t,
+    const char *val, size_t, enum vhe_index_e);
+void VHE_TableSize(struct vsb *, struct vht_table *, size_t);
@@ -0,0 +1,473 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HPACK encoder (RFC 7541)
+ *
+ * The dynamic table is a VHT table, updated with the same calls as the
+ * decoder uses, so that it stays identical to the table of the peer.
+ * Header names are always sent in lower case.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "miniobj.h"
+#include "vsb.h"
+
+#include "hpack/vhp.h"
+
+#define VHE_STATIC_MAX 61
+
+static const struct {
+	uint32_t	code;
+	uint8_t		blen;
+} vhe_huffman[256] = {
+#define HPH(c, h, l) [c] = { h, l },
+#include "tbl/vhp_huffman.h"
+};
+
+/****************************************************************************/
+
+void
+VHE_Integer(struct vsb *vsb, uint8_t b0, unsigned prefix, size_t val)
+{
+	size_t mask;
+
+	AN(vsb);
+	assert(prefix > 0 && prefix < 8);
+	mask = (1U << prefix) - 1U;
+	AZ(b0 & mask);
+
+	if (val < mask) {
+		VSB_putc(vsb, b0 | (uint8_t)val);
+		return;
+	}
+	VSB_putc(vsb, b0 | (uint8_t)mask);
+	val -= mask;
+	while (val >= 0x80) {
+		VSB_putc(vsb, 0x80 | (uint8_t)(val & 0x7f));
+		val >>= 7;
+	}
+	VSB_putc(vsb, (uint8_t)val);
+}
+
+static size_t
+vhe_huffman_len(const char *s, size_t l, int lower)
+{
+	size_t bits = 0;
+	uint8_t c;
+
+	while (l-- > 0) {
+		c = (uint8_t)*s++;
+		if (lower)
+			c = tolower(c);
+		AN(vhe_huffman[c].blen);
+		bits += vhe_huffman[c].blen;
+	}
+	return ((bits + 7) / 8);
+}
+
+/* String literal, Huffman coded only if that makes it shorter */
+
+void
+VHE_String(struct vsb *vsb, const char *s, size_t l, int lower)
+{
+	uint64_t acc = 0;
+	unsigned n = 0;
+	size_t hl;
+	uint8_t c;
+
+	AN(vsb);
+	AN(s);
+
+	hl = vhe_huffman_len(s, l, lower);
+	if (hl >= l) {
+		VHE_Integer(vsb, 0x00, 7, l);
+		if (!lower) {
+			VSB_bcat(vsb, s, l);
+			return;
+		}
+		while (l-- > 0)
+			VSB_putc(vsb, tolower(*s++));
+		return;
+	}
+
+	VHE_Integer(vsb, 0x80, 7, hl);
+	while (l-- > 0) {
+		c = (uint8_t)*s++;
+		if (lower)
+			c = tolower(c);
+		acc = (acc << vhe_huffman[c].blen) | vhe_huffman[c].code;
+		n += vhe_huffman[c].blen;
+		while (n >= 8) {
+			n -= 8;
+			VSB_putc(vsb, (uint8_t)(acc >> n));
+		}
+	}
+	if (n > 0) {
+		/* Pad with the most significant bits of EOS */
+		VSB_putc(vsb, (uint8_t)((acc << (8 - n)) | (0xff >> n)));
+	}
+}
+
+/* Find the lowest index with this name, and one with this value too */
+
+static unsigned
+vhe_lookup(const struct vht_table *tbl, const char *name, size_t namel,
+    const char *val, size_t vall, unsigned *pfull)
+{
+	const char *p;
+	unsigned u, n, idx = 0;
+	size_t l;
+
+	AN(pfull);
+	*pfull = 0;
+	n = VHE_STATIC_MAX;
+	if (tbl != NULL) {
+		CHECK_OBJ_NOTNULL(tbl, VHT_TABLE_MAGIC);
+		n += tbl->n;
+	}
+	for (u = 1; u <= n; u++) {
+		p = VHT_LookupName(tbl, u, &l);
+		AN(p);
+		if (l != namel || strncasecmp(p, name, l))
+			continue;
+		if (idx == 0)
+			idx = u;
+		p = VHT_LookupValue(tbl, u, &l);
+		if (l == vall && (l == 0 || !memcmp(p, val, l))) {
+			*pfull = u;
+			break;
+		}
+	}
+	return (idx);
+}
+
+/* Add a lower cased name to the new entry of the table */
+
+static void
+vhe_appendname(struct vht_table *tbl, const char *name, size_t l)
+{
+	char buf[64];
+	size_t u;
+
+	while (l > 0) {
+		for (u = 0; u < l && u < sizeof buf; u++)
+			buf[u] = tolower(name[u]);
+		VHT_AppendName(tbl, buf, u);
+		name += u;
+		l -= u;
+	}
+}
+
+void
+VHE_Field(struct vsb *vsb, struct vht_table *tbl, const char *name,
+    size_t namel, const char *val, size_t vall, enum vhe_index_e how)
+{
+	unsigned idx, full;
+
+	AN(vsb);
+	AN(name);
+	AN(namel);
+	AN(val);
+
+	idx = vhe_lookup(tbl, name, namel, val, vall, &full);
+	if (full > 0 && how != VHE_NEVER) {
+		/* Indexed header field */
+		VHE_Integer(vsb, 0x80, 7, full);
+		return;
+	}
+
+	switch (how) {
+	case VHE_INDEX:
+		AN(tbl);
+		VHE_Integer(vsb, 0x40, 6, idx);
+		break;
+	case VHE_NONE:
+		VHE_Integer(vsb, 0x00, 4, idx);
+		break;
+	case VHE_NEVER:
+		VHE_Integer(vsb, 0x10, 4, idx);
+		break;
+	default:
+		WRONG("vhe_index_e");
+	}
+	if (idx == 0)
+		VHE_String(vsb, name, namel, 1);
+	VHE_String(vsb, val, vall, 0);
+
+	if (how != VHE_INDEX)
+		return;
+	VHT_NewEntry(tbl);
+	vhe_appendname(tbl, name, namel);
+	VHT_AppendValue(tbl, val, vall);
+}
+
+/* Dynamic table size update, must come first in a header block */
+
+void
+VHE_TableSize(struct vsb *vsb, struct vht_table *tbl, size_t maxsize)
+{
+
+	AN(vsb);
+	CHECK_OBJ_NOTNULL(tbl, VHT_TABLE_MAGIC);
+	AZ(VHT_SetMaxTableSize(tbl, maxsize));
+	VHE_Integer(vsb, 0x20, 5, maxsize);
+}
+
+/****************************************************************************/
+
+#ifdef ENCODE_TEST_DRIVER
+
+static int verbose = 0;
+
+static void
+expect(struct vsb *vsb, const char *h)
+{
+	const uint8_t *p, *e;
+	unsigned u;
+	ssize_t l;
+	char buf[3];
+
+	AZ(VSB_finish(vsb));
+	p = (const void *)VSB_data(vsb);
+	l = VSB_len(vsb);
+	e = p + l;
+	for (; *h != '\0'; h++) {
+		if (isspace(*h))
+			continue;
+		AN(h[1]);
+		buf[0] = h[0];
+		buf[1] = h[1];
+		buf[2] = '\0';
+		u = strtoul(buf, NULL, 16);
+		if (l == 0 || *p != u)
+			break;
+		if (verbose)
+			printf("%02x", *p);
+		p++;
+		l--;
+		h++;
+	}
+	if (verbose)
+		printf("\n");
+	if (*h != '\0' || l != 0) {
+		printf("Mismatch at byte %zd, got:\n",
+		    p - (const uint8_t *)VSB_data(vsb));
+		for (p = (const void *)VSB_data(vsb); p < e; p++)
+			printf("%02x", *p);
+		printf("\n");
+		fflush(stdout);
+		WRONG("Encoding mismatch");
+	}
+	VSB_clear(vsb);
+}
+
+#define F(name, val, how) \
+	VHE_Field(vsb, t, name, strlen(name), val, strlen(val), how)
+
+static void
+test_integer(void)
+{
+	struct vsb *vsb;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+
+	/* See RFC 7541 Appendix C.1 */
+	VHE_Integer(vsb, 0x00, 5, 10);
+	expect(vsb, "0a");
+	VHE_Integer(vsb, 0x00, 5, 1337);
+	expect(vsb, "1f9a 0a");
+	VHE_Integer(vsb, 0x00, 7, 42);
+	expect(vsb, "2a");
+	VHE_Integer(vsb, 0xe0, 5, 31);
+	expect(vsb, "ff00");
+
+	VSB_destroy(&vsb);
+}
+
+static void
+test_c4(void)
+{
+	struct vht_table t[1];
+	struct vsb *vsb;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(VHT_Init(t, 4096));
+
+	/* See RFC 7541 Appendix C.4 */
+	F(":method", "GET", VHE_INDEX);
+	F(":scheme", "http", VHE_INDEX);
+	F(":path", "/", VHE_INDEX);
+	F(":authority", "www.example.com", VHE_INDEX);
+	expect(vsb, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff");
+
+	F(":method", "GET", VHE_INDEX);
+	F(":scheme", "http", VHE_INDEX);
+	F(":path", "/", VHE_INDEX);
+	F(":authority", "www.example.com", VHE_INDEX);
+	F("Cache-Control", "no-cache", VHE_INDEX);
+	expect(vsb, "8286 84be 5886 a8eb 1064 9cbf");
+
+	F(":method", "GET", VHE_INDEX);
+	F(":scheme", "https", VHE_INDEX);
+	F(":path", "/index.html", VHE_INDEX);
+	F(":authority", "www.example.com", VHE_INDEX);
+	F("custom-key", "custom-value", VHE_INDEX);
+	expect(vsb, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925"
+	    "a849 e95b b8e8 b4bf");
+
+	AZ(VHT_SetMaxTableSize(t, 4096));
+	assert(t->n == 3);
+	VHT_Fini(t);
+	VSB_destroy(&vsb);
+}
+
+static void
+test_c6(void)
+{
+	struct vht_table t[1];
+	struct vsb *vsb;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(VHT_Init(t, 256));
+
+	/* See RFC 7541 Appendix C.6 */
+	F(":status", "302", VHE_INDEX);
+	F("cache-control", "private", VHE_INDEX);
+	F("date", "Mon, 21 Oct 2013 20:13:21 GMT", VHE_INDEX);
+	F("location", "https://www.example.com", VHE_INDEX);
+	expect(vsb,
+	    "4882 6402 5885 aec3 771a 4b61 96d0 7abe"
+	    "9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+	    "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8"
+	    "e9ae 82ae 43d3");
+
+	F(":status", "307", VHE_INDEX);
+	F("cache-control", "private", VHE_INDEX);
+	F("date", "Mon, 21 Oct 2013 20:13:21 GMT", VHE_INDEX);
+	F("location", "https://www.example.com", VHE_INDEX);
+	expect(vsb, "4883 640e ffc1 c0bf");
+
+	F(":status", "200", VHE_INDEX);
+	F("cache-control", "private", VHE_INDEX);
+	F("date", "Mon, 21 Oct 2013 20:13:22 GMT", VHE_INDEX);
+	F("location", "https://www.example.com", VHE_INDEX);
+	F("content-encoding", "gzip", VHE_INDEX);
+	F("set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; "
+	    "version=1", VHE_INDEX);
+	expect(vsb,
+	    "88c1 6196 d07a be94 1054 d444 a820 0595"
+	    "040b 8166 e084 a62d 1bff c05a 839b d9ab"
+	    "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+	    "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+	    "9587 3160 65c0 03ed 4ee5 b106 3d50 07");
+
+	VHT_Fini(t);
+	VSB_destroy(&vsb);
+}
+
+static void
+test_index(void)
+{
+	struct vht_table t[1];
+	struct vsb *vsb;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(VHT_Init(t, 4096));
+
+	/* Names are lower cased, sensitive fields never indexed */
+	F("X-Secret", "abc", VHE_NEVER);
+	expect(vsb, "1086 f2b2 0a4b 0a9f 821c 64");
+	F("Age", "0", VHE_NEVER);
+	expect(vsb, "1f06 8107");
+	F("Age", "0", VHE_NONE);
+	expect(vsb, "0f06 8107");
+	assert(t->n == 0);
+
+	/* Indexed fields are found again, by name and by value */
+	F("Server", "Varnish", VHE_INDEX);
+	expect(vsb, "7685 e23b 2a32 27");
+	F("server", "Varnish", VHE_NONE);
+	expect(vsb, "be");
+	F("server", "Other", VHE_INDEX);
+	expect(vsb, "7684 d499 cb67");
+	F("Server", "Varnish", VHE_INDEX);
+	expect(vsb, "bf");
+	assert(t->n == 2);
+
+	/* Entries larger than the table empty it */
+	VHE_TableSize(vsb, t, 40);
+	F("x-a", "0123456789", VHE_INDEX);
+	expect(vsb, "3f09 4083 f2b0 ff88 0044 cb4d b8eb cfff");
+	assert(t->n == 0);
+	F("x-a", "01", VHE_INDEX);
+	expect(vsb, "4083 f2b0 ff82 007f");
+	F("x-a", "01", VHE_INDEX);
+	expect(vsb, "be");
+	assert(t->n == 1);
+
+	/* And older entries are evicted */
+	F("x-b", "2", VHE_INDEX);
+	expect(vsb, "4083 f2b4 7f81 17");
+	F("x-a", "01", VHE_NONE);
+	expect(vsb, "0083 f2b0 ff82 007f");
+	assert(t->n == 1);
+
+	VHT_Fini(t);
+	VSB_destroy(&vsb);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc == 2 && !strcmp(argv[1], "-v"))
+		verbose = 1;
+	else if (argc != 1) {
+		fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+		return (1);
+	}
+
+	test_integer();
+	test_c4();
+	test_c6();
+	test_index();
+
+	return (0);
+}
+
+#endif	/* ENCODE_TEST_DRIVER */
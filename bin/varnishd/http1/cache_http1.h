@@ -55,10 +55,17 @@ struct v1p_acct {
 int V1P_Enter(void);
 void V1P_Leave(void);
 stream_close_t V1P_Process(const struct req *, int fd, struct v1p_acct *,
-    vtim_real deadline);
+    vtim_real deadline, unsigned tunnel);
 void V1P_Charge(struct req *, const struct v1p_acct *, struct VSC_vbe *);
 
 /* cache_http1_line.c */
+struct v1l_stats {
+	uint64_t	sendfile;
+	uint64_t	zerocopy;
+	uint64_t	zerocopy_copied;
+	uint64_t	zerocopy_fallback;
+};
+
 void V1L_Chunked(struct v1l *v1l);
 void V1L_EndChunk(struct v1l *v1l);
 struct v1l * V1L_Open(struct ws *, int *fd, struct vsl_log *,
@@ -67,4 +74,8 @@ void V1L_NoRollback(struct v1l *v1l);
 stream_close_t V1L_Flush(struct v1l *v1l);
 stream_close_t V1L_Close(struct v1l **v1lp, uint64_t *cnt);
 size_t V1L_Write(struct v1l *v1l, const void *ptr, ssize_t len);
+int V1L_ZeroCopy(struct v1l *v1l, struct v1l_stats *);
+void V1L_UseSendFile(struct v1l *v1l, struct v1l_stats *);
+stream_close_t V1L_SendFile(struct v1l *v1l, const void *ptr, ssize_t len,
+    int fd, off_t off);
 extern const struct vdp * const VDP_v1l;
@@ -65,6 +65,61 @@ v1d_error(struct req *req, struct v1l **v1lp, const char *msg)
 	req->acct.resp_bodybytes += VDP_Close(req->vdc, req->objcore, req->boc);
 }
 
+/*--------------------------------------------------------------------
+ * MSG_ZEROCOPY needs the body to stay put until the kernel is done with
+ * it, which V1L_Close() waits for.  That rules out bodies which are
+ * still being fetched or are freed as they are delivered, and filters
+ * which produce the body in their own buffers.
+ */
+
+static int
+v1d_zerocopy(const struct req *req)
+{
+	const struct vdp_entry *vdpe;
+	ssize_t cl;
+
+	if (cache_param->http1_zerocopy_threshold == 0)
+		return (0);
+	if (req->boc != NULL || req->objcore->flags & OC_F_TRANSIENT)
+		return (0);
+	cl = http_GetContentLength(req->resp);
+	if (cl < cache_param->http1_zerocopy_threshold)
+		return (0);
+	VTAILQ_FOREACH(vdpe, &req->vdc->vdp, list)
+		if (vdpe->vdp != VDP_v1l && vdpe->vdp != &VDP_range)
+			return (0);
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * Send the headers pre-rendered at fetch time if the stored ones were
+ * left untouched, followed by those added for this delivery.
+ */
+
+static unsigned
+v1d_write_hdrs(struct req *req, struct v1l *v1l)
+{
+	const struct http *hp;
+	const void *blk, *hdrs;
+	ssize_t len;
+	int n;
+
+	hp = req->resp;
+	blk = ObjGetAttr(req->wrk, req->objcore, OA_HTTP1HDR, &len);
+	if (blk == NULL || len == 0 ||
+	    strcmp(hp->hd[HTTP_HDR_PROTO].b, "HTTP/1.1"))
+		return (HTTP1_Write(v1l, hp, HTTP1_Resp));
+
+	hdrs = ObjGetAttr(req->wrk, req->objcore, OA_HEADERS, NULL);
+	AN(hdrs);
+	n = HTTP_DecodedPrefix(hp, hdrs);
+	if (n < 0)
+		return (HTTP1_Write(v1l, hp, HTTP1_Resp));
+
+	req->wrk->stats->http1_hdr_block++;
+	return (HTTP1_WriteBlock(v1l, hp, hp->nhd - n, blk, len));
+}
+
 /*--------------------------------------------------------------------
  */
 
@@ -75,11 +130,13 @@ V1D_Deliver(struct req *req, int sendbody)
 	int err = 0, chunked = 0;
 	stream_close_t sc;
 	uint64_t bytes;
+	struct v1l_stats v1ls;
 	struct v1l *v1l;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_ORNULL(req->boc, BOC_MAGIC);
 	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
+	memset(&v1ls, 0, sizeof v1ls);
 
 	if (req->doclose == SC_NULL &&
 	    http_HdrIs(req->resp, H_Connection, "close")) {
@@ -119,6 +176,11 @@ V1D_Deliver(struct req *req, int sendbody)
 			v1d_error(req, &v1l, "Failure to push v1d processor");
 			return (VTR_D_DONE);
 		}
+		if (!chunked && v1d_zerocopy(req))
+			(void)V1L_ZeroCopy(v1l, &v1ls);
+		if (cache_param->http1_sendfile &&
+		    !(req->objcore->flags & OC_F_TRANSIENT))
+			V1L_UseSendFile(v1l, &v1ls);
 	}
 
 	if (WS_Overflowed(req->ws)) {
@@ -136,7 +198,7 @@ V1D_Deliver(struct req *req, int sendbody)
 		return (VTR_D_DONE);
 	}
 
-	req->acct.resp_hdrbytes += HTTP1_Write(v1l, req->resp, HTTP1_Resp);
+	req->acct.resp_hdrbytes += v1d_write_hdrs(req, v1l);
 
 	if (sendbody) {
 		if (DO_DEBUG(DBG_FLUSH_HEAD))
@@ -149,6 +211,10 @@ V1D_Deliver(struct req *req, int sendbody)
 	}
 
 	sc = V1L_Close(&v1l, &bytes);
+	req->wrk->stats->http1_sendfile += v1ls.sendfile;
+	req->wrk->stats->http1_zerocopy += v1ls.zerocopy;
+	req->wrk->stats->http1_zerocopy_copied += v1ls.zerocopy_copied;
+	req->wrk->stats->http1_zerocopy_fallback += v1ls.zerocopy_fallback;
 
 	req->acct.resp_bodybytes += VDP_Close(req->vdc, req->objcore, req->boc);
 
@@ -47,7 +47,28 @@
 
 #include <stdio.h>
 
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H) && \
+    defined(HAVE_LINUX_SOCKIOS_H)
+#  include <sys/ioctl.h>
+#  include <sys/sendfile.h>
+#  include <linux/sockios.h>
+#  define V1L_SENDFILE
+#endif
+
+#if defined(HAVE_LINUX_ERRQUEUE_H)
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <linux/errqueue.h>
+#  include <poll.h>
+#  if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#    define V1L_ZEROCOPY
+/* Below this, the page pinning and completion costs more than the copy */
+#    define V1L_ZEROCOPY_MIN	(16 * 1024)
+#  endif
+#endif
+
 #include "cache_http1.h"
+#include "vtcp.h"
 #include "vtim.h"
 
 /*--------------------------------------------------------------------*/
@@ -55,6 +76,9 @@
 struct v1l {
 	unsigned		magic;
 #define V1L_MAGIC		0x2f2142e5
+	unsigned		sendfile:1;
+	unsigned		sf_pending:1;	/* Socket refers to storage */
+	unsigned		zerocopy:1;
 	int			*wfd;
 	stream_close_t		werr;	/* valid after V1L_Flush() */
 	struct iovec		*iov;
@@ -63,9 +87,11 @@ struct v1l {
 	size_t			liov;
 	size_t			cliov;
 	int			ciov;	/* Chunked header marker */
+	unsigned		zc_pending;	/* Unreleased zerocopy writes */
 	vtim_real		deadline;
 	struct vsl_log		*vsl;
 	uint64_t		cnt;	/* Flushed byte count */
+	struct v1l_stats	*stats;	/* Only for sendfile and zerocopy */
 	struct ws		*ws;
 	uintptr_t		ws_snap;
 	void			**vdp_priv;
@@ -134,6 +160,179 @@ V1L_NoRollback(struct v1l *v1l)
 	v1l->ws_snap = 0;
 }
 
+/*--------------------------------------------------------------------
+ * MSG_ZEROCOPY
+ *
+ * The kernel transmits straight from our buffers, so they must not
+ * change before it tells us it is done with them, through a
+ * notification on the error queue of the socket.  Each successful
+ * zerocopy sendmsg() earns one notification, and V1L_Close() waits for
+ * all of them, while the caller still holds its reference to the
+ * object.  If they do not all arrive before the send timeout, the
+ * connection is aborted instead.
+ *
+ * Sendfile and zerocopy writes are counted in the caller's stats, for
+ * it to add to its worker stats after V1L_Close().
+ */
+
+int
+V1L_ZeroCopy(struct v1l *v1l, struct v1l_stats *stats)
+{
+#ifdef V1L_ZEROCOPY
+	int one = 1;
+#endif
+
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(stats);
+	v1l->stats = stats;
+#ifdef V1L_ZEROCOPY
+	AN(v1l->wfd);
+	assert(v1l->ciov == v1l->siov);		/* Not chunked */
+	if (*v1l->wfd >= 0 && !setsockopt(*v1l->wfd, SOL_SOCKET,
+	    SO_ZEROCOPY, &one, sizeof one)) {
+		v1l->zerocopy = 1;
+		return (0);
+	}
+#endif
+	v1l->stats->zerocopy_fallback++;
+	return (-1);
+}
+
+#ifdef V1L_ZEROCOPY
+static int
+v1l_zerocopy_reap(struct v1l *v1l)
+{
+	union {
+		char		buf[CMSG_SPACE(sizeof(struct sock_extended_err) +
+				    sizeof(struct sockaddr_in6))];
+		struct cmsghdr	align;
+	} cbuf;
+	const struct sock_extended_err *ee;
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	struct pollfd pfd[1];
+	vtim_dur tmo;
+	unsigned n;
+
+	while (v1l->zc_pending > 0) {
+		if (*v1l->wfd < 0)
+			return (-1);
+		memset(&msg, 0, sizeof msg);
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof cbuf.buf;
+		if (recvmsg(*v1l->wfd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				return (-1);
+			tmo = v1l->deadline - VTIM_real();
+			if (tmo <= 0.)
+				return (-1);
+			/* POLLERR is always reported, no need to ask */
+			pfd->fd = *v1l->wfd;
+			pfd->events = 0;
+			pfd->revents = 0;
+			(void)poll(pfd, 1, VTIM_poll_tmo(tmo));
+			continue;
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		    cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == SOL_IP &&
+			    cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 &&
+			    cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			ee = (const void *)CMSG_DATA(cm);
+			if (ee->ee_errno != 0 ||
+			    ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			/* A range of notification ids, both inclusive */
+			n = ee->ee_data - ee->ee_info + 1;
+			if (n > v1l->zc_pending)
+				n = v1l->zc_pending;
+			v1l->zc_pending -= n;
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				v1l->stats->zerocopy_copied += n;
+		}
+	}
+	return (0);
+}
+#endif
+
+static ssize_t
+v1l_writev(struct v1l *v1l)
+{
+#ifdef V1L_ZEROCOPY
+	struct msghdr msg;
+	ssize_t i;
+
+	if (v1l->zerocopy && v1l->liov >= V1L_ZEROCOPY_MIN) {
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = v1l->iov;
+		msg.msg_iovlen = v1l->niov;
+		i = sendmsg(*v1l->wfd, &msg, MSG_ZEROCOPY);
+		if (i > 0) {
+			v1l->zc_pending++;
+			v1l->stats->zerocopy++;
+			return (i);
+		}
+		/* Out of memory for the notifications, copy instead */
+		if (i == 0 || errno != ENOBUFS)
+			return (i);
+	}
+	if (v1l->zerocopy)
+		v1l->stats->zerocopy_fallback++;
+#endif
+	return (writev(*v1l->wfd, v1l->iov, v1l->niov));
+}
+
+#ifdef V1L_SENDFILE
+/*--------------------------------------------------------------------
+ * Once sendfile(2) returns, the socket still refers to the pages of the
+ * storage file until the client has acknowledged them, and the storage
+ * must stay put until then.  There is no notification for that, so poll
+ * the send queue until it is empty.
+ */
+
+static int
+v1l_sendfile_drain(struct v1l *v1l)
+{
+	vtim_dur tmo = 1e-4;
+	int n;
+
+	while (v1l->sf_pending) {
+		if (*v1l->wfd < 0 ||
+		    ioctl(*v1l->wfd, SIOCOUTQ, &n) < 0)
+			return (-1);
+		if (n == 0) {
+			v1l->sf_pending = 0;
+			break;
+		}
+		if (VTIM_real() > v1l->deadline)
+			return (-1);
+		VTIM_sleep(tmo);
+		if (tmo < 1e-2)
+			tmo *= 2;
+	}
+	return (0);
+}
+#endif
+
+#if defined(V1L_SENDFILE) || defined(V1L_ZEROCOPY)
+/*
+ * The kernel may still send from storage we are about to release, so
+ * make sure the connection goes away with whatever it has queued.
+ */
+
+static void
+v1l_abort(struct v1l *v1l)
+{
+
+	if (*v1l->wfd < 0)
+		return;
+	(void)VTCP_linger(*v1l->wfd, 1);
+	(void)shutdown(*v1l->wfd, SHUT_RDWR);
+}
+#endif
+
 stream_close_t
 V1L_Close(struct v1l **v1lp, uint64_t *cnt)
 {
@@ -149,6 +348,25 @@ V1L_Close(struct v1l **v1lp, uint64_t *cnt)
 		*v1l->vdp_priv = NULL;
 	}
 	sc = V1L_Flush(v1l);
+#ifdef V1L_SENDFILE
+	if (v1l_sendfile_drain(v1l)) {
+		VSLb(v1l->vsl, SLT_Debug,
+		    "Sendfile data not acknowledged, aborting connection");
+		v1l_abort(v1l);
+		if (sc == SC_NULL)
+			sc = SC_TX_ERROR;
+	}
+#endif
+#ifdef V1L_ZEROCOPY
+	if (v1l_zerocopy_reap(v1l)) {
+		VSLb(v1l->vsl, SLT_Debug,
+		    "Zerocopy buffers not released, %u writes pending, "
+		    "aborting connection", v1l->zc_pending);
+		v1l_abort(v1l);
+		if (sc == SC_NULL)
+			sc = SC_TX_ERROR;
+	}
+#endif
 	*cnt = v1l->cnt;
 	ws = v1l->ws;
 	ws_snap = v1l->ws_snap;
@@ -232,7 +450,7 @@ V1L_Flush(struct v1l *v1l)
 				break;
 			}
 
-			i = writev(*v1l->wfd, v1l->iov, v1l->niov);
+			i = v1l_writev(v1l);
 			if (i > 0) {
 				v1l->cnt += (size_t)i;
 				if ((size_t)i == v1l->liov)
@@ -309,12 +527,123 @@ V1L_Write(struct v1l *v1l, const void *ptr, ssize_t alen)
 	return (len);
 }
 
+/*--------------------------------------------------------------------
+ * Allow V1L_SendFile() to use sendfile(2).  The caller must keep the
+ * storage in place until V1L_Close(), which waits for the socket to
+ * stop referring to it.
+ */
+
+void
+V1L_UseSendFile(struct v1l *v1l, struct v1l_stats *stats)
+{
+
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(stats);
+	v1l->stats = stats;
+#ifdef V1L_SENDFILE
+	v1l->sendfile = 1;
+#endif
+}
+
+/*--------------------------------------------------------------------
+ * Send len bytes, which are also found at offset off of file descriptor
+ * fd, after whatever is already queued.
+ *
+ * With sendfile(2) the bytes go from the page cache to the socket
+ * without a detour through user space.  Chunked bodies, deliveries
+ * without V1L_UseSendFile(), and file descriptors for which sendfile(2)
+ * does not work, fall back to writing the bytes at ptr.
+ */
+
+stream_close_t
+V1L_SendFile(struct v1l *v1l, const void *ptr, ssize_t len, int fd, off_t off)
+{
+#ifdef V1L_SENDFILE
+	ssize_t i = 0;
+	size_t left;
+	int err = 0;
+#endif
+
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	CHECK_OBJ_NOTNULL(v1l->werr, STREAM_CLOSE_MAGIC);
+	AN(v1l->wfd);
+	AN(ptr);
+	assert(len > 0);
+	assert(fd >= 0);
+	assert(off >= 0);
+
+#ifdef V1L_SENDFILE
+	if (v1l->ciov == v1l->siov && v1l->sendfile) {
+		if (V1L_Flush(v1l) != SC_NULL || *v1l->wfd < 0)
+			return (v1l->werr);
+
+		left = (size_t)len;
+		while (left > 0) {
+			if (VTIM_real() > v1l->deadline) {
+				VSLb(v1l->vsl, SLT_Debug,
+				    "Hit total send timeout, "
+				    "wrote = %zd/%zd; not retrying",
+				    len - (ssize_t)left, len);
+				i = -1;
+				err = 0;
+				break;
+			}
+
+			i = sendfile(*v1l->wfd, fd, &off, left);
+			if (i > 0) {
+				v1l->sf_pending = 1;
+				v1l->cnt += (size_t)i;
+				left -= (size_t)i;
+				continue;
+			}
+			err = errno;
+			if (i < 0 && left == (size_t)len &&
+			    (err == EINVAL || err == ENOSYS)) {
+				/* Not for this pair of fds, write(2) instead */
+				v1l->sendfile = 0;
+				break;
+			}
+			if (i < 0 && err == EWOULDBLOCK) {
+				VSLb(v1l->vsl, SLT_Debug,
+				    "Hit idle send timeout, "
+				    "wrote = %zd/%zd; retrying",
+				    len - (ssize_t)left, len);
+				continue;
+			}
+			break;
+		}
+
+		if (left == 0) {
+			v1l->stats->sendfile++;
+			return (v1l->werr);
+		}
+		if (v1l->sendfile) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Write error, retval = %zd, len = %zd, errno = %s",
+			    i, len, VAS_errtxt(err));
+			assert(v1l->werr == SC_NULL);
+			if (err == EPIPE)
+				v1l->werr = SC_REM_CLOSE;
+			else
+				v1l->werr = SC_TX_ERROR;
+			return (v1l->werr);
+		}
+	}
+#else
+	(void)fd;
+	(void)off;
+#endif
+	(void)V1L_Write(v1l, ptr, len);
+	return (v1l->werr);
+}
+
 void
 V1L_Chunked(struct v1l *v1l)
 {
 
 	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
 
+	AZ(v1l->zerocopy);
 	assert(v1l->ciov == v1l->siov);
 	assert(v1l->siov >= 3);
 	/*
@@ -393,8 +722,52 @@ v1l_bytes(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
 	return (0);
 }
 
+static int v_matchproto_(vdp_bytesv_f)
+v1l_bytesv(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
+    const struct iovec *iov, int niov)
+{
+	size_t wl = 0, l = 0;
+	int i;
+
+	CHECK_OBJ_NOTNULL(vdc, VDP_CTX_MAGIC);
+	AN(priv);
+
+	AZ(vdc->nxt);		/* always at the bottom of the pile */
+
+	for (i = 0; i < niov; i++) {
+		l += iov[i].iov_len;
+		wl += V1L_Write(*priv, iov[i].iov_base, iov[i].iov_len);
+		if (wl != l)
+			break;
+	}
+	if (act > VDP_NULL && V1L_Flush(*priv) != SC_NULL)
+		return (-1);
+	if (wl != l)
+		return (-1);
+	return (0);
+}
+
+static int v_matchproto_(vdp_extent_f)
+v1l_extent(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
+    const void *ptr, ssize_t len, int fd, off_t off)
+{
+
+	CHECK_OBJ_NOTNULL(vdc, VDP_CTX_MAGIC);
+	AN(priv);
+
+	AZ(vdc->nxt);		/* always at the bottom of the pile */
+
+	if (len > 0 && V1L_SendFile(*priv, ptr, len, fd, off) != SC_NULL)
+		return (-1);
+	if (act > VDP_NULL && V1L_Flush(*priv) != SC_NULL)
+		return (-1);
+	return (0);
+}
+
 const struct vdp * const VDP_v1l = &(struct vdp){
 	.name =		"V1B",
 	.init =		v1l_init,
 	.bytes =	v1l_bytes,
+	.extent =	v1l_extent,
+	.bytesv =	v1l_bytesv,
 };
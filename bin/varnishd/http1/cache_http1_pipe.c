@@ -35,8 +35,15 @@
 
 #include "cache/cache_varnishd.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_EPOLL_CTL
+#  include <sys/epoll.h>
+#endif
 
 #include "cache_http1.h"
 #include "vtcp.h"
@@ -68,6 +75,539 @@ rdf(int fd0, int fd1, uint64_t *pcnt)
 	return (0);
 }
 
+#ifdef HAVE_SPLICE
+
+/*--------------------------------------------------------------------
+ * On Linux, move the bytes through a pipe with splice(2), so they never
+ * get copied to user space.  Each direction fills its pipe from the
+ * source only when the pipe is empty and drains it into the destination
+ * as far as the destination will take it, waiting for POLLOUT rather
+ * than sleeping if it will not take everything at once.
+ */
+
+#define V1P_SPLICE_LEN		(64 * 1024)
+
+struct v1p_splice {
+	int		rfd;
+	int		wfd;
+	int		pfd[2];
+	size_t		len;
+	uint64_t	*cnt;
+	int		done;
+};
+
+static void
+v1p_splice_fini(struct v1p_splice *vs)
+{
+
+	if (vs->pfd[0] >= 0)
+		closefd(&vs->pfd[0]);
+	if (vs->pfd[1] >= 0)
+		closefd(&vs->pfd[1]);
+}
+
+static int
+v1p_splice_init(struct v1p_splice *vs, int rfd, int wfd, uint64_t *cnt)
+{
+
+	memset(vs, 0, sizeof *vs);
+	vs->rfd = rfd;
+	vs->wfd = wfd;
+	vs->cnt = cnt;
+	if (pipe(vs->pfd)) {
+		vs->pfd[0] = -1;
+		vs->pfd[1] = -1;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Returns -1 if splice(2) does not work for these file descriptors,
+ * and 1 if this direction is done.
+ */
+
+static int
+v1p_splice_step(struct v1p_splice *vs, short rev, short wev)
+{
+	ssize_t i;
+
+	if (vs->len == 0) {
+		if (rev == 0)
+			return (0);
+		i = splice(vs->rfd, NULL, vs->pfd[1], NULL, V1P_SPLICE_LEN,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (i < 0 && errno == EINVAL)
+			return (-1);
+		if (i < 0 && errno == EAGAIN)
+			return (0);
+		VTCP_Assert(i);
+		if (i <= 0)
+			return (1);
+		vs->len = i;
+	} else if (wev == 0)
+		return (0);
+
+	/* Try to write right away, the destination is likely ready */
+	i = splice(vs->pfd[0], NULL, vs->wfd, NULL, vs->len,
+	    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (i < 0 && errno == EINVAL)
+		return (-1);
+	if (i < 0 && errno == EAGAIN)
+		return (0);
+	VTCP_Assert(i);
+	if (i <= 0)
+		return (1);
+	assert((size_t)i <= vs->len);
+	vs->len -= i;
+	*vs->cnt += i;
+	return (0);
+}
+
+static void
+v1p_splice_poll(const struct v1p_splice *vs, struct pollfd *rpfd,
+    struct pollfd *wpfd)
+{
+
+	if (vs->done)
+		return;
+	if (vs->len == 0)
+		rpfd->events |= POLLIN;
+	else
+		wpfd->events |= POLLOUT;
+}
+
+/*
+ * Returns -1 if splice(2) cannot be used, before any byte was moved
+ */
+
+static int
+v1p_splice(const struct req *req, int fd, struct v1p_acct *v1a,
+    vtim_real deadline, stream_close_t *sc)
+{
+	struct v1p_splice vs[2], *vp;
+	struct pollfd fds[2];
+	vtim_dur tmo, tmo_task;
+	uint64_t in, out;
+	int i, j;
+
+	if (v1p_splice_init(&vs[0], fd, req->sp->fd, &v1a->out) ||
+	    v1p_splice_init(&vs[1], req->sp->fd, fd, &v1a->in)) {
+		v1p_splice_fini(&vs[0]);
+		v1p_splice_fini(&vs[1]);
+		return (-1);
+	}
+	in = v1a->in;
+	out = v1a->out;
+
+	memset(fds, 0, sizeof fds);
+
+	*sc = SC_TX_PIPE;
+	while (!vs[0].done || !vs[1].done) {
+		fds[0].events = fds[0].revents = 0;
+		fds[1].events = fds[1].revents = 0;
+		v1p_splice_poll(&vs[0], &fds[0], &fds[1]);
+		v1p_splice_poll(&vs[1], &fds[1], &fds[0]);
+		/* POLLHUP is reported even if we wait for nothing */
+		fds[0].fd = fds[0].events ? fd : -1;
+		fds[1].fd = fds[1].events ? req->sp->fd : -1;
+		tmo = cache_param->pipe_timeout;
+		if (tmo == 0.)
+			tmo = INFINITY;
+		if (deadline > 0.) {
+			tmo_task = deadline - VTIM_real();
+			tmo = vmin(tmo, tmo_task);
+		}
+		i = poll(fds, 2, VTIM_poll_tmo(tmo));
+		if (i == 0)
+			*sc = SC_RX_TIMEOUT;
+		if (i < 1)
+			break;
+		for (j = 0; j < 2; j++) {
+			vp = &vs[j];
+			if (vp->done)
+				continue;
+			i = v1p_splice_step(vp, fds[j].revents & ~POLLOUT,
+			    fds[1 - j].revents & ~POLLIN);
+			if (i < 0 && in == v1a->in && out == v1a->out) {
+				v1p_splice_fini(&vs[0]);
+				v1p_splice_fini(&vs[1]);
+				return (-1);
+			}
+			if (i == 0)
+				continue;
+			vp->done = 1;
+			if (vs[1 - j].done)
+				break;
+			(void)shutdown(vp->rfd, SHUT_RD);
+			(void)shutdown(vp->wfd, SHUT_WR);
+		}
+	}
+	v1p_splice_fini(&vs[0]);
+	v1p_splice_fini(&vs[1]);
+	return (0);
+}
+
+#endif
+
+#ifdef HAVE_EPOLL_CTL
+
+/*--------------------------------------------------------------------
+ * Tunnel threads
+ *
+ * Instead of tying up a worker thread for the life of the connection,
+ * a piped session can be handed off to one of pipe_tunnel_threads
+ * tunnel threads.  These watch both ends of all their tunnels with
+ * epoll, and move the bytes with non-blocking I/O through a small
+ * buffer per direction.
+ *
+ * The tunnel gets its own copies of the two file descriptors, so the
+ * worker can close the session and backend connection as usual.
+ */
+
+#define V1P_TUNNEL_BUF		(8 * 1024)
+#define V1P_TUNNEL_NEV		64
+
+struct v1p_tunnel;
+
+struct v1p_end {
+	struct v1p_tunnel	*tun;
+	int			fd;
+	uint32_t		events;
+};
+
+struct v1p_dir {
+	struct v1p_end		*src;
+	struct v1p_end		*dst;
+	char			*buf;
+	size_t			off;
+	size_t			len;
+	uint64_t		*cnt;
+	int			done;
+};
+
+struct v1p_tunnel {
+	unsigned		magic;
+#define V1P_TUNNEL_MAGIC	0x1c0a5e3d
+	VTAILQ_ENTRY(v1p_tunnel) list;
+	struct v1p_end		end[2];
+	struct v1p_dir		dir[2];
+	vtim_real		t_idle;
+	vtim_real		deadline;
+	uint64_t		in;
+	uint64_t		out;
+	int			closed;
+	char			buf[2][V1P_TUNNEL_BUF];
+};
+
+VTAILQ_HEAD(v1p_tunnel_head, v1p_tunnel);
+
+struct v1p_tunthr {
+	unsigned		magic;
+#define V1P_TUNTHR_MAGIC	0x5e8f11a4
+	int			epfd;
+	struct lock		mtx;
+	struct v1p_tunnel_head	tunnels;
+};
+
+static struct v1p_tunthr	*v1p_tunthr;
+static unsigned			v1p_ntunthr;
+static unsigned			v1p_nexttunthr;
+
+static void
+v1p_tunnel_events(const struct v1p_tunthr *tt, struct v1p_end *ve)
+{
+	struct v1p_tunnel *tun;
+	struct v1p_dir *vd;
+	struct epoll_event ev;
+	unsigned u;
+
+	tun = ve->tun;
+	CHECK_OBJ_NOTNULL(tun, V1P_TUNNEL_MAGIC);
+	ev.events = 0;
+	for (u = 0; u < 2; u++) {
+		vd = &tun->dir[u];
+		if (vd->done)
+			continue;
+		if (vd->len == 0 && vd->src == ve)
+			ev.events |= EPOLLIN;
+		if (vd->len > 0 && vd->dst == ve)
+			ev.events |= EPOLLOUT;
+	}
+	if (ev.events == ve->events)
+		return;
+	/*
+	 * EPOLLHUP and EPOLLERR are reported even without any events, so
+	 * an end with nothing to wait for is taken out of the epoll set.
+	 */
+	ev.data.ptr = ve;
+	if (ev.events == 0)
+		AZ(epoll_ctl(tt->epfd, EPOLL_CTL_DEL, ve->fd, NULL));
+	else if (ve->events == 0)
+		AZ(epoll_ctl(tt->epfd, EPOLL_CTL_ADD, ve->fd, &ev));
+	else
+		AZ(epoll_ctl(tt->epfd, EPOLL_CTL_MOD, ve->fd, &ev));
+	ve->events = ev.events;
+}
+
+/* Returns non-zero when this direction is done */
+
+static int
+v1p_tunnel_move(struct v1p_dir *vd, int rd, int wr)
+{
+	ssize_t i;
+
+	if (vd->len == 0) {
+		if (!rd)
+			return (0);
+		i = read(vd->src->fd, vd->buf, V1P_TUNNEL_BUF);
+		if (i < 0 && errno == EAGAIN)
+			return (0);
+		VTCP_Assert(i);
+		if (i <= 0)
+			return (1);
+		vd->off = 0;
+		vd->len = i;
+	} else if (!wr)
+		return (0);
+
+	/* Try to write right away, the destination is likely ready */
+	i = write(vd->dst->fd, vd->buf + vd->off, vd->len);
+	if (i < 0 && errno == EAGAIN)
+		return (0);
+	VTCP_Assert(i);
+	if (i <= 0)
+		return (1);
+	assert((size_t)i <= vd->len);
+	vd->off += i;
+	vd->len -= i;
+	*vd->cnt += i;
+	return (0);
+}
+
+/*
+ * The worker may still hold the original descriptors, so closing ours does
+ * not take them out of the epoll set.  Events for the tunnel may also be
+ * pending in the current batch, so it is only freed by the caller, once
+ * the batch is done.
+ */
+
+static void
+v1p_tunnel_close(struct v1p_tunthr *tt, struct v1p_tunnel *tun,
+    struct v1p_tunnel_head *dead)
+{
+
+	CHECK_OBJ_NOTNULL(tun, V1P_TUNNEL_MAGIC);
+	AZ(tun->closed);
+	tun->closed = 1;
+	if (tun->end[0].events != 0)
+		AZ(epoll_ctl(tt->epfd, EPOLL_CTL_DEL, tun->end[0].fd, NULL));
+	if (tun->end[1].events != 0)
+		AZ(epoll_ctl(tt->epfd, EPOLL_CTL_DEL, tun->end[1].fd, NULL));
+	closefd(&tun->end[0].fd);
+	closefd(&tun->end[1].fd);
+
+	Lck_Lock(&tt->mtx);
+	VTAILQ_REMOVE(&tt->tunnels, tun, list);
+	Lck_Unlock(&tt->mtx);
+	VTAILQ_INSERT_TAIL(dead, tun, list);
+
+	Lck_Lock(&pipestat_mtx);
+	VSC_C_main->s_pipe_in += tun->in;
+	VSC_C_main->s_pipe_out += tun->out;
+	assert(VSC_C_main->n_pipe > 0);
+	VSC_C_main->n_pipe--;
+	Lck_Unlock(&pipestat_mtx);
+}
+
+static void
+v1p_tunnel_action(struct v1p_tunthr *tt, struct v1p_end *ve, uint32_t ev,
+    vtim_real now, struct v1p_tunnel_head *dead)
+{
+	struct v1p_tunnel *tun;
+	struct v1p_dir *vd;
+	unsigned u;
+
+	tun = ve->tun;
+	CHECK_OBJ_NOTNULL(tun, V1P_TUNNEL_MAGIC);
+	if (tun->closed)
+		return;
+	tun->t_idle = now;
+	for (u = 0; u < 2; u++) {
+		vd = &tun->dir[u];
+		if (vd->done)
+			continue;
+		if (!v1p_tunnel_move(vd,
+		    vd->src == ve && (ev & ~EPOLLOUT),
+		    vd->dst == ve && (ev & ~EPOLLIN)))
+			continue;
+		vd->done = 1;
+		if (tun->dir[1 - u].done) {
+			v1p_tunnel_close(tt, tun, dead);
+			return;
+		}
+		(void)shutdown(vd->src->fd, SHUT_RD);
+		(void)shutdown(vd->dst->fd, SHUT_WR);
+	}
+	v1p_tunnel_events(tt, &tun->end[0]);
+	v1p_tunnel_events(tt, &tun->end[1]);
+}
+
+static void
+v1p_tunnel_timeout(struct v1p_tunthr *tt, vtim_real now,
+    struct v1p_tunnel_head *dead)
+{
+	struct v1p_tunnel *tun, *tun2;
+	vtim_dur tmo;
+
+	/* Only this thread removes tunnels from the list */
+	tmo = cache_param->pipe_timeout;
+	Lck_Lock(&tt->mtx);
+	tun = VTAILQ_FIRST(&tt->tunnels);
+	Lck_Unlock(&tt->mtx);
+	for (; tun != NULL; tun = tun2) {
+		CHECK_OBJ_NOTNULL(tun, V1P_TUNNEL_MAGIC);
+		Lck_Lock(&tt->mtx);
+		tun2 = VTAILQ_NEXT(tun, list);
+		Lck_Unlock(&tt->mtx);
+		if ((tmo > 0. && tun->t_idle + tmo < now) ||
+		    (tun->deadline > 0. && tun->deadline < now))
+			v1p_tunnel_close(tt, tun, dead);
+	}
+}
+
+static void * v_matchproto_(bgthread_t)
+v1p_tunnel_thread(struct worker *wrk, void *priv)
+{
+	struct epoll_event ev[V1P_TUNNEL_NEV];
+	struct v1p_tunnel_head dead;
+	struct v1p_tunthr *tt;
+	struct v1p_tunnel *tun;
+	vtim_real now, scan;
+	vtim_dur tmo;
+	int i, n;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(tt, priv, V1P_TUNTHR_MAGIC);
+	VTAILQ_INIT(&dead);
+	scan = VTIM_real();
+	while (1) {
+		/* Look for timeouts at least once per second */
+		tmo = cache_param->pipe_timeout;
+		if (tmo <= 0. || tmo > 1.)
+			tmo = 1.;
+		do {
+			n = epoll_wait(tt->epfd, ev, V1P_TUNNEL_NEV,
+			    VTIM_poll_tmo(tmo));
+		} while (n < 0 && errno == EINTR);
+		assert(n >= 0);
+		now = VTIM_real();
+		for (i = 0; i < n; i++) {
+			AN(ev[i].data.ptr);
+			v1p_tunnel_action(tt, ev[i].data.ptr, ev[i].events,
+			    now, &dead);
+		}
+		if (now - scan >= tmo) {
+			v1p_tunnel_timeout(tt, now, &dead);
+			scan = now;
+		}
+		while ((tun = VTAILQ_FIRST(&dead)) != NULL) {
+			VTAILQ_REMOVE(&dead, tun, list);
+			FREE_OBJ(tun);
+		}
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*
+ * Returns non-zero if the session could not be handed off
+ */
+
+static int
+v1p_tunnel_enter(const struct req *req, int fd, vtim_real deadline)
+{
+	struct v1p_tunnel *tun;
+	struct v1p_tunthr *tt;
+	struct epoll_event ev;
+	unsigned u;
+
+	if (v1p_ntunthr == 0)
+		return (-1);
+
+	ALLOC_OBJ(tun, V1P_TUNNEL_MAGIC);
+	if (tun == NULL)
+		return (-1);
+	tun->end[0].fd = dup(fd);
+	tun->end[1].fd = dup(req->sp->fd);
+	if (tun->end[0].fd < 0 || tun->end[1].fd < 0) {
+		if (tun->end[0].fd >= 0)
+			closefd(&tun->end[0].fd);
+		if (tun->end[1].fd >= 0)
+			closefd(&tun->end[1].fd);
+		FREE_OBJ(tun);
+		return (-1);
+	}
+	for (u = 0; u < 2; u++) {
+		VTCP_nonblocking(tun->end[u].fd);
+		tun->end[u].tun = tun;
+		tun->end[u].events = EPOLLIN;
+		tun->dir[u].src = &tun->end[u];
+		tun->dir[u].dst = &tun->end[1 - u];
+		tun->dir[u].buf = tun->buf[u];
+	}
+	tun->dir[0].cnt = &tun->out;
+	tun->dir[1].cnt = &tun->in;
+	tun->t_idle = VTIM_real();
+	tun->deadline = deadline;
+
+	/* The worker's V1P_Leave() is balanced by v1p_tunnel_close() */
+	Lck_Lock(&pipestat_mtx);
+	VSC_C_main->n_pipe++;
+	VSC_C_main->pipe_tunnel++;
+	u = v1p_nexttunthr++ % v1p_ntunthr;
+	Lck_Unlock(&pipestat_mtx);
+
+	tt = &v1p_tunthr[u];
+	CHECK_OBJ(tt, V1P_TUNTHR_MAGIC);
+	Lck_Lock(&tt->mtx);
+	VTAILQ_INSERT_TAIL(&tt->tunnels, tun, list);
+	Lck_Unlock(&tt->mtx);
+
+	for (u = 0; u < 2; u++) {
+		ev.events = tun->end[u].events;
+		ev.data.ptr = &tun->end[u];
+		AZ(epoll_ctl(tt->epfd, EPOLL_CTL_ADD, tun->end[u].fd, &ev));
+	}
+	return (0);
+}
+
+static void
+v1p_tunnel_init(void)
+{
+	struct v1p_tunthr *tt;
+	pthread_t thr;
+	unsigned u;
+
+	v1p_ntunthr = cache_param->pipe_tunnel_threads;
+	if (v1p_ntunthr == 0)
+		return;
+	v1p_tunthr = calloc(v1p_ntunthr, sizeof *v1p_tunthr);
+	AN(v1p_tunthr);
+	for (u = 0; u < v1p_ntunthr; u++) {
+		tt = &v1p_tunthr[u];
+		INIT_OBJ(tt, V1P_TUNTHR_MAGIC);
+		tt->epfd = epoll_create(1);
+		assert(tt->epfd >= 0);
+		Lck_New(&tt->mtx, lck_pipestat);
+		VTAILQ_INIT(&tt->tunnels);
+		WRK_BgThread(&thr, "pipe-tunnel", v1p_tunnel_thread, tt);
+	}
+}
+
+#endif
+
+/*--------------------------------------------------------------------*/
+
 int
 V1P_Enter(void)
 {
@@ -116,7 +656,7 @@ V1P_Charge(struct req *req, const struct v1p_acct *a, struct VSC_vbe *b)
 
 stream_close_t
 V1P_Process(const struct req *req, int fd, struct v1p_acct *v1a,
-    vtim_real deadline)
+    vtim_real deadline, unsigned tunnel)
 {
 	struct pollfd fds[2];
 	vtim_dur tmo, tmo_task;
@@ -137,6 +677,19 @@ V1P_Process(const struct req *req, int fd, struct v1p_acct *v1a,
 		req->htc->pipeline_e = NULL;
 		v1a->in += j;
 	}
+
+#ifdef HAVE_EPOLL_CTL
+	if (tunnel && !v1p_tunnel_enter(req, fd, deadline))
+		return (SC_TX_PIPE);
+#else
+	(void)tunnel;
+#endif
+
+#ifdef HAVE_SPLICE
+	if (!v1p_splice(req, fd, v1a, deadline, &sc))
+		return (sc);
+#endif
+
 	memset(fds, 0, sizeof fds);
 	fds[0].fd = fd;
 	fds[0].events = POLLIN;
@@ -189,4 +742,7 @@ V1P_Init(void)
 {
 
 	Lck_New(&pipestat_mtx, lck_pipestat);
+#ifdef HAVE_EPOLL_CTL
+	v1p_tunnel_init();
+#endif
 }
@@ -124,10 +124,9 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 		if (vct_iscrlf(p, htc->rxbuf_e))
 			break;
 		while (r < htc->rxbuf_e) {
-			if (vct_ishdrval(*r)) {
-				r++;
-				continue;
-			}
+			r += VCT_hdrval_span(r, htc->rxbuf_e);
+			if (r == htc->rxbuf_e)
+				break;
 			i = vct_iscrlf(r, htc->rxbuf_e);
 			if (i == 0) {
 				VSLb(hp->vsl, SLT_BogoHeader,
@@ -198,6 +197,7 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 			hp->hd[hp->nhd].b = p;
 			hp->hd[hp->nhd].e = q;
 			hp->nhd++;
+			HTTP_IndexHdr(hp, hp->nhd - 1);
 		} else {
 			VSLb(hp->vsl, SLT_BogoHeader, "Too many headers: %.*s",
 			    (int)(q - p > 20 ? 20 : q - p), p);
@@ -276,10 +276,7 @@ http1_splitline(struct http *hp, struct http_conn *htc, const int *hf,
 
 	/* Third field is optional and cannot contain CTL except TAB */
 	q = p;
-	for (; p < htc->rxbuf_e && !vct_iscrlf(p, htc->rxbuf_e); p++) {
-		if (vct_isctl(*p) && !vct_issp(*p))
-			return (400);
-	}
+	p += VCT_hdrval_span(p, htc->rxbuf_e);
 	if (p > q) {
 		hp->hd[hf[2]].b = q;
 		hp->hd[hf[2]].e = p;
@@ -495,3 +492,88 @@ HTTP1_Write(struct v1l *v1l, const struct http *hp, const int *hf)
 	l += V1L_Write(v1l, "\r\n", -1);
 	return (l);
 }
+
+/*--------------------------------------------------------------------
+ * The status line and headers of an object, rendered the way
+ * HTTP1_Write() sends them in a response, without the final CRLF.
+ * The fields are filtered like HTTP_Encode() does, so the block
+ * matches the stored headers.
+ */
+
+static const char http1_blk_proto[] = "HTTP/1.1 ";
+
+unsigned
+HTTP1_EstimateBlock(const struct http *hp, unsigned how)
+{
+	unsigned u, l;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	l = sizeof http1_blk_proto - 1;
+	l += Tlen(hp->hd[HTTP_HDR_STATUS]) + 1;
+	l += Tlen(hp->hd[HTTP_HDR_REASON]) + 2;
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		if (!http_IsFiltered(hp, u, how))
+			l += Tlen(hp->hd[u]) + 2;
+	}
+	return (l);
+}
+
+static uint8_t *
+http1_blk_txt(uint8_t *p, const uint8_t *e, const txt *t, const char *suf)
+{
+	size_t l, sl;
+
+	Tcheck(*t);
+	l = Tlen(*t);
+	sl = strlen(suf);
+	assert(p + l + sl <= e);
+	memcpy(p, t->b, l);
+	memcpy(p + l, suf, sl);
+	return (p + l + sl);
+}
+
+void
+HTTP1_EncodeBlock(const struct http *hp, uint8_t *p, unsigned l,
+    unsigned how)
+{
+	const uint8_t *e;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	AN(p);
+	e = p + l;
+
+	assert(p + sizeof http1_blk_proto - 1 <= e);
+	memcpy(p, http1_blk_proto, sizeof http1_blk_proto - 1);
+	p += sizeof http1_blk_proto - 1;
+	p = http1_blk_txt(p, e, &hp->hd[HTTP_HDR_STATUS], " ");
+	p = http1_blk_txt(p, e, &hp->hd[HTTP_HDR_REASON], "\r\n");
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		if (!http_IsFiltered(hp, u, how))
+			p = http1_blk_txt(p, e, &hp->hd[u], "\r\n");
+	}
+	assert(p == e);
+}
+
+/*--------------------------------------------------------------------
+ * Send a pre-rendered block in place of the status line and the first
+ * headers, and the headers from 'u' on as usual.
+ */
+
+unsigned
+HTTP1_WriteBlock(struct v1l *v1l, const struct http *hp, unsigned u,
+    const void *blk, ssize_t len)
+{
+	unsigned l;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	AN(blk);
+	assert(len > 0);
+	assert(u >= HTTP_HDR_FIRST);
+
+	l = V1L_Write(v1l, blk, len);
+	for (; u < hp->nhd; u++)
+		l += http1_WrTxt(v1l, &hp->hd[u], "\r\n");
+	l += V1L_Write(v1l, "\r\n", -1);
+	return (l);
+}
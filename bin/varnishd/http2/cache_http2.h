@@ -154,8 +154,21 @@ struct h2_req {
 
 	VTAILQ_ENTRY(h2_req)		tx_list;
 	h2_error			error;
+
+	/* rfc9218 priority, lower urgency is sent first */
+	int				urgency;
+	int				incremental;
+
+	/* DATA waiting for window, see h2_outq_size */
+	uint8_t				*outq;
+	unsigned			outq_head;
+	unsigned			outq_len;
+	int				outq_end;
 };
 
+#define H2_URGENCY_DEFAULT		3
+#define H2_URGENCY_CONTROL		-1	/* stream 0 */
+
 VTAILQ_HEAD(h2_req_s, h2_req);
 
 struct h2_sess {
@@ -185,6 +198,9 @@ struct h2_sess {
 	struct vsl_log			*vsl;
 	struct h2h_decode		*decode;
 	struct vht_table		dectbl[1];
+	struct vht_table		enctbl[1];
+	uint32_t			enctbl_size;	// as known to the client
+	uint32_t			enctbl_low;	// since the last block
 
 	unsigned			rxf_len;
 	unsigned			rxf_type;
@@ -201,6 +217,15 @@ struct h2_sess {
 
 	VTAILQ_HEAD(,h2_req)		txqueue;
 
+	/* Frames not yet written, owned by the head of the txqueue */
+	uint8_t				*txbuf;
+	unsigned			txbuf_size;
+	unsigned			txbuf_len;
+	vtim_mono			txbuf_t;
+
+	unsigned			outq_size;
+	int				outq_streams;
+
 	h2_error			error;
 
 	// rst rate limit parameters, copied from h2_* parameters
@@ -263,6 +288,8 @@ void H2_Send_RST(struct worker *wrk, struct h2_sess *h2,
 void H2_Send(struct worker *, struct h2_req *, h2_frame type, uint8_t flags,
     uint32_t len, const void *, uint64_t *acct);
 
+void H2_Send_Queued(struct worker *, struct h2_sess *);
+
 /* cache_http2_proto.c */
 struct h2_req * h2_new_req(struct h2_sess *, unsigned stream, struct req *);
 h2_error h2_stream_tmo(struct h2_sess *, const struct h2_req *, vtim_real);
@@ -33,7 +33,6 @@
 
 #include "cache/cache_varnishd.h"
 
-#include <ctype.h>
 #include <stdio.h>
 
 #include "cache/cache_filter.h"
@@ -45,33 +44,6 @@
 
 /**********************************************************************/
 
-struct hpack_static {
-	uint8_t			idx;
-	const char *		name;
-	const char *		val;
-};
-
-static const struct hpack_static hp_static[] = {
-#define HPS(I,N,V) [I] = { I, N ":", V },
-#include "tbl/vhp_static.h"
-	{ 0, "\377:", ""}		// Terminator
-};
-
-static const struct hpack_static *hp_idx[256];
-
-void
-V2D_Init(void)
-{
-	int i;
-#define HPS(I,N,V)						\
-	i = hp_static[I].name[0];				\
-	if (hp_idx[i] == NULL) hp_idx[i] = &hp_static[I];
-#include "tbl/vhp_static.h"
-#undef HPS
-}
-
-/**********************************************************************/
-
 static int v_matchproto_(vdp_init_f)
 h2_init(VRT_CTX, struct vdp_ctx *vdc, void **priv)
 {
@@ -164,12 +136,48 @@ h2_status(uint8_t *p, uint16_t status) {
 	return (l);
 }
 
+/*
+ * Changes to SETTINGS_HEADER_TABLE_SIZE and to our own table size are
+ * signaled at the start of the next header block.  With reset, the
+ * table is emptied on both sides first.
+ *
+ * Header blocks must be encoded with the send ownership held, so that
+ * the client sees them in the order they updated the table.
+ */
+
+static void
+h2_enc_tblsize(struct vsb *vsb, struct h2_sess *h2, int reset)
+{
+	uint32_t low, want;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+
+	Lck_Lock(&h2->sess->mtx);
+	low = h2->enctbl_low;
+	want = h2->remote_settings.header_table_size;
+	h2->enctbl_low = want;
+	Lck_Unlock(&h2->sess->mtx);
+
+	if (reset)
+		low = 0;
+	want = vmin_t(uint32_t, want, h2->enctbl->protomax);
+	if (low < h2->enctbl_size) {
+		h2->enctbl_size = vmin_t(uint32_t, low, h2->enctbl->protomax);
+		VHE_TableSize(vsb, h2->enctbl, h2->enctbl_size);
+	}
+	if (want != h2->enctbl_size) {
+		h2->enctbl_size = want;
+		VHE_TableSize(vsb, h2->enctbl, want);
+	}
+}
+
 int v_matchproto_(vtr_minimal_response_f)
 h2_minimal_response(struct req *req, uint16_t status)
 {
 	struct h2_req *r2;
+	struct vsb vsb[1];
 	size_t l;
-	uint8_t buf[6];
+	uint8_t buf[6], hdrs[32];
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
@@ -190,32 +198,20 @@ h2_minimal_response(struct req *req, uint16_t status)
 
 	/* XXX return code checking once H2_Send returns anything but 0 */
 	H2_Send_Get(req->wrk, r2->h2sess, r2);
+	AN(VSB_init(vsb, hdrs, sizeof hdrs));
+	h2_enc_tblsize(vsb, r2->h2sess, 0);
+	VSB_bcat(vsb, buf, l);
+	AZ(VSB_finish(vsb));
 	H2_Send(req->wrk, r2,
 	    H2_F_HEADERS,
 	    H2FF_HEADERS_END_HEADERS |
 		(status < 200 ? 0 : H2FF_HEADERS_END_STREAM),
-	    l, buf, NULL);
+	    VSB_len(vsb), VSB_data(vsb), NULL);
 	H2_Send_Rel(r2->h2sess, r2);
+	VSB_fini(vsb);
 	return (0);
 }
 
-static void
-h2_enc_len(struct vsb *vsb, unsigned bits, unsigned val, uint8_t b0)
-{
-	assert(bits < 8);
-	unsigned mask = (1U << bits) - 1U;
-
-	if (val >= mask) {
-		VSB_putc(vsb, b0 | (uint8_t)mask);
-		val -= mask;
-		while (val >= 128) {
-			VSB_putc(vsb, 0x80 | ((uint8_t)val & 0x7f));
-			val >>= 7;
-		}
-	}
-	VSB_putc(vsb, (uint8_t)val);
-}
-
 /*
  * Hand-crafted-H2-HEADERS-R-Us:
  *
@@ -234,16 +230,43 @@ static const uint8_t h2_500_resp[] = {
 	0x1f, 0x27, 0x07, 'V', 'a', 'r', 'n', 'i', 's', 'h',
 };
 
+static hdr_t H_X_Varnish = "\012X-Varnish:";
+
+/*
+ * Fields which differ from one response to the next are not worth a
+ * place in the dynamic table, and cookies are kept out of any table.
+ */
+
+static enum vhe_index_e
+h2_hdr_index(const struct h2_sess *h2, const txt *hd, size_t l)
+{
+
+	if (http_IsHdr(hd, H_Set_Cookie))
+		return (VHE_NEVER);
+	if (l + VHT_ENTRY_SIZE > h2->enctbl->maxsize / 4 ||
+	    http_IsHdr(hd, H_Content_Length) ||
+	    http_IsHdr(hd, H_Content_Range) ||
+	    http_IsHdr(hd, H_Date) ||
+	    http_IsHdr(hd, H_Age) ||
+	    http_IsHdr(hd, H_ETag) ||
+	    http_IsHdr(hd, H_Last_Modified) ||
+	    http_IsHdr(hd, H_Expires) ||
+	    http_IsHdr(hd, H_Location) ||
+	    http_IsHdr(hd, H_X_Varnish))
+		return (VHE_NONE);
+	return (VHE_INDEX);
+}
+
 static void
-h2_build_headers(struct vsb *resp, struct req *req)
+h2_build_headers(struct vsb *resp, struct req *req, struct h2_sess *h2)
 {
 	unsigned u, l;
-	int i;
 	struct http *hp;
 	const char *r;
-	const struct hpack_static *hps;
 	uint8_t buf[6];
-	ssize_t sz, sz1;
+	ssize_t sz;
+
+	h2_enc_tblsize(resp, h2, 0);
 
 	assert(req->resp->status % 1000 >= 100);
 	l = h2_status(buf, req->resp->status % 1000);
@@ -257,38 +280,13 @@ h2_build_headers(struct vsb *resp, struct req *req)
 		if (http_IsFiltered(hp, u, HTTPH_C_SPECIFIC))
 			continue; //rfc7540,l,2999,3006
 
-		hps = hp_idx[tolower(*hp->hd[u].b)];
-		sz = 1 + r - hp->hd[u].b;
+		sz = r - hp->hd[u].b;
 		assert(sz > 0);
-		while (hps != NULL && hps->idx > 0) {
-			i = strncasecmp(hps->name, hp->hd[u].b, sz);
-			if (i < 0) {
-				hps++;
-				continue;
-			}
-			if (i > 0)
-				hps = NULL;
-			break;
-		}
-		if (hps != NULL) {
-			VSLb(req->vsl, SLT_Debug,
-			    "HP {%d, \"%s\", \"%s\"} <%s>",
-			    hps->idx, hps->name, hps->val, hp->hd[u].b);
-			h2_enc_len(resp, 4, hps->idx, 0x10);
-		} else {
-			VSB_putc(resp, 0x10);
-			sz--;
-			h2_enc_len(resp, 7, sz, 0);
-			for (sz1 = 0; sz1 < sz; sz1++)
-				VSB_putc(resp, tolower(hp->hd[u].b[sz1]));
-
-		}
-
 		while (vct_islws(*++r))
 			continue;
-		sz = hp->hd[u].e - r;
-		h2_enc_len(resp, 7, sz, 0);
-		VSB_bcat(resp, r, sz);
+		VHE_Field(resp, h2->enctbl, hp->hd[u].b, sz,
+		    r, hp->hd[u].e - r,
+		    h2_hdr_index(h2, &hp->hd[u], sz + (hp->hd[u].e - r)));
 	}
 }
 
@@ -302,6 +300,7 @@ h2_deliver(struct req *req, int sendbody)
 	struct vsb resp[1];
 	struct vrt_ctx ctx[1];
 	uintptr_t ss;
+	uint8_t hdrs[32];
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
@@ -315,8 +314,10 @@ h2_deliver(struct req *req, int sendbody)
 
 	ss = WS_Snapshot(req->ws);
 
+	H2_Send_Get(req->wrk, r2->h2sess, r2);
+
 	WS_VSB_new(resp, req->ws);
-	h2_build_headers(resp, req);
+	h2_build_headers(resp, req, r2->h2sess);
 	r = WS_VSB_finish(resp, req->ws, &sz);
 
 	if (r == NULL) {
@@ -325,14 +326,18 @@ h2_deliver(struct req *req, int sendbody)
 		VSLb(req->vsl, SLT_RespReason, "Internal Server Error");
 		req->wrk->stats->client_resp_500++;
 
-		r = (const char*)h2_500_resp;
-		sz = sizeof h2_500_resp;
+		/* The client will not see what we indexed so far */
+		AN(VSB_init(resp, hdrs, sizeof hdrs));
+		h2_enc_tblsize(resp, r2->h2sess, 1);
+		VSB_bcat(resp, h2_500_resp, sizeof h2_500_resp);
+		AZ(VSB_finish(resp));
+		r = VSB_data(resp);
+		sz = VSB_len(resp);
 		sendbody = 0;
 	}
 
 	r2->t_send = req->t_prev;
 
-	H2_Send_Get(req->wrk, r2->h2sess, r2);
 	H2_Send(req->wrk, r2, H2_F_HEADERS,
 	    (sendbody ? 0 : H2FF_HEADERS_END_STREAM) | H2FF_HEADERS_END_HEADERS,
 	    sz, r, &req->acct.resp_hdrbytes);
@@ -111,6 +111,8 @@ h2_sess_panic(struct vsb *vsb, const struct sess *sp)
 		    r2->t_send, r2->t_winupd);
 		VSB_printf(vsb, "t_window = %jd, r_window = %jd,\n",
 		    (intmax_t)r2->t_window, (intmax_t)r2->r_window);
+		VSB_printf(vsb, "outq = %p, outq_len = %u, outq_end = %d,\n",
+		    r2->outq, r2->outq_len, r2->outq_end);
 
 		if (!PAN_dump_struct(vsb, r2->rxbuf, H2_RXBUF_MAGIC, "rxbuf")) {
 			VSB_printf(vsb, "stvbuf = %p,\n", r2->rxbuf->stvbuf);
@@ -42,6 +42,7 @@
 #include "cache/cache_objhead.h"
 #include "storage/storage.h"
 
+#include "vct.h"
 #include "vend.h"
 #include "vtcp.h"
 #include "vtim.h"
@@ -162,6 +163,7 @@ h2_new_req(struct h2_sess *h2, unsigned stream, struct req *req)
 	r2->req = req;
 	if (stream)
 		r2->counted = 1;
+	r2->urgency = stream ? H2_URGENCY_DEFAULT : H2_URGENCY_CONTROL;
 	r2->r_window = h2->local_settings.initial_window_size;
 	r2->t_window = h2->remote_settings.initial_window_size;
 	req->transport_priv = r2;
@@ -194,8 +196,15 @@ h2_del_req(struct worker *wrk, struct h2_req *r2)
 	VTAILQ_REMOVE(&h2->streams, r2, list);
 	if (r2->req == h2->new_req)
 		h2->new_req = NULL;
+	if (r2->outq_len > 0) {
+		assert(h2->outq_streams > 0);
+		h2->outq_streams--;
+	}
 	Lck_Unlock(&sp->mtx);
 
+	free(r2->outq);
+	r2->outq = NULL;
+
 	assert(!WS_IsReserved(r2->req->ws));
 	AZ(r2->req->ws->r);
 
@@ -560,10 +569,12 @@ h2_set_setting(struct h2_sess *h2, const uint8_t *d)
 	Lck_Lock(&h2->sess->mtx);
 	if (s == H2_SET_INITIAL_WINDOW_SIZE)
 		h2_win_adjust(h2, h2->remote_settings.initial_window_size, y);
+	if (s == H2_SET_HEADER_TABLE_SIZE && y < h2->enctbl_low)
+		h2->enctbl_low = y;
 	VSLb(h2->vsl, SLT_Debug, "H2SETTING %s=0x%08x", s->name, y);
-	Lck_Unlock(&h2->sess->mtx);
 	AN(s->setfunc);
 	s->setfunc(&h2->remote_settings, y);
+	Lck_Unlock(&h2->sess->mtx);
 	return (0);
 }
 
@@ -607,6 +618,41 @@ h2_rx_settings(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	return (0);
 }
 
+/**********************************************************************
+ * rfc9218 priority header field, a dictionary with the urgency u (0-7)
+ * and the boolean incremental i.
+ */
+
+static hdr_t H_Priority = "\011priority:";
+
+/* A value is followed by end of field, a parameter or the next member */
+static int
+h2_priority_end(const char *p)
+{
+
+	return (*p == '\0' || *p == ',' || *p == ';' || vct_issp(*p));
+}
+
+static void
+h2_priority(const struct h2_sess *h2, struct h2_req *r2,
+    const struct http *hp)
+{
+	const char *p;
+
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+
+	if (!http_GetHdr(hp, H_Priority, NULL))
+		return;
+	if (http_GetHdrField(hp, H_Priority, "u", &p) && p != NULL &&
+	    *p >= '0' && *p <= '7' && h2_priority_end(p + 1))
+		r2->urgency = *p - '0';
+	if (http_GetHdrField(hp, H_Priority, "i", &p))
+		r2->incremental = p == NULL ||
+		    (!strncmp(p, "?1", 2) && h2_priority_end(p + 2));
+	H2S_Lock_VSLb(h2, SLT_Debug, "H2: stream %u: priority u=%d i=%d",
+	    r2->stream, r2->urgency, r2->incremental);
+}
+
 /**********************************************************************
  * Incoming HEADERS, this is where the party's at...
  */
@@ -714,6 +760,8 @@ h2_end_headers(struct worker *wrk, struct h2_sess *h2,
 		return (H2SE_PROTOCOL_ERROR); //rfc7540,l,3068,3071
 	}
 
+	h2_priority(h2, r2, req->http);
+
 	assert(req->req_step == R_STP_TRANSPORT);
 	VCL_TaskEnter(req->privs);
 	VCL_TaskEnter(req->top->privs);
@@ -1420,6 +1468,19 @@ h2_sweep(struct worker *wrk, struct h2_sess *h2)
 		switch (r2->state) {
 		case H2_S_CLOSED:
 			AZ(r2->scheduled);
+			if (r2->outq_len > 0 && r2->error == NULL) {
+				/* The end of the body is still queued */
+				Lck_Lock(&h2->sess->mtx);
+				tmo = h2_stream_tmo(h2, r2, now);
+				Lck_Unlock(&h2->sess->mtx);
+				if (tmo == NULL)
+					break;
+				H2_Send_Get(wrk, h2, h2->req0);
+				H2_Send_RST(wrk, h2, h2->req0, r2->stream, tmo);
+				H2_Send_Rel(h2, h2->req0);
+				h2_kill_req(wrk, h2, r2, tmo);
+				break;
+			}
 			h2_del_req(wrk, r2);
 			break;
 		case H2_S_CLOS_REM:
@@ -1580,6 +1641,8 @@ h2_rxframe(struct worker *wrk, struct h2_sess *h2)
 		h2->error = h2e;
 		h2_tx_goaway(wrk, h2, h2e);
 	}
+	if (h2->error == NULL)
+		H2_Send_Queued(wrk, h2);
 
 	return (h2->error != NULL ? 0 : 1);
 }
@@ -32,6 +32,7 @@
 #include "config.h"
 
 #include <sys/uio.h>
+#include <stdlib.h>
 
 #include "cache/cache_varnishd.h"
 
@@ -98,6 +99,50 @@ h2_cond_wait(pthread_cond_t *cond, struct h2_sess *h2, struct h2_req *r2)
 	return (h2e != NULL ? -1 : 0);
 }
 
+/*
+ * The send ownership goes to the waiting streams in order of urgency.
+ * Within an urgency, non-incremental streams come first, one after the
+ * other by stream number, and incremental streams take turns, since
+ * they queue up again behind each other after every send.
+ */
+
+static int
+h2_send_before(const struct h2_req *r2, const struct h2_req *r2b)
+{
+
+	if (r2->urgency != r2b->urgency)
+		return (r2->urgency < r2b->urgency);
+	if (r2->incremental)
+		return (0);
+	return (r2b->incremental || r2->stream < r2b->stream);
+}
+
+static void
+h2_send_queue(struct h2_sess *h2, struct h2_req *r2)
+{
+	struct h2_req *r2b;
+	unsigned n = 0;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+
+	/* Never overtake the current owner */
+	r2b = VTAILQ_FIRST(&h2->txqueue);
+	if (r2b != NULL)
+		r2b = VTAILQ_NEXT(r2b, tx_list);
+	while (r2b != NULL && !h2_send_before(r2, r2b))
+		r2b = VTAILQ_NEXT(r2b, tx_list);
+	if (r2b == NULL) {
+		VTAILQ_INSERT_TAIL(&h2->txqueue, r2, tx_list);
+		return;
+	}
+	VTAILQ_INSERT_BEFORE(r2b, r2, tx_list);
+	for (; r2b != NULL; r2b = VTAILQ_NEXT(r2b, tx_list))
+		n++;
+	VSLb(h2->vsl, SLT_Debug,
+	    "H2: stream %u: scheduled ahead of %u (u=%d i=%d)",
+	    r2->stream, n, r2->urgency, r2->incremental);
+}
+
 static void
 h2_send_get_locked(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
@@ -110,7 +155,7 @@ h2_send_get_locked(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	if (&wrk->cond == h2->cond)
 		ASSERT_RXTHR(h2);
 	r2->wrk = wrk;
-	VTAILQ_INSERT_TAIL(&h2->txqueue, r2, tx_list);
+	h2_send_queue(h2, r2);
 	while (!H2_SEND_HELD(h2, r2))
 		AZ(Lck_CondWait(&wrk->cond, &h2->sess->mtx));
 	r2->wrk = NULL;
@@ -145,16 +190,6 @@ h2_send_rel_locked(struct h2_sess *h2, const struct h2_req *r2)
 	}
 }
 
-void
-H2_Send_Rel(struct h2_sess *h2, const struct h2_req *r2)
-{
-	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
-	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
-
-	Lck_Lock(&h2->sess->mtx);
-	h2_send_rel_locked(h2, r2);
-	Lck_Unlock(&h2->sess->mtx);
-}
 
 static void
 h2_mk_hdr(uint8_t *hdr, h2_frame ftyp, uint8_t flags,
@@ -169,10 +204,88 @@ h2_mk_hdr(uint8_t *hdr, h2_frame ftyp, uint8_t flags,
 	vbe32enc(hdr + 5, stream);
 }
 
+/*
+ * Write the output buffer into the free iov[0], followed by the niov
+ * iovecs after it.  Must be called with the send ownership, but without
+ * the session mtx.
+ */
+
+static void
+h2_tx_write(struct h2_sess *h2, uint32_t stream, struct iovec *iov, int niov)
+{
+	size_t len = 0;
+	ssize_t s;
+	int i;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	AN(iov);
+
+	if (h2->txbuf_len > 0) {
+		iov[0].iov_base = h2->txbuf;
+		iov[0].iov_len = h2->txbuf_len;
+		niov++;
+	} else
+		iov++;
+	if (niov == 0)
+		return;
+	for (i = 0; i < niov; i++)
+		len += iov[i].iov_len;
+	h2->txbuf_len = 0;
+
+	s = writev(h2->sess->fd, iov, niov);
+	if (s == len)
+		return;
+	if (errno == EWOULDBLOCK) {
+		H2S_Lock_VSLb(h2, SLT_SessError,
+		     "H2: stream %u: Hit idle_send_timeout", stream);
+	}
+	else {
+		H2S_Lock_VSLb(h2, SLT_Debug,
+		    "H2: stream %u: write error s=%zd/%zu errno=%d",
+		    stream, s, len, errno);
+	}
+	/*
+	 * There is no point in being nice here, we will be unable
+	 * to send a GOAWAY once the code unrolls, so go directly
+	 * to the finale and be done with it.
+	 */
+	h2->error = H2CE_PROTOCOL_ERROR;
+}
+
+static void
+h2_tx_flush(struct h2_sess *h2, uint32_t stream)
+{
+	struct iovec iov[1];
+
+	h2_tx_write(h2, stream, iov, 0);
+}
+
+void
+H2_Send_Rel(struct h2_sess *h2, const struct h2_req *r2)
+{
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+
+	Lck_Lock(&h2->sess->mtx);
+	AN(H2_SEND_HELD(h2, r2));
+	if (h2->txbuf_len > 0 && VTAILQ_NEXT(r2, tx_list) == NULL) {
+		/* Nobody else is going to send soon */
+		Lck_Unlock(&h2->sess->mtx);
+		h2_tx_flush(h2, r2->stream);
+		Lck_Lock(&h2->sess->mtx);
+	}
+	h2_send_rel_locked(h2, r2);
+	Lck_Unlock(&h2->sess->mtx);
+}
+
 /*
  * This is the "raw" frame sender, all per-stream accounting and
  * prioritization must have happened before this is called, and
- * the session mtx must be held.
+ * the send ownership must be held.
+ *
+ * Frames which fit are added to the output buffer, which is written
+ * when it is full, when the oldest frame in it is h2_txbuf_delay old,
+ * or when the sender releases the connection with nobody waiting.
  */
 
 void
@@ -181,8 +294,8 @@ H2_Send_Frame(struct worker *wrk, struct h2_sess *h2,
     uint32_t len, uint32_t stream, const void *ptr)
 {
 	uint8_t hdr[9];
-	ssize_t s;
-	struct iovec iov[2];
+	struct iovec iov[3];
+	vtim_mono now;
 
 	(void)wrk;
 
@@ -201,29 +314,33 @@ H2_Send_Frame(struct worker *wrk, struct h2_sess *h2,
 		h2->srq->acct.resp_bodybytes += len;
 	Lck_Unlock(&h2->sess->mtx);
 
-	memset(iov, 0, sizeof iov);
-	iov[0].iov_base = (void*)hdr;
-	iov[0].iov_len = sizeof hdr;
-	iov[1].iov_base = TRUST_ME(ptr);
-	iov[1].iov_len = len;
-	s = writev(h2->sess->fd, iov, len == 0 ? 1 : 2);
-	if (s != sizeof hdr + len) {
-		if (errno == EWOULDBLOCK) {
-			H2S_Lock_VSLb(h2, SLT_SessError,
-			     "H2: stream %u: Hit idle_send_timeout", stream);
+	if (h2->txbuf != NULL &&
+	    sizeof hdr + len <= h2->txbuf_size - h2->txbuf_len) {
+		now = VTIM_mono();
+		if (h2->txbuf_len == 0)
+			h2->txbuf_t = now;
+		memcpy(h2->txbuf + h2->txbuf_len, hdr, sizeof hdr);
+		h2->txbuf_len += sizeof hdr;
+		if (len > 0) {
+			memcpy(h2->txbuf + h2->txbuf_len, ptr, len);
+			h2->txbuf_len += len;
+			Lck_Lock(&h2->sess->mtx);
+			VSLb_bin(h2->vsl, SLT_H2TxBody, len, ptr);
+			Lck_Unlock(&h2->sess->mtx);
 		}
-		else {
-			H2S_Lock_VSLb(h2, SLT_Debug,
-			    "H2: stream %u: write error s=%zd/%zu errno=%d",
-			    stream, s, sizeof hdr + len, errno);
-		}
-		/*
-		 * There is no point in being nice here, we will be unable
-		 * to send a GOAWAY once the code unrolls, so go directly
-		 * to the finale and be done with it.
-		 */
-		h2->error = H2CE_PROTOCOL_ERROR;
-	} else if (len > 0) {
+		if (h2->txbuf_len == h2->txbuf_size ||
+		    now - h2->txbuf_t >= cache_param->h2_txbuf_delay)
+			h2_tx_flush(h2, stream);
+		return;
+	}
+
+	memset(iov, 0, sizeof iov);
+	iov[1].iov_base = (void*)hdr;
+	iov[1].iov_len = sizeof hdr;
+	iov[2].iov_base = TRUST_ME(ptr);
+	iov[2].iov_len = len;
+	h2_tx_write(h2, stream, iov, len == 0 ? 1 : 2);
+	if (h2->error == NULL && len > 0) {
 		Lck_Lock(&h2->sess->mtx);
 		VSLb_bin(h2->vsl, SLT_H2TxBody, len, ptr);
 		Lck_Unlock(&h2->sess->mtx);
@@ -268,6 +385,13 @@ h2_do_window(struct worker *wrk, struct h2_req *r2,
 		return (0);
 
 	Lck_Lock(&h2->sess->mtx);
+	if ((r2->t_window <= 0 || h2->req0->t_window <= 0) &&
+	    h2->txbuf_len > 0) {
+		/* The client may be waiting for these to credit us */
+		Lck_Unlock(&h2->sess->mtx);
+		h2_tx_flush(h2, r2->stream);
+		Lck_Lock(&h2->sess->mtx);
+	}
 	if (r2->t_window <= 0 || h2->req0->t_window <= 0) {
 		r2->t_winupd = VTIM_real();
 		h2_send_rel_locked(h2, r2);
@@ -318,7 +442,6 @@ h2_do_window(struct worker *wrk, struct h2_req *r2,
 
 /*
  * This is the per-stream frame sender.
- * XXX: priority
  */
 
 static void
@@ -339,8 +462,15 @@ h2_send(struct worker *wrk, struct h2_req *r2, h2_frame ftyp, uint8_t flags,
 
 	AN(H2_SEND_HELD(h2, r2));
 
-	if (h2_errcheck(r2, h2) != NULL)
+	if (h2_errcheck(r2, h2) != NULL) {
+		if (ftyp == H2_F_HEADERS || ftyp == H2_F_CONTINUATION) {
+			/* The client will not see what we indexed */
+			Lck_Lock(&h2->sess->mtx);
+			h2->enctbl_low = 0;
+			Lck_Unlock(&h2->sess->mtx);
+		}
 		return;
+	}
 
 	AN(ftyp);
 	AZ(flags & ~(ftyp->flags));
@@ -410,6 +540,199 @@ h2_send(struct worker *wrk, struct h2_req *r2, h2_frame ftyp, uint8_t flags,
 	}
 }
 
+/*
+ * With h2_outq_size, DATA which the window does not allow to send right
+ * away is copied to the output queue of the stream, and sent from there
+ * by whoever holds the send ownership next: the stream itself, or the
+ * session thread when the client credits the window.
+ *
+ * Called with the send ownership and the session mtx held.
+ */
+
+static void
+h2_outq_send(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
+{
+	int64_t w;
+	uint8_t flags;
+	int sent = 0;
+
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	Lck_AssertHeld(&h2->sess->mtx);
+
+	while (r2->outq_len > 0 && h2_errcheck(r2, h2) == NULL) {
+		w = vmin_t(int64_t, h2_win_limit(r2, h2), r2->outq_len);
+		w = vmin_t(int64_t, w, h2->remote_settings.max_frame_size);
+		if (w <= 0)
+			break;
+		h2_win_charge(r2, h2, w);
+		flags = H2FF_NONE;
+		if (w == r2->outq_len && r2->outq_end) {
+			flags = H2FF_DATA_END_STREAM;
+			if (r2->counted) {
+				assert(h2->open_streams > 0);
+				h2->open_streams--;
+				r2->counted = 0;
+			}
+		}
+		Lck_Unlock(&h2->sess->mtx);
+		H2_Send_Frame(wrk, h2, H2_F_DATA, flags, w, r2->stream,
+		    r2->outq + r2->outq_head);
+		Lck_Lock(&h2->sess->mtx);
+		r2->outq_head += w;
+		r2->outq_len -= w;
+		sent = 1;
+	}
+	if (!sent)
+		return;
+	r2->t_winupd = 0;
+	if (r2->outq_len == 0) {
+		assert(h2->outq_streams > 0);
+		h2->outq_streams--;
+		r2->outq_head = 0;
+		r2->outq_end = 0;
+		if (r2->state == H2_S_CLOSED)
+			h2->do_sweep = 1;
+	} else
+		r2->t_winupd = VTIM_real();
+	if (r2->cond != NULL)
+		PTOK(pthread_cond_signal(r2->cond));
+}
+
+static void
+h2_send_data(struct worker *wrk, struct h2_req *r2, uint8_t flags,
+    uint32_t len, const void *ptr, uint64_t *counter)
+{
+	struct h2_sess *h2;
+	const uint8_t *p = ptr;
+	uint8_t fl;
+	int64_t w;
+
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	AN(H2_SEND_HELD(h2, r2));
+	AZ(flags & ~H2FF_DATA_END_STREAM);
+	assert(len == 0 || ptr != NULL);
+	AN(counter);
+
+	if (len == 0 && flags == H2FF_NONE)
+		return;
+
+	Lck_Lock(&h2->sess->mtx);
+	h2_outq_send(wrk, h2, r2);
+	while (h2_errcheck(r2, h2) == NULL) {
+		if (r2->outq_len == 0) {
+			w = vmin_t(int64_t, h2_win_limit(r2, h2), len);
+			w = vmin_t(int64_t, w,
+			    h2->remote_settings.max_frame_size);
+			if (w > 0 || len == 0) {
+				w = vmax_t(int64_t, w, 0);
+				h2_win_charge(r2, h2, w);
+				fl = (w == len) ? flags : H2FF_NONE;
+				if (fl != H2FF_NONE && r2->counted) {
+					assert(h2->open_streams > 0);
+					h2->open_streams--;
+					r2->counted = 0;
+				}
+				Lck_Unlock(&h2->sess->mtx);
+				H2_Send_Frame(wrk, h2, H2_F_DATA, fl, w,
+				    r2->stream, p);
+				Lck_Lock(&h2->sess->mtx);
+				p += w;
+				len -= w;
+				*counter += w;
+				if (len == 0)
+					break;
+				continue;
+			}
+		}
+
+		/* Out of window, queue what fits */
+		w = vmin_t(int64_t, h2->outq_size - r2->outq_len, len);
+		if (w > 0 || len == 0) {
+			if (r2->outq == NULL) {
+				r2->outq = malloc(h2->outq_size);
+				AN(r2->outq);
+			}
+			if (r2->outq_len == 0) {
+				AZ(r2->outq_head);
+				h2->outq_streams++;
+			} else if (r2->outq_head > 0) {
+				memmove(r2->outq, r2->outq + r2->outq_head,
+				    r2->outq_len);
+				r2->outq_head = 0;
+			}
+			Lck_Unlock(&h2->sess->mtx);
+			memcpy(r2->outq + r2->outq_len, p, w);
+			Lck_Lock(&h2->sess->mtx);
+			r2->outq_len += w;
+			if (r2->t_winupd == 0)
+				r2->t_winupd = VTIM_real();
+			p += w;
+			len -= w;
+			*counter += w;
+			if (len == 0) {
+				r2->outq_end = (flags != H2FF_NONE);
+				break;
+			}
+			continue;
+		}
+
+		/* The queue is full, the client may need our frames first */
+		if (h2->txbuf_len > 0) {
+			Lck_Unlock(&h2->sess->mtx);
+			h2_tx_flush(h2, r2->stream);
+			Lck_Lock(&h2->sess->mtx);
+		}
+		h2_send_rel_locked(h2, r2);
+		r2->cond = &wrk->cond;
+		(void)h2_cond_wait(r2->cond, h2, r2);
+		r2->cond = NULL;
+		h2_send_get_locked(wrk, h2, r2);
+		h2_outq_send(wrk, h2, r2);
+	}
+	if (r2->outq_end)
+		VSLb(h2->vsl, SLT_Debug, "H2: stream %u: %u bytes queued",
+		    r2->stream, r2->outq_len);
+	Lck_Unlock(&h2->sess->mtx);
+}
+
+/*
+ * The session thread sends from the output queues after every frame
+ * it received, most urgent stream first.
+ */
+
+void
+H2_Send_Queued(struct worker *wrk, struct h2_sess *h2)
+{
+	struct h2_req *r2, *r2b;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	ASSERT_RXTHR(h2);
+
+	Lck_Lock(&h2->sess->mtx);
+	if (h2->outq_streams == 0) {
+		Lck_Unlock(&h2->sess->mtx);
+		return;
+	}
+	h2_send_get_locked(wrk, h2, h2->req0);
+	while (h2->req0->t_window > 0 && h2->error == NULL) {
+		r2b = NULL;
+		VTAILQ_FOREACH(r2, &h2->streams, list) {
+			if (r2->outq_len == 0 || r2->t_window <= 0 ||
+			    h2_errcheck(r2, h2) != NULL)
+				continue;
+			if (r2b == NULL || h2_send_before(r2, r2b))
+				r2b = r2;
+		}
+		if (r2b == NULL)
+			break;
+		h2_outq_send(wrk, h2, r2b);
+	}
+	Lck_Unlock(&h2->sess->mtx);
+	H2_Send_Rel(h2, h2->req0);
+}
+
 void
 H2_Send_RST(struct worker *wrk, struct h2_sess *h2, const struct h2_req *r2,
     uint32_t stream, h2_error h2e)
@@ -437,7 +760,10 @@ H2_Send(struct worker *wrk, struct h2_req *r2, h2_frame ftyp, uint8_t flags,
 	if (counter == NULL)
 		counter = &dummy_counter;
 
-	h2_send(wrk, r2, ftyp, flags, len, ptr, counter);
+	if (ftyp == H2_F_DATA && r2->h2sess->outq_size > 0)
+		h2_send_data(wrk, r2, flags, len, ptr, counter);
+	else
+		h2_send(wrk, r2, ftyp, flags, len, ptr, counter);
 
 	h2e = h2_errcheck(r2, r2->h2sess);
 	if (H2_ERROR_MATCH(h2e, H2SE_CANCEL))
@@ -34,6 +34,7 @@
 #include "cache/cache_varnishd.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "cache/cache_transport.h"
 #include "http2/cache_http2.h"
@@ -162,6 +163,18 @@ h2_init_sess(struct sess *sp,
 	AZ(isnan(h2->last_rst));
 
 	AZ(VHT_Init(h2->dectbl, h2->local_settings.header_table_size));
+	AZ(VHT_Init(h2->enctbl, cache_param->h2_encoder_table_size));
+	h2->enctbl_size = h2->remote_settings.header_table_size;
+	h2->enctbl_low = h2->enctbl_size;
+	AZ(VHT_SetMaxTableSize(h2->enctbl,
+	    vmin_t(size_t, h2->enctbl->protomax, h2->enctbl_size)));
+
+	h2->txbuf_size = cache_param->h2_txbuf_size;
+	if (h2->txbuf_size > 0) {
+		h2->txbuf = malloc(h2->txbuf_size);
+		AN(h2->txbuf);
+	}
+	h2->outq_size = cache_param->h2_outq_size;
 
 	*up = (uintptr_t)h2;
 
@@ -180,6 +193,9 @@ h2_del_sess(struct worker *wrk, struct h2_sess *h2, stream_close_t reason)
 	AN(reason);
 
 	VHT_Fini(h2->dectbl);
+	VHT_Fini(h2->enctbl);
+	free(h2->txbuf);
+	h2->txbuf = NULL;
 	PTOK(pthread_cond_destroy(h2->winupd_cond));
 	TAKE_OBJ_NOTNULL(req, &h2->srq, REQ_MAGIC);
 	assert(!WS_IsReserved(req->ws));
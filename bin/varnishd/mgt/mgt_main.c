@@ -121,6 +121,10 @@ usage(void)
 	    "user, group and mode set permissions for");
 	printf(FMT, "    [,mode=<m>]",
 	    "  a Unix domain socket.");
+	printf(FMT, "    [,reuseport=<n>]",
+	    "n SO_REUSEPORT sockets for a TCP address.");
+	printf(FMT, "    [,reuseport_steer=cpu]",
+	    "  Steer connections to them by CPU.");
 	printf(FMT, "-b none", "No backend");
 	printf(FMT, "-b [addr[:port]|path]", "Backend address and port");
 	printf(FMT, "", "  or socket file path");
@@ -127,7 +127,7 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 	size = NULL;
 	page_size = getpagesize();
 
-	if (ac > 4)
+	if (ac > 5)
 		ARGV_ERR("(-sfile) too many arguments\n");
 	if (ac < 1 || *av[0] == '\0')
 		ARGV_ERR("(-sfile) path is mandatory\n");
@@ -140,7 +140,7 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 		if (r != NULL)
 			ARGV_ERR("(-sfile) granularity \"%s\": %s\n", av[2], r);
 	}
-	if (ac > 3) {
+	if (ac > 3 && *av[3] != '\0') {
 		if (!strcmp(av[3], "normal"))
 			advice = MADV_NORMAL;
 		else if (!strcmp(av[3], "random"))
@@ -150,6 +150,12 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 		else
 			ARGV_ERR("(-s file) invalid advice: \"%s\"", av[3]);
 	}
+	if (ac > 4 && *av[4] != '\0') {
+		parent->lru_policy = LRU_Policy(av[4]);
+		if (parent->lru_policy == NULL)
+			ARGV_ERR("(-sfile) invalid eviction policy: \"%s\"\n",
+			    av[4]);
+	}
 
 	AN(fn);
 
@@ -411,7 +417,7 @@ smf_open(struct stevedore *st)
 	off_t sum = 0;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st->ident, st->lru_policy);
 	if (lck_smf == NULL)
 		lck_smf = Lck_CreateClass(NULL, "smf");
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
@@ -496,6 +502,26 @@ smf_free(struct storage *s)
 	Lck_Unlock(&sc->mtx);
 }
 
+/*--------------------------------------------------------------------
+ * The segment is mapped from the file, so it can also be sent from there
+ */
+
+static int v_matchproto_(sml_extent_f)
+smf_extent(const struct storage *s, int *fdp, off_t *offp)
+{
+	struct smf *smf;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(smf, s->priv, SMF_MAGIC);
+	CHECK_OBJ_NOTNULL(smf->sc, SMF_SC_MAGIC);
+	AN(fdp);
+	AN(offp);
+	assert(s->ptr == smf->ptr);
+	*fdp = smf->sc->fd;
+	*offp = smf->offset;
+	return (0);
+}
+
 /*--------------------------------------------------------------------*/
 
 const struct stevedore smf_stevedore = {
@@ -505,6 +531,7 @@ const struct stevedore smf_stevedore = {
 	.open		=	smf_open,
 	.sml_alloc	=	smf_alloc,
 	.sml_free	=	smf_free,
+	.sml_extent	=	smf_extent,
 	.allocobj	=	SML_allocobj,
 	.panic		=	SML_panic,
 	.methods	=	&SML_methods,
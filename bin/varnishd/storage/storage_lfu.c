@@ -0,0 +1,163 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * TinyLFU frequency sketch for storage admission.
+ *
+ * A count-min sketch with four rows of saturating four bit counters,
+ * indexed by four words of the objhead digest.  The digest is the
+ * output of a cryptographic hash, so its words are independent hash
+ * functions for free.
+ *
+ * After lfu_sketch_width * LFU_SAMPLE accesses, all counters are halved
+ * so that the sketch follows changes in popularity.
+ *
+ * Counters are updated without locking.  Racing updates may get lost,
+ * which only makes the frequency estimate slightly lower than it would
+ * be otherwise.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "storage/storage.h"
+
+#include "vend.h"
+
+#define LFU_ROWS	4
+#define LFU_MAX		15
+#define LFU_SAMPLE	10
+
+struct lfu_sketch {
+	unsigned		magic;
+#define LFU_SKETCH_MAGIC	0x1f0c5b2e
+	unsigned		mask;
+	uint64_t		sample;
+	uint64_t		n_access;
+	struct lock		mtx;
+	uint8_t			*row[LFU_ROWS];
+};
+
+static struct lfu_sketch *lfu;
+
+void
+LFU_Init(void)
+{
+	unsigned u, w;
+
+	ASSERT_CLI();
+	AZ(lfu);
+	if (cache_param->lfu_sketch_width == 0)
+		return;
+
+	for (w = 1; w < cache_param->lfu_sketch_width; w <<= 1)
+		continue;
+
+	ALLOC_OBJ(lfu, LFU_SKETCH_MAGIC);
+	AN(lfu);
+	lfu->mask = w - 1;
+	lfu->sample = (uint64_t)w * LFU_SAMPLE;
+	Lck_New(&lfu->mtx, lck_lfu);
+	for (u = 0; u < LFU_ROWS; u++) {
+		lfu->row[u] = calloc(w, sizeof *lfu->row[u]);
+		AN(lfu->row[u]);
+	}
+}
+
+int
+LFU_Enabled(void)
+{
+
+	return (lfu != NULL);
+}
+
+static void
+lfu_age(void)
+{
+	unsigned u, i;
+
+	/* Only one thread needs to do this */
+	if (Lck_Trylock(&lfu->mtx))
+		return;
+	if (lfu->n_access >= lfu->sample) {
+		for (u = 0; u < LFU_ROWS; u++)
+			for (i = 0; i <= lfu->mask; i++)
+				lfu->row[u][i] >>= 1;
+		lfu->n_access = 0;
+		VSC_C_main->lfu_aged++;
+	}
+	Lck_Unlock(&lfu->mtx);
+}
+
+unsigned
+LFU_Estimate(const uint8_t *digest)
+{
+	unsigned u, v, min = LFU_MAX;
+
+	AN(digest);
+	if (lfu == NULL)
+		return (0);
+	CHECK_OBJ(lfu, LFU_SKETCH_MAGIC);
+	for (u = 0; u < LFU_ROWS; u++) {
+		v = lfu->row[u][vle32dec(digest + 4 * u) & lfu->mask];
+		if (v < min)
+			min = v;
+	}
+	return (min);
+}
+
+/*--------------------------------------------------------------------
+ * Record an access.  Conservative update: only the counters holding the
+ * current minimum are incremented, which reduces the overestimation
+ * caused by collisions.
+ */
+
+void
+LFU_Access(const uint8_t *digest)
+{
+	unsigned u, min;
+	uint8_t *p;
+
+	AN(digest);
+	if (lfu == NULL)
+		return;
+	CHECK_OBJ(lfu, LFU_SKETCH_MAGIC);
+
+	min = LFU_Estimate(digest);
+	if (min < LFU_MAX) {
+		for (u = 0; u < LFU_ROWS; u++) {
+			p = &lfu->row[u][vle32dec(digest + 4 * u) & lfu->mask];
+			if (*p == min)
+				*p = min + 1;
+		}
+	}
+
+	if (++lfu->n_access >= lfu->sample)
+		lfu_age();
+}
@@ -33,37 +33,406 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "cache/cache_varnishd.h"
 #include "cache/cache_objhead.h"
 
 #include "storage/storage.h"
 
+#include "VSC_lru.h"
+
+/*--------------------------------------------------------------------
+ * The LRU list of a stevedore is split into lru_shards independently
+ * locked shards.  An object is assigned to a shard by a hash of its
+ * objcore address, which stays stable for as long as the object lives.
+ *
+ * Each shard caches the timestamp of its oldest entry, so that
+ * LRU_NukeOne() can sample the shard heads without any locks and start
+ * its search in the shard which holds the globally oldest object.
+ *
+ * Within a shard, the eviction policy decides how objects are ordered:
+ *
+ * lru:   A single list, objects move to the tail when touched.
+ *
+ * slru:  Segmented LRU.  New objects enter the probation list and are
+ *        promoted to the protected list when touched by a hit.  The protected
+ *        list is capped at LRU_SLRU_PROTECTED percent of the shard, the
+ *        overflow is demoted back to probation.  Eviction drains the
+ *        probation list first, so one-hit wonders do not push out the
+ *        working set.
+ *
+ * clock: A single list used as a clock, the head is the hand.  A hit on
+ *        an object only sets its referenced bit, which takes the shard
+ *        lock only if the bit was clear.  Eviction gives referenced
+ *        objects a second chance by clearing the bit and moving them to
+ *        the tail.
+ *
+ * The delivery of a freshly fetched object is not a reuse, so slru and
+ * clock ignore touches of objects which have not been hit yet.
+ */
+
+#define LRU_SLRU_PROTECTED	80
+
+#define LRU_F_PROTECTED		(1U << 0)
+#define LRU_F_REFERENCED	(1U << 1)
+
+struct lru_shard {
+	VTAILQ_HEAD(,objcore)	lru_head[2];
+	unsigned		n_obj[2];
+	struct lock		mtx;
+	vtim_real		t_head;
+	struct VSC_lru		*vsc;
+	struct vsc_seg		*vsc_seg;
+};
+
+typedef void lru_insert_f(struct lru_shard *, struct objcore *);
+typedef void lru_remove_f(struct lru_shard *, struct objcore *);
+typedef void lru_touch_f(struct worker *, struct objcore *, vtim_real);
+typedef struct objcore *lru_nuke_f(struct worker *, struct lru_shard *);
+
+struct lru_policy {
+	unsigned		magic;
+#define LRU_POLICY_MAGIC	0x5cc0a1b3
+	const char		*name;
+
+	/* Called with the shard lock held */
+	lru_insert_f		*insert;
+	lru_remove_f		*remove;
+	lru_nuke_f		*nuke;
+
+	/* Called without any locks held */
+	lru_touch_f		*touch;
+};
+
 struct lru {
 	unsigned		magic;
 #define LRU_MAGIC		0x3fec7bb0
-	VTAILQ_HEAD(,objcore)	lru_head;
-	struct lock		mtx;
+	const struct lru_policy	*policy;
+	unsigned		nshard;
+	struct lru_shard	shard[];
 };
 
-static struct lru *
+static struct lru_shard *
 lru_get(const struct objcore *oc)
 {
+	struct lru *lru;
+	uint64_t h;
+
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_NOTNULL(oc->stobj->stevedore, STEVEDORE_MAGIC);
-	CHECK_OBJ_NOTNULL(oc->stobj->stevedore->lru, LRU_MAGIC);
-	return (oc->stobj->stevedore->lru);
+	lru = oc->stobj->stevedore->lru;
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	if (lru->nshard == 1)
+		return (&lru->shard[0]);
+	h = (uint64_t)(uintptr_t)oc * 0x9e3779b97f4a7c15ULL;
+	return (&lru->shard[(h >> 32) % lru->nshard]);
+}
+
+/* Must be called with the shard lock held */
+static void
+lru_head(struct lru_shard *sh)
+{
+	struct objcore *oc;
+
+	oc = VTAILQ_FIRST(&sh->lru_head[0]);
+	if (oc == NULL)
+		oc = VTAILQ_FIRST(&sh->lru_head[1]);
+	sh->t_head = (oc == NULL ? NAN : oc->last_lru);
+}
+
+/* Must be called with the shard lock held */
+static void
+lru_move(struct lru_shard *sh, struct objcore *oc, unsigned from,
+    unsigned to)
+{
+
+	VTAILQ_REMOVE(&sh->lru_head[from], oc, lru_list);
+	VTAILQ_INSERT_TAIL(&sh->lru_head[to], oc, lru_list);
+	sh->n_obj[from]--;
+	sh->n_obj[to]++;
+}
+
+/*--------------------------------------------------------------------
+ * Walk one list and snipe the first currently unused object.
+ */
+
+static struct objcore *
+lru_nuke_list(struct worker *wrk, struct lru_shard *sh, unsigned l)
+{
+	struct objcore *oc, *oc2;
+
+	VTAILQ_FOREACH_SAFE(oc, &sh->lru_head[l], lru_list, oc2) {
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		AZ(isnan(oc->last_lru));
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+		    oc, oc->flags, oc->refcnt);
+
+		if (HSH_Snipe(wrk, oc)) {
+			lru_move(sh, oc, l, l);
+			return (oc);
+		}
+	}
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Plain LRU and SLRU only move objects if they have not been moved
+ * recently and if the shard lock is available.
+ *
+ * Returns the locked shard or NULL.
+ */
+
+static struct lru_shard *
+lru_touch_lock(struct worker *wrk, struct objcore *oc, vtim_real now)
+{
+	struct lru_shard *sh;
+
+	/*
+	 * To avoid the exphdl->mtx becoming a hotspot, we only
+	 * attempt to move objects if they have not been moved
+	 * recently and if the lock is available.  This optimization
+	 * obviously leaves the LRU list imperfectly sorted.
+	 */
+
+	if (now - oc->last_lru < cache_param->lru_interval)
+		return (NULL);
+
+	sh = lru_get(oc);
+
+	if (Lck_Trylock(&sh->mtx)) {
+		wrk->stats->n_lru_busy++;
+		return (NULL);
+	}
+
+	if (isnan(oc->last_lru)) {
+		Lck_Unlock(&sh->mtx);
+		return (NULL);
+	}
+
+	wrk->stats->n_lru_moved++;
+	sh->vsc->n_moved++;
+	oc->last_lru = now;
+	return (sh);
+}
+
+/*--------------------------------------------------------------------
+ * Plain LRU
+ */
+
+static void v_matchproto_(lru_insert_f)
+lru_lru_insert(struct lru_shard *sh, struct objcore *oc)
+{
+
+	VTAILQ_INSERT_TAIL(&sh->lru_head[0], oc, lru_list);
+	sh->n_obj[0]++;
+}
+
+static void v_matchproto_(lru_remove_f)
+lru_lru_remove(struct lru_shard *sh, struct objcore *oc)
+{
+	unsigned l;
+
+	l = (oc->lru_flags & LRU_F_PROTECTED) ? 1 : 0;
+	VTAILQ_REMOVE(&sh->lru_head[l], oc, lru_list);
+	sh->n_obj[l]--;
+}
+
+static void v_matchproto_(lru_touch_f)
+lru_lru_touch(struct worker *wrk, struct objcore *oc, vtim_real now)
+{
+	struct lru_shard *sh;
+
+	sh = lru_touch_lock(wrk, oc, now);
+	if (sh == NULL)
+		return;
+	lru_move(sh, oc, 0, 0);
+	lru_head(sh);
+	Lck_Unlock(&sh->mtx);
+}
+
+static struct objcore * v_matchproto_(lru_nuke_f)
+lru_lru_nuke(struct worker *wrk, struct lru_shard *sh)
+{
+
+	return (lru_nuke_list(wrk, sh, 0));
+}
+
+static const struct lru_policy lru_lru = {
+	.magic =	LRU_POLICY_MAGIC,
+	.name =		"lru",
+	.insert =	lru_lru_insert,
+	.remove =	lru_lru_remove,
+	.nuke =		lru_lru_nuke,
+	.touch =	lru_lru_touch,
+};
+
+/*--------------------------------------------------------------------
+ * Segmented LRU
+ */
+
+static void v_matchproto_(lru_touch_f)
+lru_slru_touch(struct worker *wrk, struct objcore *oc, vtim_real now)
+{
+	struct lru_shard *sh;
+	struct objcore *oc2;
+	unsigned max;
+
+	if (oc->hits == 0)
+		return;
+	sh = lru_touch_lock(wrk, oc, now);
+	if (sh == NULL)
+		return;
+	if (oc->lru_flags & LRU_F_PROTECTED) {
+		lru_move(sh, oc, 1, 1);
+	} else {
+		lru_move(sh, oc, 0, 1);
+		oc->lru_flags |= LRU_F_PROTECTED;
+		max = ((sh->n_obj[0] + sh->n_obj[1]) * LRU_SLRU_PROTECTED
+		    + 99) / 100;
+		while (sh->n_obj[1] > max) {
+			oc2 = VTAILQ_FIRST(&sh->lru_head[1]);
+			CHECK_OBJ_NOTNULL(oc2, OBJCORE_MAGIC);
+			lru_move(sh, oc2, 1, 0);
+			oc2->lru_flags &= ~LRU_F_PROTECTED;
+		}
+	}
+	lru_head(sh);
+	Lck_Unlock(&sh->mtx);
+}
+
+static struct objcore * v_matchproto_(lru_nuke_f)
+lru_slru_nuke(struct worker *wrk, struct lru_shard *sh)
+{
+	struct objcore *oc;
+
+	oc = lru_nuke_list(wrk, sh, 0);
+	if (oc == NULL)
+		oc = lru_nuke_list(wrk, sh, 1);
+	return (oc);
+}
+
+static const struct lru_policy lru_slru = {
+	.magic =	LRU_POLICY_MAGIC,
+	.name =		"slru",
+	.insert =	lru_lru_insert,
+	.remove =	lru_lru_remove,
+	.nuke =		lru_slru_nuke,
+	.touch =	lru_slru_touch,
+};
+
+/*--------------------------------------------------------------------
+ * CLOCK
+ */
+
+static void v_matchproto_(lru_touch_f)
+lru_clock_touch(struct worker *wrk, struct objcore *oc, vtim_real now)
+{
+	struct lru_shard *sh;
+
+	(void)wrk;
+	(void)now;
+	if (oc->hits == 0 || (oc->lru_flags & LRU_F_REFERENCED))
+		return;
+
+	/* The hand clears the bit with the shard lock held */
+	sh = lru_get(oc);
+	Lck_Lock(&sh->mtx);
+	if (!isnan(oc->last_lru))
+		oc->lru_flags |= LRU_F_REFERENCED;
+	Lck_Unlock(&sh->mtx);
+}
+
+static struct objcore * v_matchproto_(lru_nuke_f)
+lru_clock_nuke(struct worker *wrk, struct lru_shard *sh)
+{
+	struct objcore *oc;
+	unsigned n;
+
+	/* Every object is visited at most twice: once to clear the bit */
+	n = sh->n_obj[0] * 2;
+	while (n-- > 0) {
+		oc = VTAILQ_FIRST(&sh->lru_head[0]);
+		if (oc == NULL)
+			break;
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		AZ(isnan(oc->last_lru));
+
+		if (oc->lru_flags & LRU_F_REFERENCED) {
+			oc->lru_flags &= ~LRU_F_REFERENCED;
+			lru_move(sh, oc, 0, 0);
+			wrk->stats->n_lru_moved++;
+			sh->vsc->n_moved++;
+			continue;
+		}
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+		    oc, oc->flags, oc->refcnt);
+
+		lru_move(sh, oc, 0, 0);
+		if (HSH_Snipe(wrk, oc))
+			return (oc);
+	}
+	return (NULL);
+}
+
+static const struct lru_policy lru_clock = {
+	.magic =	LRU_POLICY_MAGIC,
+	.name =		"clock",
+	.insert =	lru_lru_insert,
+	.remove =	lru_lru_remove,
+	.nuke =		lru_clock_nuke,
+	.touch =	lru_clock_touch,
+};
+
+/*--------------------------------------------------------------------*/
+
+static const struct lru_policy * const lru_policies[] = {
+	&lru_lru,
+	&lru_slru,
+	&lru_clock,
+	NULL
+};
+
+const struct lru_policy *
+LRU_Policy(const char *name)
+{
+	const struct lru_policy * const *lp;
+
+	AN(name);
+	for (lp = lru_policies; *lp != NULL; lp++)
+		if (!strcmp((*lp)->name, name))
+			return (*lp);
+	return (NULL);
 }
 
 struct lru *
-LRU_Alloc(void)
+LRU_Alloc(const char *ident, const struct lru_policy *lp)
 {
 	struct lru *lru;
-
-	ALLOC_OBJ(lru, LRU_MAGIC);
+	struct lru_shard *sh;
+	unsigned u, n;
+
+	AN(ident);
+	if (lp == NULL)
+		lp = &lru_lru;
+	CHECK_OBJ(lp, LRU_POLICY_MAGIC);
+	n = cache_param->lru_shards;
+	assert(n > 0);
+	ALLOC_FLEX_OBJ(lru, shard, n, LRU_MAGIC);
 	AN(lru);
-	VTAILQ_INIT(&lru->lru_head);
-	Lck_New(&lru->mtx, lck_lru);
+	lru->policy = lp;
+	lru->nshard = n;
+	for (u = 0; u < n; u++) {
+		sh = &lru->shard[u];
+		VTAILQ_INIT(&sh->lru_head[0]);
+		VTAILQ_INIT(&sh->lru_head[1]);
+		Lck_New(&sh->mtx, lck_lru);
+		sh->t_head = NAN;
+		sh->vsc = VSC_lru_New(NULL, &sh->vsc_seg, "%s.%u", ident, u);
+		AN(sh->vsc);
+	}
 	return (lru);
 }
 
@@ -71,19 +440,27 @@ void
 LRU_Free(struct lru **pp)
 {
 	struct lru *lru;
+	struct lru_shard *sh;
+	unsigned u;
 
 	TAKE_OBJ_NOTNULL(lru, pp, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	AN(VTAILQ_EMPTY(&lru->lru_head));
-	Lck_Unlock(&lru->mtx);
-	Lck_Delete(&lru->mtx);
+	for (u = 0; u < lru->nshard; u++) {
+		sh = &lru->shard[u];
+		Lck_Lock(&sh->mtx);
+		AN(VTAILQ_EMPTY(&sh->lru_head[0]));
+		AN(VTAILQ_EMPTY(&sh->lru_head[1]));
+		Lck_Unlock(&sh->mtx);
+		Lck_Delete(&sh->mtx);
+		VSC_lru_Destroy(&sh->vsc_seg);
+	}
 	FREE_OBJ(lru);
 }
 
 void
 LRU_Add(struct objcore *oc, vtim_real now)
 {
-	struct lru *lru;
+	struct lru_shard *sh;
+	const struct lru_policy *lp;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -93,19 +470,22 @@ LRU_Add(struct objcore *oc, vtim_real now)
 	AZ(oc->boc);
 	AN(isnan(oc->last_lru));
 	AZ(isnan(now));
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	sh = lru_get(oc);
+	lp = oc->stobj->stevedore->lru->policy;
+	Lck_Lock(&sh->mtx);
+	oc->lru_flags = 0;
+	lp->insert(sh, oc);
 	oc->last_lru = now;
 	AZ(isnan(oc->last_lru));
-	Lck_Unlock(&lru->mtx);
+	lru_head(sh);
+	Lck_Unlock(&sh->mtx);
 }
 
 void
 LRU_Remove(struct objcore *oc)
 {
-	struct lru *lru;
+	struct lru_shard *sh;
+	const struct lru_policy *lp;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -113,19 +493,20 @@ LRU_Remove(struct objcore *oc)
 		return;
 
 	AZ(oc->boc);
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
+	sh = lru_get(oc);
+	lp = oc->stobj->stevedore->lru->policy;
+	Lck_Lock(&sh->mtx);
 	AZ(isnan(oc->last_lru));
-	VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
+	lp->remove(sh, oc);
 	oc->last_lru = NAN;
-	Lck_Unlock(&lru->mtx);
+	lru_head(sh);
+	Lck_Unlock(&sh->mtx);
 }
 
 void v_matchproto_(objtouch_f)
 LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 {
-	struct lru *lru;
+	const struct lru *lru;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -133,41 +514,48 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 	if (oc->flags & OC_F_PRIVATE || isnan(oc->last_lru))
 		return;
 
-	/*
-	 * To avoid the exphdl->mtx becoming a hotspot, we only
-	 * attempt to move objects if they have not been moved
-	 * recently and if the lock is available.  This optimization
-	 * obviously leaves the LRU list imperfectly sorted.
-	 */
-
-	if (now - oc->last_lru < cache_param->lru_interval)
-		return;
-
-	lru = lru_get(oc);
+	lru = oc->stobj->stevedore->lru;
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	lru->policy->touch(wrk, oc, now);
+}
 
-	if (Lck_Trylock(&lru->mtx))
-		return;
+/*--------------------------------------------------------------------
+ * Sample the shard heads without locking and return the index of the
+ * shard holding the oldest object.
+ */
 
-	if (!isnan(oc->last_lru)) {
-		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-		VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-		VSC_C_main->n_lru_moved++;
-		oc->last_lru = now;
+static unsigned
+lru_oldest(const struct lru *lru)
+{
+	vtim_real t, t_min = NAN;
+	unsigned u, start = 0;
+
+	for (u = 0; u < lru->nshard; u++) {
+		t = lru->shard[u].t_head;
+		if (!isnan(t) && (isnan(t_min) || t < t_min)) {
+			t_min = t;
+			start = u;
+		}
 	}
-	Lck_Unlock(&lru->mtx);
+	return (start);
 }
 
 /*--------------------------------------------------------------------
  * Attempt to make space by nuking the oldest object on the LRU list
  * which isn't in use.
+ *
+ * The search starts with the shard holding the oldest object and moves
+ * on to the others if nothing there can be nuked.
+ *
  * Returns: 1: did, 0: didn't;
  */
 
 int
 LRU_NukeOne(struct worker *wrk, struct lru *lru)
 {
-	struct objcore *oc, *oc2;
+	struct objcore *oc = NULL;
+	struct lru_shard *sh;
+	unsigned u, start;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
@@ -178,23 +566,18 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 		return (0);
 	}
 
-	/* Find the first currently unused object on the LRU.  */
-	Lck_Lock(&lru->mtx);
-	VTAILQ_FOREACH_SAFE(oc, &lru->lru_head, lru_list, oc2) {
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		AZ(isnan(oc->last_lru));
-
-		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
-		    oc, oc->flags, oc->refcnt);
-
-		if (HSH_Snipe(wrk, oc)) {
-			VSC_C_main->n_lru_nuked++; // XXX per lru ?
-			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-			VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-			break;
+	start = lru_oldest(lru);
+	for (u = 0; oc == NULL && u < lru->nshard; u++) {
+		sh = &lru->shard[(start + u) % lru->nshard];
+		Lck_Lock(&sh->mtx);
+		oc = lru->policy->nuke(wrk, sh);
+		if (oc != NULL) {
+			wrk->stats->n_lru_nuked++;
+			sh->vsc->n_nuked++;
 		}
+		lru_head(sh);
+		Lck_Unlock(&sh->mtx);
 	}
-	Lck_Unlock(&lru->mtx);
 
 	if (oc == NULL) {
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Fail");
@@ -208,3 +591,63 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 	(void)HSH_DerefObjCore(wrk, &oc, 0);	// Ref from HSH_Snipe
 	return (1);
 }
+
+/*--------------------------------------------------------------------
+ * TinyLFU admission: If the storage does not have enough free space for
+ * a new object, it is only admitted if it has been requested more often
+ * than the object which would be the first candidate for eviction.
+ *
+ * Returns: 1: admit, 0: reject
+ */
+
+int
+LRU_Admit(struct worker *wrk, const struct stevedore *stv,
+    const struct objcore *oc, intmax_t size)
+{
+	struct lru *lru;
+	struct lru_shard *sh;
+	const struct objcore *voc;
+	uint8_t digest[DIGEST_LEN];
+	unsigned c, v;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	if (!LFU_Enabled() || stv->lru == NULL ||
+	    stv->var_free_space == NULL || oc->flags & OC_F_PRIVATE)
+		return (1);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+
+	if (size < 0)
+		size = cache_param->fetch_chunksize;
+	if (stv->var_free_space(stv) >= size)
+		return (1);
+
+	lru = stv->lru;
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	sh = &lru->shard[lru_oldest(lru)];
+	Lck_Lock(&sh->mtx);
+	voc = VTAILQ_FIRST(&sh->lru_head[0]);
+	if (voc == NULL)
+		voc = VTAILQ_FIRST(&sh->lru_head[1]);
+	if (voc != NULL) {
+		CHECK_OBJ_NOTNULL(voc, OBJCORE_MAGIC);
+		CHECK_OBJ_NOTNULL(voc->objhead, OBJHEAD_MAGIC);
+		memcpy(digest, voc->objhead->digest, sizeof digest);
+	}
+	Lck_Unlock(&sh->mtx);
+
+	if (voc == NULL)
+		return (1);
+
+	c = LFU_Estimate(oc->objhead->digest);
+	v = LFU_Estimate(digest);
+	if (c > v) {
+		wrk->stats->beresp_lfu_admitted++;
+		return (1);
+	}
+	VSLb(wrk->vsl, SLT_ExpKill, "LFU_Reject p=%p c=%u v=%u", oc, c, v);
+	wrk->stats->beresp_lfu_rejected++;
+	return (0);
+}
@@ -185,9 +185,16 @@ sma_init(struct stevedore *parent, int ac, char * const *av)
 	parent->priv = sc;
 
 	AZ(av[ac]);
-	if (ac > 1)
+	if (ac > 2)
 		ARGV_ERR("(-s%s) too many arguments\n", parent->name);
 
+	if (ac > 1 && *av[1] != '\0') {
+		parent->lru_policy = LRU_Policy(av[1]);
+		if (parent->lru_policy == NULL)
+			ARGV_ERR("(-s%s) invalid eviction policy: \"%s\"\n",
+			    parent->name, av[1]);
+	}
+
 	if (ac == 0 || *av[0] == '\0')
 		 return;
 
@@ -210,7 +217,7 @@ sma_open(struct stevedore *st)
 	struct sma_sc *sma_sc;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st->ident, st->lru_policy);
 	if (lck_sma == NULL)
 		lck_sma = Lck_CreateClass(NULL, "sma");
 	CAST_OBJ_NOTNULL(sma_sc, st->priv, SMA_SC_MAGIC);
@@ -109,6 +109,12 @@ struct smp_ident {
  */
 #define SMP_IDENT_SIZE		112
 
+/*
+ * Bump the major version whenever the layout of what is stored in the
+ * silo changes, including struct object and the object attributes.
+ */
+#define SMP_MAJOR_VERSION	3
+
 #define SMP_IDENT_STRING	"Varnish Persistent Storage Silo"
 
 /*
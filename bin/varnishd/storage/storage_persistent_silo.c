@@ -451,6 +451,7 @@ smp_sml_getobj(struct worker *wrk, struct objcore *oc)
 	fix_ptr(sg, st, (void**)&o->objstore);
 	fix_ptr(sg, st, (void**)&o->va_vary);
 	fix_ptr(sg, st, (void**)&o->va_headers);
+	fix_ptr(sg, st, (void**)&o->va_http1hdr);
 	fix_ptr(sg, st, (void**)&o->list.vtqh_first);
 	fix_ptr(sg, st, (void**)&o->list.vtqh_last);
 	st->priv = (void*)(sg->sc->base);
@@ -31,6 +31,8 @@
 
 #include "config.h"
 
+#include <sys/uio.h>
+
 #include "cache/cache_varnishd.h"
 
 #include "cache/cache_obj.h"
@@ -41,6 +43,9 @@
 
 #include "vtim.h"
 
+/* Storage segments per objiteratev_f call */
+#define SML_IOV_MAX		32
+
 /* Flags for allocating memory in sml_stv_alloc */
 #define LESS_MEM_ALLOCED_IS_OK	1
 
@@ -306,14 +311,71 @@ sml_objfree(struct worker *wrk, struct objcore *oc)
 	wrk->stats->n_object--;
 }
 
-static int v_matchproto_(objiterator_f)
-sml_iterator(struct worker *wrk, struct objcore *oc,
-    void *priv, objiterate_f *func, int final)
+/*--------------------------------------------------------------------
+ * Hand a chunk of a storage segment to the iterator, as a file extent
+ * if we have an extent function and the stevedore can tell where the
+ * segment lives.
+ */
+
+static int
+sml_emit(const struct stevedore *stv, const struct storage *st,
+    void *priv, objiterate_f *func, objextent_f *efunc, unsigned flush,
+    const void *ptr, ssize_t len)
+{
+	int fd;
+	off_t off;
+
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	if (efunc != NULL && stv->sml_extent != NULL && len > 0 &&
+	    !stv->sml_extent(st, &fd, &off)) {
+		assert((const unsigned char *)ptr >= st->ptr);
+		off += (const unsigned char *)ptr - st->ptr;
+		return (efunc(priv, flush, ptr, len, fd, off));
+	}
+	return (func(priv, flush, ptr, len));
+}
+
+/*--------------------------------------------------------------------
+ * Hand the segments of a complete object to the iterator, up to
+ * SML_IOV_MAX at a time.
+ */
+
+static int
+sml_iterate_vec(const struct object *obj, void *priv, objiteratev_f *vfunc)
+{
+	struct iovec iov[SML_IOV_MAX];
+	struct storage *st;
+	unsigned u;
+	int niov = 0, ret = 0;
+
+	VTAILQ_FOREACH_REVERSE(st, &obj->list, storagehead, list) {
+		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+		if (st->len > 0) {
+			iov[niov].iov_base = st->ptr;
+			iov[niov].iov_len = st->len;
+			niov++;
+		}
+		u = 0;
+		if (VTAILQ_PREV(st, storagehead, list) == NULL)
+			u |= OBJ_ITER_END;
+		if (niov == SML_IOV_MAX || (u != 0 && niov > 0)) {
+			ret = vfunc(priv, u, iov, niov);
+			niov = 0;
+			if (ret)
+				break;
+		}
+	}
+	return (ret);
+}
+
+static int
+sml_iterate(struct worker *wrk, struct objcore *oc, void *priv,
+    objiterate_f *func, objextent_f *efunc, objiteratev_f *vfunc, int final)
 {
 	struct boc *boc;
 	enum boc_state_e state;
 	struct object *obj;
-	struct storage *st;
+	struct storage *st, *pst = NULL;
 	struct storage *checkpoint = NULL;
 	const struct stevedore *stv;
 	ssize_t checkpoint_len = 0;
@@ -333,6 +395,14 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 
 	boc = HSH_RefBoc(oc);
 
+	/*
+	 * Segments freed as we go must not be batched, and extents are
+	 * passed one by one.
+	 */
+	if (boc == NULL && vfunc != NULL && !final &&
+	    (efunc == NULL || stv->sml_extent == NULL))
+		return (sml_iterate_vec(obj, priv, vfunc));
+
 	if (boc == NULL) {
 		VTAILQ_FOREACH_REVERSE_SAFE(
 		    st, &obj->list, storagehead, list, checkpoint) {
@@ -343,7 +413,8 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 			if (final)
 				u |= OBJ_ITER_FLUSH;
 			if (ret == 0 && st->len > 0)
-				ret = func(priv, u, st->ptr, st->len);
+				ret = sml_emit(stv, st, priv, func, efunc, u,
+				    st->ptr, st->len);
 			if (final) {
 				VTAILQ_REMOVE(&obj->list, st, list);
 				sml_stv_free(stv, st);
@@ -386,6 +457,7 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 		}
 		while (st != NULL) {
 			if (st->len > ol) {
+				pst = st;
 				p = st->ptr + ol;
 				l = st->len - ol;
 				len += l;
@@ -419,7 +491,7 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 			u |= OBJ_ITER_FLUSH;
 		if (st == NULL && state == BOS_FINISHED)
 			u |= OBJ_ITER_END;
-		ret = func(priv, u, p, l);
+		ret = sml_emit(stv, pst, priv, func, efunc, u, p, l);
 		if (ret)
 			break;
 	}
@@ -432,6 +504,32 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 	return (ret);
 }
 
+static int v_matchproto_(objiterator_f)
+sml_iterator(struct worker *wrk, struct objcore *oc,
+    void *priv, objiterate_f *func, int final)
+{
+
+	return (sml_iterate(wrk, oc, priv, func, NULL, NULL, final));
+}
+
+static int v_matchproto_(objiterextent_f)
+sml_iterextent(struct worker *wrk, struct objcore *oc,
+    void *priv, objiterate_f *func, objextent_f *efunc, int final)
+{
+
+	AN(efunc);
+	return (sml_iterate(wrk, oc, priv, func, efunc, NULL, final));
+}
+
+static int v_matchproto_(objiterv_f)
+sml_iterv(struct worker *wrk, struct objcore *oc, void *priv,
+    objiterate_f *func, objextent_f *efunc, objiteratev_f *vfunc, int final)
+{
+
+	AN(vfunc);
+	return (sml_iterate(wrk, oc, priv, func, efunc, vfunc, final));
+}
+
 /*--------------------------------------------------------------------
  */
 
@@ -736,6 +834,8 @@ const struct obj_methods SML_methods = {
 	.objgetattr	= sml_getattr,
 	.objsetattr	= sml_setattr,
 	.objtouch	= LRU_Touch,
+	.objiterextent	= sml_iterextent,
+	.objiterv	= sml_iterv,
 };
 
 static void
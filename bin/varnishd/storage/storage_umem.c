@@ -304,10 +304,17 @@ smu_init(struct stevedore *parent, int ac, char * const *av)
 	parent->priv = sc;
 
 	AZ(av[ac]);
-	if (ac > 1)
+	if (ac > 2)
 		ARGV_ERR("(-sumem) too many arguments\n");
 
-	if (ac == 1 && *av[0] != '\0') {
+	if (ac > 1 && *av[1] != '\0') {
+		parent->lru_policy = LRU_Policy(av[1]);
+		if (parent->lru_policy == NULL)
+			ARGV_ERR("(-sumem) invalid eviction policy: \"%s\"\n",
+			    av[1]);
+	}
+
+	if (ac > 0 && *av[0] != '\0') {
 		e = VNUM_2bytes(av[0], &u, 0);
 		if (e != NULL)
 			ARGV_ERR("(-sumem) size \"%s\": %s\n", av[0], e);
@@ -402,7 +409,7 @@ smu_open(struct stevedore *st)
 	char ident[strlen(st->ident) + 1];
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st->ident, st->lru_policy);
 	if (lck_smu == NULL)
 		lck_smu = Lck_CreateClass(NULL, "smu");
 	CAST_OBJ_NOTNULL(smu_sc, st->priv, SMU_SC_MAGIC);
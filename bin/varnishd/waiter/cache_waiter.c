@@ -106,6 +106,7 @@ Wait_HeapInsert(const struct waiter *w, struct waited *wp)
 	assert(wp->idx == VBH_NOIDX);
 	AN(w->vsc);
 	w->vsc->conns++;
+	w->vsc->waited++;
 	VBH_insert(w->heap, wp);
 }
 
@@ -193,7 +194,7 @@ Waiter_New(const char *name)
 	w->heap = VBH_new(w, waited_cmp, waited_update);
 
 	AZ(w->vsc);
-	w->vsc = VSC_waiter_New(NULL, NULL, "%s", name);
+	w->vsc = VSC_waiter_New(NULL, &w->vsc_seg, "%s", name);
 	AN(w->vsc);
 
 	waiter->init(w);
@@ -211,5 +212,6 @@ Waiter_Destroy(struct waiter **wp)
 	AZ(VBH_root(w->heap));
 	AN(w->impl->fini);
 	w->impl->fini(w);
+	VSC_waiter_Destroy(&w->vsc_seg);
 	FREE_OBJ(w);
 }
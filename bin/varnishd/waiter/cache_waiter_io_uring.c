@@ -0,0 +1,492 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Linux io_uring(7) waiter
+ *
+ * Each waited fd gets a one-shot IORING_OP_POLL_ADD, which the kernel
+ * disarms by itself when it fires, so unlike with epoll there is no
+ * system call to take the fd out again.  Timeouts are cancelled with
+ * IORING_OP_POLL_REMOVE, and those go in the same submission as the
+ * wait for the next completions.  Completions are reaped from the
+ * shared ring without system calls.
+ *
+ * A poll which is being cancelled still refers to its waited, so the
+ * timeout is only reported once the completion for it arrives.
+ *
+ * We talk to the kernel directly, rather than through liburing, the
+ * three system calls and the ring layout is all we need.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "waiter/waiter.h"
+#include "waiter/waiter_priv.h"
+#include "vmb.h"
+#include "vtim.h"
+
+#ifndef POLLRDHUP
+#  define POLLRDHUP 0
+#endif
+
+#define NSQE	4096
+#define NCQE	(4 * NSQE)
+
+/* user_data for our own submissions, waited are never at NULL */
+#define VWU_INTERNAL	0
+
+struct vwu_sq {
+	unsigned		*head;
+	unsigned		*tail;
+	unsigned		mask;
+	unsigned		entries;
+	unsigned		*array;
+	struct io_uring_sqe	*sqes;
+	void			*ring;
+	size_t			ring_sz;
+	size_t			sqes_sz;
+};
+
+struct vwu_cq {
+	unsigned		*head;
+	unsigned		*tail;
+	unsigned		mask;
+	struct io_uring_cqe	*cqes;
+	void			*ring;
+	size_t			ring_sz;
+};
+
+struct vwu {
+	unsigned		magic;
+#define VWU_MAGIC		0x2e9bb8a1
+	int			fd;
+	struct waiter		*waiter;
+	pthread_t		thread;
+	double			next;
+	unsigned		nwaited;
+	int			sleeping;
+	int			die;
+	struct lock		mtx;
+	struct vwu_sq		sq;
+	struct vwu_cq		cq;
+};
+
+/*--------------------------------------------------------------------*/
+
+static int
+vwu_setup(unsigned entries, struct io_uring_params *p)
+{
+
+	return ((int)syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+vwu_sys_enter(const struct vwu *vwu, unsigned to_submit,
+    unsigned min_complete, unsigned flags, const void *arg, size_t argsz)
+{
+
+	return ((int)syscall(__NR_io_uring_enter, vwu->fd, to_submit,
+	    min_complete, flags, arg, argsz));
+}
+
+static void
+vwu_map(struct vwu *vwu, const struct io_uring_params *p)
+{
+	struct vwu_sq *sq;
+	struct vwu_cq *cq;
+	char *r;
+
+	sq = &vwu->sq;
+	cq = &vwu->cq;
+
+	/* Kernels with IORING_FEAT_SINGLE_MMAP share one mapping */
+	sq->ring_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	cq->ring_sz = p->cq_off.cqes +
+	    p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP)
+		sq->ring_sz = cq->ring_sz = vmax(sq->ring_sz, cq->ring_sz);
+
+	sq->ring = mmap(NULL, sq->ring_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, vwu->fd, IORING_OFF_SQ_RING);
+	assert(sq->ring != MAP_FAILED);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		cq->ring = sq->ring;
+	} else {
+		cq->ring = mmap(NULL, cq->ring_sz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, vwu->fd, IORING_OFF_CQ_RING);
+		assert(cq->ring != MAP_FAILED);
+	}
+	sq->sqes_sz = p->sq_entries * sizeof(struct io_uring_sqe);
+	sq->sqes = mmap(NULL, sq->sqes_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, vwu->fd, IORING_OFF_SQES);
+	assert(sq->sqes != MAP_FAILED);
+
+	r = sq->ring;
+	sq->head = (void*)(r + p->sq_off.head);
+	sq->tail = (void*)(r + p->sq_off.tail);
+	sq->mask = *(unsigned *)(void*)(r + p->sq_off.ring_mask);
+	sq->entries = *(unsigned *)(void*)(r + p->sq_off.ring_entries);
+	sq->array = (void*)(r + p->sq_off.array);
+
+	r = cq->ring;
+	cq->head = (void*)(r + p->cq_off.head);
+	cq->tail = (void*)(r + p->cq_off.tail);
+	cq->mask = *(unsigned *)(void*)(r + p->cq_off.ring_mask);
+	cq->cqes = (void*)(r + p->cq_off.cqes);
+}
+
+static void
+vwu_unmap(struct vwu *vwu)
+{
+
+	AZ(munmap(vwu->sq.sqes, vwu->sq.sqes_sz));
+	if (vwu->cq.ring != vwu->sq.ring)
+		AZ(munmap(vwu->cq.ring, vwu->cq.ring_sz));
+	AZ(munmap(vwu->sq.ring, vwu->sq.ring_sz));
+}
+
+/*--------------------------------------------------------------------
+ * Submission queue, vwu->mtx must be held
+ *
+ * With completions backed up, the kernel refuses new submissions with
+ * EBUSY until vwu_thread() has reaped.  It is bound to wake up to do so,
+ * and its next io_uring_enter() submits whatever is left in the queue.
+ */
+
+static int
+vwu_submit(const struct vwu *vwu)
+{
+	int i;
+
+	do {
+		i = vwu_sys_enter(vwu, vwu->sq.entries, 0, 0, NULL, 0);
+	} while (i < 0 && (errno == EINTR || errno == EAGAIN));
+	if (i < 0 && errno == EBUSY)
+		return (-1);
+	assert(i >= 0);
+	return (0);
+}
+
+static int
+vwu_sq_full(const struct vwu *vwu)
+{
+	unsigned head;
+
+	head = *(volatile unsigned *)vwu->sq.head;
+	VRMB();
+	return (*vwu->sq.tail - head == vwu->sq.entries);
+}
+
+static struct io_uring_sqe *
+vwu_get_sqe(struct vwu *vwu)
+{
+	struct vwu_sq *sq;
+	struct io_uring_sqe *sqe;
+
+	Lck_AssertHeld(&vwu->mtx);
+	sq = &vwu->sq;
+	while (vwu_sq_full(vwu)) {
+		/* Full, hand what we have to the kernel first */
+		if (vwu_submit(vwu)) {
+			/* Never the thread, it does not queue when full */
+			Lck_Unlock(&vwu->mtx);
+			VTIM_sleep(1e-3);
+			Lck_Lock(&vwu->mtx);
+		}
+	}
+	sqe = &sq->sqes[*sq->tail & sq->mask];
+	memset(sqe, 0, sizeof *sqe);
+	return (sqe);
+}
+
+static void
+vwu_put_sqe(struct vwu *vwu, const struct io_uring_sqe *sqe)
+{
+	struct vwu_sq *sq;
+	unsigned tail;
+
+	Lck_AssertHeld(&vwu->mtx);
+	sq = &vwu->sq;
+	tail = *sq->tail;
+	assert(sqe == &sq->sqes[tail & sq->mask]);
+	sq->array[tail & sq->mask] = tail & sq->mask;
+	VWMB();
+	*(volatile unsigned *)sq->tail = tail + 1;
+}
+
+static void
+vwu_poll_add(struct vwu *vwu, struct waited *wp)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = vwu_get_sqe(vwu);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = wp->fd;
+	sqe->poll32_events = POLLIN | POLLRDHUP;
+	sqe->user_data = (uintptr_t)wp;
+	vwu_put_sqe(vwu, sqe);
+}
+
+static void
+vwu_poll_remove(struct vwu *vwu, const struct waited *wp)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = vwu_get_sqe(vwu);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)wp;
+	sqe->user_data = VWU_INTERNAL;
+	vwu_put_sqe(vwu, sqe);
+}
+
+static void
+vwu_nop(struct vwu *vwu)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = vwu_get_sqe(vwu);
+	sqe->opcode = IORING_OP_NOP;
+	sqe->fd = -1;
+	sqe->user_data = VWU_INTERNAL;
+	vwu_put_sqe(vwu, sqe);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+vwu_event(struct vwu *vwu, struct waited *wp, int res, double now)
+{
+	struct waiter *w;
+	int active;
+	char c;
+
+	w = vwu->waiter;
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	Lck_Lock(&vwu->mtx);
+	active = Wait_HeapDelete(w, wp);
+	AN(vwu->nwaited);
+	vwu->nwaited--;
+	Lck_Unlock(&vwu->mtx);
+
+	if (!active) {
+		/* We timed it out, and this is the poll we cancelled */
+		Wait_Call(w, wp, WAITER_TIMEOUT, now);
+	} else if (res > 0 && (res & POLLIN)) {
+		if ((res & POLLRDHUP) &&
+		    recv(wp->fd, &c, 1, MSG_PEEK) == 0)
+			Wait_Call(w, wp, WAITER_REMCLOSE, now);
+		else
+			Wait_Call(w, wp, WAITER_ACTION, now);
+	} else {
+		Wait_Call(w, wp, WAITER_REMCLOSE, now);
+	}
+}
+
+static void *
+vwu_thread(void *priv)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_cqe *cqe;
+	struct waited *wp;
+	struct waiter *w;
+	struct vwu *vwu;
+	double now, then;
+	unsigned head, tail;
+	int i;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	w = vwu->waiter;
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	THR_SetName("cache-io_uring");
+	THR_Init();
+
+	memset(&arg, 0, sizeof arg);
+	arg.ts = (uintptr_t)&ts;
+
+	now = VTIM_real();
+	while (1) {
+		Lck_Lock(&vwu->mtx);
+		while (1) {
+			then = Wait_HeapDue(w, &wp);
+			if (wp == NULL) {
+				vwu->next = now + 100;
+				break;
+			} else if (then > now) {
+				vwu->next = then;
+				break;
+			} else if (vwu_sq_full(vwu)) {
+				/* Reap and submit first, then come back */
+				vwu->next = now;
+				break;
+			}
+			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+			AN(Wait_HeapDelete(w, wp));
+			vwu_poll_remove(vwu, wp);
+		}
+		then = vwu->next - now;
+		vwu->sleeping = 1;
+		Lck_Unlock(&vwu->mtx);
+
+		ts.tv_sec = (long)floor(then);
+		ts.tv_nsec = (long)(1e9 * (then - ts.tv_sec));
+
+		/* Submit whatever is queued and wait for completions */
+		i = vwu_sys_enter(vwu, vwu->sq.entries, 1,
+		    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+		    &arg, sizeof arg);
+		assert(i >= 0 || errno == ETIME || errno == EINTR ||
+		    errno == EAGAIN || errno == EBUSY);
+
+		Lck_Lock(&vwu->mtx);
+		vwu->sleeping = 0;
+		Lck_Unlock(&vwu->mtx);
+
+		now = VTIM_real();
+		head = *vwu->cq.head;
+		tail = *(volatile unsigned *)vwu->cq.tail;
+		VRMB();
+		for (; head != tail; head++) {
+			cqe = &vwu->cq.cqes[head & vwu->cq.mask];
+			if (cqe->user_data == VWU_INTERNAL)
+				continue;
+			wp = (void *)(uintptr_t)cqe->user_data;
+			vwu_event(vwu, wp, cqe->res, now);
+		}
+		VWMB();
+		*(volatile unsigned *)vwu->cq.head = head;
+
+		if (vwu->nwaited == 0 && vwu->die)
+			break;
+	}
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------
+ * While the thread is busy reaping completions, new polls pile up and
+ * go to the kernel in one go when it goes back to waiting.  If it is
+ * already waiting, we submit here.
+ */
+
+static int v_matchproto_(waiter_enter_f)
+vwu_enter(void *priv, struct waited *wp)
+{
+	struct vwu *vwu;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	Lck_Lock(&vwu->mtx);
+	/* First, vwu_get_sqe() may drop the lock while the queue is full */
+	vwu_poll_add(vwu, wp);
+	vwu->nwaited++;
+	Wait_HeapInsert(vwu->waiter, wp);
+	/* If it is due before the thread's timeout, wake it with a nop */
+	if (Wait_When(wp) < vwu->next)
+		vwu_nop(vwu);
+	if (vwu->sleeping)
+		(void)vwu_submit(vwu);
+	Lck_Unlock(&vwu->mtx);
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void v_matchproto_(waiter_init_f)
+vwu_init(struct waiter *w)
+{
+	struct io_uring_params p;
+	struct vwu *vwu;
+
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	vwu = w->priv;
+	INIT_OBJ(vwu, VWU_MAGIC);
+	vwu->waiter = w;
+
+	memset(&p, 0, sizeof p);
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = NCQE;
+	vwu->fd = vwu_setup(NSQE, &p);
+	if (vwu->fd < 0)
+		WRONG("io_uring_setup() failed, io_uring may be disabled");
+	/* For the wait timeout, and to not lose completions */
+	AN(p.features & IORING_FEAT_EXT_ARG);
+	AN(p.features & IORING_FEAT_NODROP);
+	vwu_map(vwu, &p);
+
+	Lck_New(&vwu->mtx, lck_waiter);
+	vwu->next = VTIM_real() + 100;
+	PTOK(pthread_create(&vwu->thread, NULL, vwu_thread, vwu));
+}
+
+/*--------------------------------------------------------------------
+ * It is the callers responsibility to trigger all fd's waited on to
+ * fail somehow.
+ */
+
+static void v_matchproto_(waiter_fini_f)
+vwu_fini(struct waiter *w)
+{
+	struct vwu *vwu;
+	void *vp;
+
+	CAST_OBJ_NOTNULL(vwu, w->priv, VWU_MAGIC);
+
+	Lck_Lock(&vwu->mtx);
+	vwu->die = 1;
+	vwu_nop(vwu);
+	(void)vwu_submit(vwu);
+	Lck_Unlock(&vwu->mtx);
+	PTOK(pthread_join(vwu->thread, &vp));
+	Lck_Delete(&vwu->mtx);
+	vwu_unmap(vwu);
+	closefd(&vwu->fd);
+}
+
+/*--------------------------------------------------------------------*/
+
+#include "waiter/mgt_waiter.h"
+
+const struct waiter_impl waiter_io_uring = {
+	.name =		"io_uring",
+	.init =		vwu_init,
+	.fini =		vwu_fini,
+	.enter =	vwu_enter,
+	.size =		sizeof(struct vwu),
+};
+
+#endif /* defined(HAVE_IO_URING) */
@@ -34,6 +34,7 @@
 struct waited;
 struct vbh;
 struct VSC_waiter;
+struct vsc_seg;
 
 struct waiter {
 	unsigned			magic;
@@ -45,6 +46,7 @@ struct waiter {
 	void				*priv;
 	struct vbh			*heap;
 	struct VSC_waiter		*vsc;
+	struct vsc_seg			*vsc_seg;
 };
 
 typedef void waiter_init_f(struct waiter *);
@@ -363,9 +363,17 @@ HPK_DecHdr(struct hpk_iter *iter, struct hpk_hdr *header)
 	/* Dynamic Table Size Update */
 	/* XXX if under max allowed value */
 	else if (*iter->buf >> 5 == 1) {
-		if (hpk_done != num_decode(&num, iter, 5))
+		switch (num_decode(&num, iter, 5)) {
+		case hpk_done:
+			return (HPK_ResizeTbl(iter->ctx, num));
+		case hpk_more:
+			/* Updates come first, the field follows */
+			if (hpk_err == HPK_ResizeTbl(iter->ctx, num))
+				return (hpk_err);
+			return (HPK_DecHdr(iter, header));
+		default:
 			return (hpk_err);
-		return (HPK_ResizeTbl(iter->ctx, num));
+		}
 	} else {
 		return (hpk_err);
 	}
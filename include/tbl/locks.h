@@ -37,7 +37,9 @@ LOCK(cli)
 LOCK(director)
 LOCK(exp)
 LOCK(hcb)
+LOCK(lfu)
 LOCK(lru)
+LOCK(lsock)
 LOCK(mempool)
 LOCK(objhdr)
 LOCK(perpool)
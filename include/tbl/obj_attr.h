@@ -45,6 +45,7 @@
 #ifdef OBJ_VARATTR
   OBJ_VARATTR(VARY, vary)
   OBJ_VARATTR(HEADERS, headers)
+  OBJ_VARATTR(HTTP1HDR, http1hdr)
   #undef OBJ_VARATTR
 #endif
 
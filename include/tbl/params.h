@@ -236,6 +236,38 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	exp_partitions,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"partitions",
+	/* descr */
+	"Number of partitions the object expiry work is split into.\n"
+	"Each partition has its own inbox, expiry heap and thread, and "
+	"objects are distributed across the partitions by hash.  More "
+	"partitions reduce contention on the expiry locks when many "
+	"objects are inserted, rearmed or removed concurrently.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
+PARAM_SIMPLE(
+	/* name */	exp_wheel_tick,
+	/* type */	duration,
+	/* min */	"0",
+	/* max */	"60",
+	/* def */	"0",
+	/* units */	"seconds",
+	/* descr */
+	"Granularity of the timer wheel used to track object expiry.\n"
+	"Zero selects a binary heap instead, which expires objects "
+	"exactly on time at O(log n) cost per insert and rearm.  A timer "
+	"wheel has O(1) cost per operation, but objects may be expired "
+	"up to one tick late.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	first_byte_timeout,
 	/* type */	timeout,
@@ -428,8 +460,9 @@ PARAM_SIMPLE(
 	/* def */	"180.000",
 	/* units */	"seconds",
 	/* descr */
-	"How long the critbit hasher keeps deleted objheads on the cooloff "
-	"list.",
+	"This parameter has no effect and will be removed.  The critbit "
+	"hasher now frees deleted objheads as soon as no worker can "
+	"reference them any more.",
 	/* flags */	WIZARD
 )
 
@@ -501,6 +534,64 @@ PARAM_SIMPLE(
 	/* flags */	WIZARD
 )
 
+PARAM_SIMPLE(
+	/* name */	http1_sendfile,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Send HTTP1 response bodies of objects in file storage with "
+	"sendfile(2), except for Transient objects.  A delivery only ends "
+	"once the send queue of the socket has drained.\n"
+	"\n"
+	"Only available on Linux.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	http1_zerocopy_threshold,
+	/* type */	bytes,
+	/* min */	"0b",
+	/* max */	NULL,
+	/* def */	"0b",
+	/* units */	"bytes",
+	/* descr */
+	"Send HTTP1 response bodies of at least this size with "
+	"MSG_ZEROCOPY, so the kernel transmits them from the object "
+	"storage instead of copying them first.  Zero disables it.\n"
+	"\n"
+	"Only objects which are complete, not in Transient storage and "
+	"delivered with a Content-Length qualify.  Writes smaller than "
+	"16 kilobytes are always copied.  A delivery only ends once the "
+	"kernel has released the zerocopy buffers, which is usually when "
+	"the client has acknowledged the data.\n"
+	"\n"
+	"Only available on Linux.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	http1_hdr_block,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Store the HTTP1 status line and headers of cacheable objects "
+	"pre-rendered with the object.\n"
+	"\n"
+	"Deliveries which leave the stored headers untouched send the "
+	"pre-rendered block in one piece, followed by the headers added "
+	"for the delivery, such as Age and X-Varnish.  If vcl_deliver{} "
+	"or the delivery code changes the status line or any stored "
+	"header, the headers are rendered one by one as usual.  The block "
+	"takes as much storage again as the stored headers.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	fetch_chunksize,
 	/* type */	bytes,
@@ -738,6 +829,42 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	lfu_sketch_width,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	"1073741824",
+	/* def */	"0",
+	/* units */	"counters",
+	/* descr */
+	"Width of the TinyLFU frequency sketch used to decide whether a new "
+	"object is admitted to a full storage.  Rounded up to the next power "
+	"of two, should be in the order of the number of objects in cache.\n"
+	"If admitting a new object would require evicting another one, it "
+	"is only admitted if it has been requested more often than the "
+	"eviction candidate.  Otherwise, it is delivered from Transient "
+	"storage like a shortlived object.\n"
+	"Zero disables the admission filter.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
+PARAM_SIMPLE(
+	/* name */	lru_shards,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"shards",
+	/* descr */
+	"Number of independently locked shards each stevedore splits its "
+	"LRU list into.\n"
+	"Objects are distributed across the shards by hash, and eviction "
+	"starts with the shard holding the oldest object.  More shards "
+	"reduce contention on the LRU locks at the cost of a less precise "
+	"eviction order.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	ban_any_variant,
 	/* type */	uint,
@@ -876,6 +1003,25 @@ PARAM_SIMPLE(
 	"either direction for this many seconds, the session is closed."
 )
 
+PARAM_SIMPLE(
+	/* name */	pipe_tunnel_threads,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	"64",
+	/* def */	"0",
+	/* units */	"threads",
+	/* descr */
+	"Number of tunnel threads to hand PIPE sessions off to.\n"
+	"Once the backend request is sent, a piped session is moved to "
+	"one of these threads, which move the bytes with non-blocking "
+	"I/O, and the worker thread is released.  The PipeAcct record "
+	"and per backend counters then only account for the bytes moved "
+	"before the handoff.\n"
+	"Zero keeps each PIPE session on its worker thread.  Tunnel "
+	"threads are only available with the epoll waiter platform.",
+	/* flags */	EXPERIMENTAL | MUST_RESTART
+)
+
 PARAM_SIMPLE(
 	/* name */	prefer_ipv6,
 	/* type */	boolean,
@@ -1305,6 +1451,59 @@ PARAM_SIMPLE(
 	/* flags */	WIZARD
 )
 
+PARAM_SIMPLE(
+	/* name */	h2_txbuf_size,
+	/* type */	bytes_u,
+	/* min */	"0",
+	/* max */	"1M",
+	/* def */	"16k",
+	/* units */	"bytes",
+	/* descr */
+	"Size of the HTTP2 session output buffer.\n"
+	"Frames from all streams of a session are collected in it and "
+	"written together when it is full, when h2_txbuf_delay has passed "
+	"since the oldest frame was added, or when no other stream waits "
+	"to send.  Frames which do not fit are written directly, along "
+	"with the buffer content.\n"
+	"Zero disables the buffer, so that every frame is written on its "
+	"own.",
+	/* flags */	EXPERIMENTAL | DELAYED_EFFECT
+)
+
+PARAM_SIMPLE(
+	/* name */	h2_txbuf_delay,
+	/* type */	timeout,
+	/* min */	"0",
+	/* max */	"1",
+	/* def */	"0.001",
+	/* units */	"seconds",
+	/* descr */
+	"How long frames may stay in the HTTP2 session output buffer "
+	"while other streams keep adding to it.  It is checked when a "
+	"frame is added.  See h2_txbuf_size.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	h2_outq_size,
+	/* type */	bytes_u,
+	/* min */	"0",
+	/* max */	"16M",
+	/* def */	"0",
+	/* units */	"bytes",
+	/* descr */
+	"Size of the HTTP2 per-stream output queue.\n"
+	"Response body data which cannot be sent for lack of flow "
+	"control window is copied to the queue of the stream, and sent by "
+	"the session thread once the client credits the window.  The "
+	"worker delivering the stream only waits when the queue is full, "
+	"and is released as soon as the end of the body is queued.  "
+	"Queued bytes are accounted as sent in ReqAcct.\n"
+	"Zero disables the queue, so that delivery workers wait for the "
+	"window themselves.",
+	/* flags */	EXPERIMENTAL | DELAYED_EFFECT
+)
+
 #define H2_SETTING_NAME(nm) "SETTINGS_" #nm
 #define H2_SETTING_DESCR(nm)						\
 	"\n\nThe value of this parameter defines " H2_SETTING_NAME(nm)	\
@@ -1325,6 +1524,23 @@ PARAM_SIMPLE(
 	H2_SETTING_DESCR(HEADER_TABLE_SIZE)
 )
 
+PARAM_SIMPLE(
+	/* name */	h2_encoder_table_size,
+	/* type */	bytes_u,
+	/* min */	"0b",
+	/* max */	"64k",
+	/* def */	"4k",
+	/* units */	"bytes",
+	/* descr */
+	"Maximum size of the HPACK dynamic table used to encode response "
+	"headers.\n"
+	"Response header fields repeated across the streams of a session "
+	"are sent as a reference to this table.  The table is never larger "
+	"than the SETTINGS_HEADER_TABLE_SIZE of the client.  Zero disables "
+	"the dynamic table.",
+	/* flags */	DELAYED_EFFECT
+)
+
 PARAM_SIMPLE(
 	/* name */	h2_max_concurrent_streams,
 	/* type */	uint,
@@ -1510,6 +1726,27 @@ PARAM_THREAD(
 	/* flags */	EXPERIMENTAL | DELAYED_EFFECT
 )
 
+PARAM_THREAD(
+	/* name */	thread_pool_waiters,
+	/* field */	waiters,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"waiters",
+	/* descr */
+	"Number of waiter threads in each pool.\n"
+	"\n"
+	"Idle connections of a pool are spread over its waiters by file "
+	"descriptor, and each waiter keeps its own timeout heap.  More "
+	"waiters help when a single waiter thread per pool cannot keep "
+	"up with a large number of idle keep-alive connections.\n"
+	"\n"
+	"Only pools created after a change get the new number of "
+	"waiters, so a restart is required for it to take full effect.",
+	/* flags */	EXPERIMENTAL | DELAYED_EFFECT
+)
+
 PARAM_THREAD(
 	/* name */	thread_pool_max,
 	/* field */	max,
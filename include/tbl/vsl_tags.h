@@ -376,6 +376,9 @@ SLTM(ExpKill, 0, "Object expiry event",
 	"LRU_Fail\n"
 	"\tLogged when no suitable candidate object is found for LRU force"
 	" expiry.\n\n"
+	"LFU_Reject\n"
+	"\tLogged when a new object is not admitted to a full storage,"
+	" because it was requested less often than the LRU candidate.\n\n"
 	"The format is::\n\n"
 	"\tEXP_Rearm p=%p E=%f e=%f f=0x%x\n"
 	"\tEXP_Inbox p=%p e=%f f=0x%x\n"
@@ -388,6 +391,7 @@ SLTM(ExpKill, 0, "Object expiry event",
 	"\tLRU_Cand p=%p f=0x%x r=%d\n"
 	"\tLRU x=%u\n"
 	"\tLRU_Fail\n"
+	"\tLFU_Reject p=%p c=%u v=%u\n"
 	"\t\n"
 	"\tLegend:\n"
 	"\tp=%p         Objcore pointer\n"
@@ -398,6 +402,8 @@ SLTM(ExpKill, 0, "Object expiry event",
 	"\tr=%d         Objcore refcount\n"
 	"\tx=%u         Object VXID\n"
 	"\tn=%u         New object VXID\n"
+	"\tc=%u         Frequency estimate of the new object\n"
+	"\tv=%u         Frequency estimate of the LRU candidate\n"
 	"\th=%u         Objcore hits\n"
 	"\n"
 )
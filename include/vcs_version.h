@@ -0,0 +1,8 @@
+/* 4ad8ef5e3ca6ed5d4958c5e9e4e435373310091e */
+/*
+ * NB:  This file is machine generated, DO NOT EDIT!
+ *
+ * Edit and run include/generate.py instead.
+ */
+
+#define VCS_Version "4ad8ef5e3ca6ed5d4958c5e9e4e435373310091e"
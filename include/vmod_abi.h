@@ -0,0 +1,7 @@
+/*
+ * NB:  This file is machine generated, DO NOT EDIT!
+ *
+ * Edit and run include/generate.py instead.
+ */
+
+#define VMOD_ABI_Version "Varnish trunk 4ad8ef5e3ca6ed5d4958c5e9e4e435373310091e"
@@ -58,6 +58,10 @@
  * binary/load-time compatible, increment MAJOR version
  *
  * NEXT (2025-03-15)
+ *	[cache_filter.h] struct vdp.extent added
+ *	[cache_filter.h] VDP_extent() added
+ *	[cache_filter.h] struct vdp.bytesv added
+ *	[cache_filter.h] VDP_bytesv() added
  * 20.1 (2024-11-08 7.6.1)
  *	VDI_EVENT_SICK added to enum vcl_event_e
  * 20.0 (2024-09-13)
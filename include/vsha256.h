@@ -44,6 +44,8 @@ void	VSHA256_Init(VSHA256_CTX *);
 void	VSHA256_Update(VSHA256_CTX *, const void *, size_t);
 void	VSHA256_Final(unsigned char [VSHA256_LEN], VSHA256_CTX *);
 void	VSHA256_Test(void);
+const char *VSHA256_Engine(void);
+int	VSHA256_SetEngine(const char *);
 
 #define SHA256_LEN		VSHA256_LEN
 #define SHA256_DIGEST_LENGTH	VSHA256_DIGEST_LENGTH
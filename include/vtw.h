@@ -0,0 +1,84 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ * Hierarchical Timer Wheel API
+ *
+ * Items are kept in doubly linked lists hanging off the slots of a
+ * small number of wheels with increasing granularity, which makes
+ * insert, reorder and delete O(1) operations.  Items are reported due
+ * up to one tick after their time.
+ */
+
+/* Public Interface --------------------------------------------------*/
+
+struct vtw;
+
+typedef void vtw_update_t(void *priv, void *a, unsigned newidx);
+	/*
+	 * Update function
+	 * Called when an item is inserted or deleted to notify the
+	 * item of its index.
+	 */
+
+struct vtw *VTW_new(void *priv, vtw_update_t *, double tick, double now);
+	/*
+	 * Create timer wheel with 'tick' seconds granularity
+	 * 'priv' is passed to the update function.
+	 */
+
+void VTW_destroy(struct vtw **);
+	/*
+	 * Destroy an empty timer wheel
+	 */
+
+void VTW_insert(struct vtw *, void *, double when);
+	/*
+	 * Insert an item to become due at 'when'
+	 */
+
+void VTW_reorder(struct vtw *, unsigned idx, double when);
+	/*
+	 * Move an item to become due at 'when'
+	 */
+
+void VTW_delete(struct vtw *, unsigned idx);
+	/*
+	 * Delete an item
+	 */
+
+void *VTW_next(struct vtw *, double now, double *next);
+	/*
+	 * Return an item which is due at 'now', if any.
+	 * Otherwise return NULL and set 'next' to the time the wheel
+	 * needs to be looked at again, or zero if it is empty.
+	 */
+
+unsigned VTW_count(const struct vtw *);
+	/*
+	 * Return the number of items
+	 */
+
+#define VTW_NOIDX	0
@@ -38,6 +38,21 @@
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#  define VCT_SSE2
+#  include <emmintrin.h>
+#  ifdef HAVE_CPUID_H
+#    define VCT_AVX2
+#    include <cpuid.h>
+#    include <immintrin.h>
+#  endif
+#endif
+
+#if defined(__aarch64__) && defined(__GNUC__)
+#  define VCT_NEON
+#  include <arm_neon.h>
+#endif
+
 #include "vdef.h"
 
 #include "vas.h"
@@ -296,11 +311,312 @@ VCT_invalid_name(const char *b, const char *e)
 	return (NULL);
 }
 
+/*--------------------------------------------------------------------
+ * Length of the span of header value characters (vct_ishdrval()) at
+ * the start of [b, e).  This is what the HTTP/1 parser spends its time
+ * on: the span stops at CR, LF or any other control character, and
+ * the caller decides whether that is the end of the line or an error.
+ *
+ * The vector versions classify 16 or 32 bytes at a time, and leave the
+ * tail of the span to the C version.
+ */
+
+typedef size_t vct_span_f(const char *, const char *);
+
+static size_t
+vct_hdrval_c(const char *b, const char *e)
+{
+	const char *p;
+
+	for (p = b; p < e && vct_ishdrval(*p); p++)
+		continue;
+	return (p - b);
+}
+
+#ifdef VCT_SSE2
+
+/*
+ * SSE2 has no unsigned byte compare, but x >= 0x20 is max(x, 0x20) == x.
+ * The last partial vector is loaded so that it ends at e, overlapping
+ * bytes already looked at, which are shifted out of the mask.
+ */
+
+static inline unsigned
+vct_hdrval_sse2_bad(const char *p)
+{
+	const __m128i sp = _mm_set1_epi8(0x20);
+	const __m128i ht = _mm_set1_epi8(0x09);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	__m128i x, ok;
+
+	x = _mm_loadu_si128((const void *)p);
+	ok = _mm_cmpeq_epi8(_mm_max_epu8(x, sp), x);
+	ok = _mm_andnot_si128(_mm_cmpeq_epi8(x, del), ok);
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(x, ht));
+	return (~(unsigned)_mm_movemask_epi8(ok) & 0xffff);
+}
+
+static size_t
+vct_hdrval_sse2(const char *b, const char *e)
+{
+	const char *p;
+	unsigned m;
+
+	if (e - b < 16)
+		return (vct_hdrval_c(b, e));
+	for (p = b; e - p >= 16; p += 16) {
+		m = vct_hdrval_sse2_bad(p);
+		if (m != 0)
+			return (p - b + __builtin_ctz(m));
+	}
+	if (p == e)
+		return (e - b);
+	m = vct_hdrval_sse2_bad(e - 16) >> (16 - (e - p));
+	if (m != 0)
+		return (p - b + __builtin_ctz(m));
+	return (e - b);
+}
+#endif
+
+#ifdef VCT_AVX2
+
+static int
+vct_avx2_probe(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return (0);
+	if (!(c & (1U << 27)) || !(c & (1U << 28)))	/* OSXSAVE, AVX */
+		return (0);
+	__asm__ ("xgetbv" : "=a" (a), "=d" (d) : "c" (0));
+	if ((a & 6) != 6)				/* XMM, YMM state */
+		return (0);
+	if (__get_cpuid_max(0, NULL) < 7)
+		return (0);
+	__cpuid_count(7, 0, a, b, c, d);
+	return ((b & (1U << 5)) != 0);			/* AVX2 */
+}
+
+static inline unsigned __attribute__((target("avx2")))
+vct_hdrval_avx2_bad(const char *p)
+{
+	const __m256i sp = _mm256_set1_epi8(0x20);
+	const __m256i ht = _mm256_set1_epi8(0x09);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	__m256i x, ok;
+
+	x = _mm256_loadu_si256((const void *)p);
+	ok = _mm256_cmpeq_epi8(_mm256_max_epu8(x, sp), x);
+	ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, del), ok);
+	ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(x, ht));
+	return (~(unsigned)_mm256_movemask_epi8(ok));
+}
+
+static size_t __attribute__((target("avx2")))
+vct_hdrval_avx2(const char *b, const char *e)
+{
+	const char *p;
+	unsigned m;
+
+	if (e - b < 32)
+		return (vct_hdrval_sse2(b, e));
+	for (p = b; e - p >= 32; p += 32) {
+		m = vct_hdrval_avx2_bad(p);
+		if (m != 0)
+			return (p - b + __builtin_ctz(m));
+	}
+	if (p == e)
+		return (e - b);
+	m = vct_hdrval_avx2_bad(e - 32) >> (32 - (e - p));
+	if (m != 0)
+		return (p - b + __builtin_ctz(m));
+	return (e - b);
+}
+#endif
+
+#ifdef VCT_NEON
+
+/*
+ * NEON has no movemask, so the comparison result is narrowed to four
+ * bits per byte and the first bad byte found in the 64 bit word.  The
+ * last partial vector is handled like in the SSE2 version.
+ */
+
+static inline uint64_t
+vct_hdrval_neon_bad(const char *p)
+{
+	const uint8x16_t sp = vdupq_n_u8(0x20);
+	const uint8x16_t ht = vdupq_n_u8(0x09);
+	const uint8x16_t del = vdupq_n_u8(0x7f);
+	uint8x16_t x, bad;
+
+	x = vld1q_u8((const uint8_t *)p);
+	bad = vorrq_u8(vcltq_u8(x, sp), vceqq_u8(x, del));
+	bad = vbicq_u8(bad, vceqq_u8(x, ht));
+	return (vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(
+	    vreinterpretq_u16_u8(bad), 4)), 0));
+}
+
+static size_t
+vct_hdrval_neon(const char *b, const char *e)
+{
+	const char *p;
+	uint64_t m;
+
+	if (e - b < 16)
+		return (vct_hdrval_c(b, e));
+	for (p = b; e - p >= 16; p += 16) {
+		m = vct_hdrval_neon_bad(p);
+		if (m != 0)
+			return (p - b + (__builtin_ctzll(m) >> 2));
+	}
+	if (p == e)
+		return (e - b);
+	m = vct_hdrval_neon_bad(e - 16) >> (4 * (16 - (e - p)));
+	if (m != 0)
+		return (p - b + (__builtin_ctzll(m) >> 2));
+	return (e - b);
+}
+#endif
+
+/*
+ * The fastest version the CPU supports is picked at the first use.
+ * Racing threads will all pick the same one.
+ */
+
+static const struct vct_engine {
+	const char		*name;
+	vct_span_f		*hdrval;
+	int			(*probe)(void);
+} vct_engines[] = {
+#ifdef VCT_AVX2
+	{ "avx2",	vct_hdrval_avx2,	vct_avx2_probe },
+#endif
+#ifdef VCT_SSE2
+	{ "sse2",	vct_hdrval_sse2,	NULL },
+#endif
+#ifdef VCT_NEON
+	{ "neon",	vct_hdrval_neon,	NULL },
+#endif
+	{ "c",		vct_hdrval_c,		NULL },
+	{ NULL,		NULL,			NULL }
+};
+
+static const struct vct_engine *vct_engine;
+
+static const struct vct_engine *
+vct_pick(void)
+{
+	const struct vct_engine *v;
+
+	for (v = vct_engines; v->name != NULL; v++)
+		if (v->probe == NULL || v->probe())
+			break;
+	AN(v->name);
+	vct_engine = v;
+	return (v);
+}
+
+size_t
+VCT_hdrval_span(const char *b, const char *e)
+{
+	const struct vct_engine *v;
+
+	AN(b);
+	AN(e);
+	assert(b <= e);
+	v = vct_engine;
+	if (v == NULL)
+		v = vct_pick();
+	return (v->hdrval(b, e));
+}
+
+/*
+ * Report or select the scanner, for tests and benchmarks.
+ * Returns -1 if the named one is not supported by this CPU.
+ */
+
+const char *
+VCT_Engine(void)
+{
+	const struct vct_engine *v;
+
+	v = vct_engine;
+	if (v == NULL)
+		v = vct_pick();
+	return (v->name);
+}
+
+int
+VCT_SetEngine(const char *name)
+{
+	const struct vct_engine *v;
+
+	AN(name);
+	for (v = vct_engines; v->name != NULL; v++) {
+		if (strcmp(v->name, name))
+			continue;
+		if (v->probe != NULL && !v->probe())
+			break;
+		vct_engine = v;
+		return (0);
+	}
+	return (-1);
+}
+
 #ifdef TEST_DRIVER
 
 #include <ctype.h>
 #include <locale.h>
 
+static const char * const engines[] = { "c", "sse2", "avx2", "neon", NULL };
+
+/*
+ * Compare all scanners against the C version, for spans ending at every
+ * offset of a vector and with every byte value as the stop character.
+ */
+
+static void
+test_hdrval(void)
+{
+	char buf[96];
+	const char * const *e;
+	size_t l, ref;
+	unsigned u, x, n = 0;
+
+	for (e = engines; *e != NULL; e++) {
+		if (VCT_SetEngine(*e))
+			continue;
+		n++;
+		for (x = 0; x < 256; x++) {
+			for (l = 0; l < sizeof buf; l++) {
+				memset(buf, 'a', sizeof buf);
+				buf[l] = (char)x;
+				for (u = 0; u < 33; u++) {
+					ref = vct_hdrval_c(buf + u,
+					    buf + sizeof buf);
+					assert(VCT_hdrval_span(buf + u,
+					    buf + sizeof buf) == ref);
+					if (u <= l)
+						assert(VCT_hdrval_span(buf + u,
+						    buf + l) == l - u);
+				}
+			}
+		}
+		for (u = 0; u < 100000; u++) {
+			for (l = 0; l < sizeof buf; l++)
+				buf[l] = (char)(0x20 + random() % 0x60);
+			buf[random() % sizeof buf] = (char)random();
+			l = random() % sizeof buf;
+			ref = vct_hdrval_c(buf + l, buf + sizeof buf);
+			assert(VCT_hdrval_span(buf + l,
+			    buf + sizeof buf) == ref);
+		}
+	}
+	assert(n > 0);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -342,6 +658,8 @@ main(int argc, char **argv)
 
 	assert(vct_caselencmp("A", "B", 0) == 0);
 
+	test_hdrval();
+
 	return (0);
 }
 
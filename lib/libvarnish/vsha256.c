@@ -60,6 +60,19 @@
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__x86_64__) && defined(__GNUC__) && defined(HAVE_CPUID_H)
+#  define VSHA256_SHANI
+#  include <cpuid.h>
+#  include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__GNUC__) && defined(__linux__) && \
+    defined(HAVE_SYS_AUXV_H)
+#  define VSHA256_ARMV8
+#  include <arm_neon.h>
+#  include <sys/auxv.h>
+#endif
+
 #include "vdef.h"
 
 #include "vas.h"
@@ -221,6 +234,229 @@ VSHA256_Transform(uint32_t * state, const unsigned char block[64])
 		state[i] += S[i];
 }
 
+/*
+ * The compression functions below all take a number of consecutive
+ * blocks, so the hardware versions only have to shuffle the state
+ * in and out of their registers once.
+ */
+
+typedef void vsha256_compress_f(uint32_t *, const unsigned char *, size_t);
+
+static void
+vsha256_c(uint32_t *state, const unsigned char *block, size_t nblk)
+{
+
+	for (; nblk > 0; nblk--, block += 64)
+		VSHA256_Transform(state, block);
+}
+
+#ifdef VSHA256_SHANI
+
+/*
+ * Intel SHA extensions.  Each sha256rnds2 does two rounds on the state
+ * split into ABEF and CDGH halves, and sha256msg1/sha256msg2 compute
+ * the next four words of the message schedule.
+ */
+
+static int
+vsha256_shani_probe(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return (0);
+	if (!(c & (1U << 9)) || !(c & (1U << 19)))	/* SSSE3, SSE4.1 */
+		return (0);
+	if (__get_cpuid_max(0, NULL) < 7)
+		return (0);
+	__cpuid_count(7, 0, a, b, c, d);
+	return ((b & (1U << 29)) != 0);			/* SHA */
+}
+
+static void __attribute__((target("sha,sse4.1")))
+vsha256_shani(uint32_t *state, const unsigned char *block, size_t nblk)
+{
+	const __m128i bswap = _mm_set_epi64x(
+	    0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i s0, s1, s0_save, s1_save, msg, tmp, w[4];
+	int i;
+
+	/* From ABCD and EFGH to the ABEF and CDGH the instructions want */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((void *)&state[0]), 0xb1);
+	s1 = _mm_shuffle_epi32(_mm_loadu_si128((void *)&state[4]), 0x1b);
+	s0 = _mm_alignr_epi8(tmp, s1, 8);
+	s1 = _mm_blend_epi16(s1, tmp, 0xf0);
+
+	for (; nblk > 0; nblk--, block += 64) {
+		s0_save = s0;
+		s1_save = s1;
+		for (i = 0; i < 4; i++)
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+			    (const void *)(block + 16 * i)), bswap);
+		for (i = 0; i < 16; i++) {
+			if (i >= 4) {
+				tmp = _mm_sha256msg1_epu32(w[i & 3],
+				    w[(i - 3) & 3]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(
+				    w[(i - 1) & 3], w[(i - 2) & 3], 4));
+				w[i & 3] = _mm_sha256msg2_epu32(tmp,
+				    w[(i - 1) & 3]);
+			}
+			msg = _mm_add_epi32(w[i & 3],
+			    _mm_loadu_si128((const void *)&K[4 * i]));
+			s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			s0 = _mm_sha256rnds2_epu32(s0, s1, msg);
+		}
+		s0 = _mm_add_epi32(s0, s0_save);
+		s1 = _mm_add_epi32(s1, s1_save);
+	}
+
+	tmp = _mm_shuffle_epi32(s0, 0x1b);
+	s1 = _mm_shuffle_epi32(s1, 0xb1);
+	_mm_storeu_si128((void *)&state[0], _mm_blend_epi16(tmp, s1, 0xf0));
+	_mm_storeu_si128((void *)&state[4], _mm_alignr_epi8(s1, tmp, 8));
+}
+#endif
+
+#ifdef VSHA256_ARMV8
+
+/*
+ * ARMv8 cryptographic extensions.  Each sha256h/sha256h2 pair does four
+ * rounds, and sha256su0/sha256su1 compute the next four words of the
+ * message schedule.
+ */
+
+#  ifdef __clang__
+#    define VSHA256_ARMV8_TARGET __attribute__((target("crypto")))
+#  else
+#    define VSHA256_ARMV8_TARGET __attribute__((target("+crypto")))
+#  endif
+
+static int
+vsha256_armv8_probe(void)
+{
+
+#  ifdef HWCAP_SHA2
+	return ((getauxval(AT_HWCAP) & HWCAP_SHA2) != 0);
+#  else
+	return (0);
+#  endif
+}
+
+static void VSHA256_ARMV8_TARGET
+vsha256_armv8(uint32_t *state, const unsigned char *block, size_t nblk)
+{
+	uint32x4_t s0, s1, s0_save, s1_save, msg, tmp, w[4];
+	int i;
+
+	s0 = vld1q_u32(&state[0]);
+	s1 = vld1q_u32(&state[4]);
+
+	for (; nblk > 0; nblk--, block += 64) {
+		s0_save = s0;
+		s1_save = s1;
+		for (i = 0; i < 4; i++)
+			w[i] = vreinterpretq_u32_u8(
+			    vrev32q_u8(vld1q_u8(block + 16 * i)));
+		for (i = 0; i < 16; i++) {
+			if (i >= 4)
+				w[i & 3] = vsha256su1q_u32(
+				    vsha256su0q_u32(w[i & 3], w[(i - 3) & 3]),
+				    w[(i - 2) & 3], w[(i - 1) & 3]);
+			msg = vaddq_u32(w[i & 3], vld1q_u32(&K[4 * i]));
+			tmp = s0;
+			s0 = vsha256hq_u32(s0, s1, msg);
+			s1 = vsha256h2q_u32(s1, tmp, msg);
+		}
+		s0 = vaddq_u32(s0, s0_save);
+		s1 = vaddq_u32(s1, s1_save);
+	}
+
+	vst1q_u32(&state[0], s0);
+	vst1q_u32(&state[4], s1);
+}
+#endif
+
+/*
+ * The fastest compression function the CPU supports is picked at the
+ * first use.  Racing threads will all pick the same one.
+ */
+
+static const struct vsha256_engine {
+	const char		*name;
+	vsha256_compress_f	*compress;
+	int			(*probe)(void);
+} vsha256_engines[] = {
+#ifdef VSHA256_SHANI
+	{ "sha-ni",	vsha256_shani,	vsha256_shani_probe },
+#endif
+#ifdef VSHA256_ARMV8
+	{ "armv8",	vsha256_armv8,	vsha256_armv8_probe },
+#endif
+	{ "c",		vsha256_c,	NULL },
+	{ NULL,		NULL,		NULL }
+};
+
+static const struct vsha256_engine *vsha256_engine;
+
+static const struct vsha256_engine *
+vsha256_pick(void)
+{
+	const struct vsha256_engine *e;
+
+	for (e = vsha256_engines; e->name != NULL; e++)
+		if (e->probe == NULL || e->probe())
+			break;
+	AN(e->name);
+	vsha256_engine = e;
+	return (e);
+}
+
+static inline void
+vsha256_compress(uint32_t *state, const unsigned char *block, size_t nblk)
+{
+	const struct vsha256_engine *e;
+
+	e = vsha256_engine;
+	if (e == NULL)
+		e = vsha256_pick();
+	e->compress(state, block, nblk);
+}
+
+/*
+ * Report or select the compression function, for tests and benchmarks.
+ * Returns -1 if the named one is not supported by this CPU.
+ */
+
+const char *
+VSHA256_Engine(void)
+{
+	const struct vsha256_engine *e;
+
+	e = vsha256_engine;
+	if (e == NULL)
+		e = vsha256_pick();
+	return (e->name);
+}
+
+int
+VSHA256_SetEngine(const char *name)
+{
+	const struct vsha256_engine *e;
+
+	AN(name);
+	for (e = vsha256_engines; e->name != NULL; e++) {
+		if (strcmp(e->name, name))
+			continue;
+		if (e->probe != NULL && !e->probe())
+			break;
+		vsha256_engine = e;
+		return (0);
+	}
+	return (-1);
+}
+
 static const unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -244,7 +480,7 @@ VSHA256_Pad(VSHA256_CTX * ctx)
 	} else {
 		/* Finish the current block and mix. */
 		memcpy(&ctx->buf[r], PAD, 64 - r);
-		VSHA256_Transform(ctx->state, ctx->buf);
+		vsha256_compress(ctx->state, ctx->buf, 1);
 
 		/* The start of the final block is all zeroes. */
 		memset(&ctx->buf[0], 0, 56);
@@ -254,7 +490,7 @@ VSHA256_Pad(VSHA256_CTX * ctx)
 	vbe64enc(&ctx->buf[56], ctx->count);
 
 	/* Mix in the final block. */
-	VSHA256_Transform(ctx->state, ctx->buf);
+	vsha256_compress(ctx->state, ctx->buf, 1);
 }
 
 /* SHA-256 initialization.  Begins a SHA-256 operation. */
@@ -301,15 +537,15 @@ VSHA256_Update(VSHA256_CTX * ctx, const void *in, size_t len)
 
 	/* Finish the current block */
 	memcpy(&ctx->buf[r], src, 64 - r);
-	VSHA256_Transform(ctx->state, ctx->buf);
+	vsha256_compress(ctx->state, ctx->buf, 1);
 	src += 64 - r;
 	len -= 64 - r;
 
 	/* Perform complete blocks */
-	while (len >= 64) {
-		VSHA256_Transform(ctx->state, src);
-		src += 64;
-		len -= 64;
+	if (len >= 64) {
+		vsha256_compress(ctx->state, src, len / 64);
+		src += len & ~(size_t)0x3f;
+		len &= 0x3f;
 	}
 
 	/* Copy left over data into buffer */
@@ -364,12 +600,77 @@ VSHA256_Test(void)
 {
 	struct VSHA256Context c;
 	const struct sha256test *p;
+	const struct vsha256_engine *e, *e0;
 	unsigned char o[32];
 
-	for (p = sha256test; p->input != NULL; p++) {
+	/* Check every compression function this CPU supports */
+	e0 = vsha256_engine;
+	for (e = vsha256_engines; e->name != NULL; e++) {
+		if (e->probe != NULL && !e->probe())
+			continue;
+		vsha256_engine = e;
+		for (p = sha256test; p->input != NULL; p++) {
+			VSHA256_Init(&c);
+			VSHA256_Update(&c, p->input, strlen(p->input));
+			VSHA256_Final(o, &c);
+			AZ(memcmp(o, p->output, 32));
+		}
+	}
+	vsha256_engine = e0;
+}
+
+#ifdef TEST_DRIVER
+
+#include <stdio.h>
+
+#include "vrnd.h"
+
+static void
+vrnd_lock(void)
+{
+}
+
+int
+main(void)
+{
+	struct VSHA256Context c;
+	const struct vsha256_engine *e;
+	unsigned char buf[1024], o[32], r[32];
+	size_t len, l, u;
+	int i;
+
+	VRND_Lock = vrnd_lock;
+	VRND_Unlock = vrnd_lock;
+
+	VSHA256_Test();
+	printf("Using %s\n", VSHA256_Engine());
+
+	for (i = 0; i < 10000; i++) {
+		len = VRND_RandomTestable() % sizeof buf;
+		for (u = 0; u < len; u++)
+			buf[u] = VRND_RandomTestable() & 0xff;
+
+		AZ(VSHA256_SetEngine("c"));
 		VSHA256_Init(&c);
-		VSHA256_Update(&c, p->input, strlen(p->input));
-		VSHA256_Final(o, &c);
-		AZ(memcmp(o, p->output, 32));
+		VSHA256_Update(&c, buf, len);
+		VSHA256_Final(r, &c);
+
+		/* Feed the others in random sized pieces */
+		for (e = vsha256_engines; e->name != NULL; e++) {
+			if (VSHA256_SetEngine(e->name))
+				continue;
+			VSHA256_Init(&c);
+			for (u = 0; u < len; u += l) {
+				l = VRND_RandomTestable() % 200;
+				if (l > len - u)
+					l = len - u;
+				VSHA256_Update(&c, buf + u, l);
+			}
+			VSHA256_Final(o, &c);
+			AZ(memcmp(o, r, sizeof o));
+		}
 	}
+	printf("OK\n");
+	return (0);
 }
+#endif
@@ -0,0 +1,111 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Micro-benchmark of the SHA256 compression functions
+ *
+ * Usage: vsha256_bench [digests]
+ *
+ * Hash keys are built the way the builtin vcl_hash does it, from the
+ * URL and the Host: header, so most of them fit in one or two blocks.
+ * For a range of key sizes, compute the digest with every compression
+ * function this CPU supports.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "vsha256.h"
+#include "vtim.h"
+
+static const char * const engines[] = { "c", "sha-ni", "armv8", NULL };
+
+/* URL lengths, to be followed by a 16 byte Host: header */
+static const size_t url_lens[] = { 8, 40, 100, 200, 1000 };
+
+#define HOST_LEN	16
+
+static volatile unsigned sink;
+
+static double
+bench(const unsigned char *key, size_t len, unsigned n)
+{
+	struct VSHA256Context c;
+	unsigned char d[VSHA256_LEN];
+	vtim_mono t0;
+	unsigned u;
+
+	t0 = VTIM_mono();
+	for (u = 0; u < n; u++) {
+		VSHA256_Init(&c);
+		VSHA256_Update(&c, key, len);
+		VSHA256_Update(&c, key + len, HOST_LEN);
+		VSHA256_Final(d, &c);
+		sink += d[0];
+	}
+	return (VTIM_mono() - t0);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char key[1100];
+	const char * const *e;
+	const size_t *l;
+	unsigned n = 1000000;
+	double t;
+
+	if (argc > 1)
+		n = strtoul(argv[1], NULL, 0);
+	if (n == 0) {
+		fprintf(stderr, "Usage: %s [digests]\n", argv[0]);
+		return (1);
+	}
+
+	memset(key, 'x', sizeof key);
+	VSHA256_Test();
+	printf("%u digests, default is %s\n\n", n, VSHA256_Engine());
+	printf("%-8s %8s %12s %10s\n", "engine", "keylen", "ns/digest", "MB/s");
+	for (e = engines; *e != NULL; e++) {
+		if (VSHA256_SetEngine(*e))
+			continue;
+		for (l = url_lens;
+		    l < url_lens + (sizeof url_lens / sizeof url_lens[0]);
+		    l++) {
+			assert(*l + HOST_LEN <= sizeof key);
+			t = bench(key, *l, n);
+			printf("%-8s %8zu %12.1f %10.1f\n", *e, *l + HOST_LEN,
+			    t * 1e9 / n, (*l + HOST_LEN) * n / (t * 1e6));
+		}
+	}
+	return (0);
+}
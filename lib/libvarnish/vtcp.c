@@ -416,10 +416,14 @@ VTCP_open(const char *addr, const char *def_port, vtim_dur timeout,
  *
  * If the address is an IPv6 address, the IPV6_V6ONLY option is set to
  * avoid conflicts between INADDR_ANY and IN6ADDR_ANY.
+ *
+ * With reuseport, SO_REUSEPORT is set so that several sockets can be
+ * bound to the same address, and the kernel spreads the incoming
+ * connections over them.
  */
 
-int
-VTCP_bind(const struct suckaddr *sa, const char **errp)
+static int
+vtcp_bind(const struct suckaddr *sa, int reuseport, const char **errp)
 {
 	int sd, val, e;
 	socklen_t sl;
@@ -445,6 +449,26 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 		errno = e;
 		return (-1);
 	}
+#ifdef SO_REUSEPORT
+	val = 1;
+	if (reuseport &&
+	    setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof val) != 0) {
+		if (errp != NULL)
+			*errp = "setsockopt(SO_REUSEPORT, 1)";
+		e = errno;
+		closefd(&sd);
+		errno = e;
+		return (-1);
+	}
+#else
+	if (reuseport) {
+		if (errp != NULL)
+			*errp = "SO_REUSEPORT";
+		closefd(&sd);
+		errno = EOPNOTSUPP;
+		return (-1);
+	}
+#endif
 #ifdef IPV6_V6ONLY
 	/* forcibly use separate sockets for IPv4 and IPv6 */
 	val = 1;
@@ -470,6 +494,20 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 	return (sd);
 }
 
+int
+VTCP_bind(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 0, errp));
+}
+
+int
+VTCP_bind_reuseport(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 1, errp));
+}
+
 /*--------------------------------------------------------------------
  * Given a struct suckaddr, open a socket of the appropriate type, bind it
  * to the requested address, and start listening.
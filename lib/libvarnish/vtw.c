@@ -0,0 +1,568 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ * Implementation of a hierarchical timer wheel
+ *
+ * Time is counted in ticks.  The first wheel has one slot per tick for
+ * the next TW0_SIZE ticks, each further wheel has TWN_SIZE slots which
+ * cover a whole rotation of the wheel below.  When the first wheel
+ * wraps around, the matching slot of the second wheel is cascaded into
+ * it, and so on.  Items further into the future than the last wheel
+ * reaches are parked in its farthest slot and placed again when that
+ * slot is cascaded.
+ *
+ * Items live in an array of entries, and the index of its entry is the
+ * handle of an item, so the user only needs to keep an unsigned around.
+ *
+ * See also:
+ *	http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+ *
+ * XXX: doesn't scale back the array of entries when items are deleted.
+ */
+
+#include "config.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miniobj.h"
+#include "vdef.h"
+#include "vas.h"
+#include "vtw.h"
+
+/* Parameters --------------------------------------------------------*/
+
+#define TW0_BITS		8
+#define TWN_BITS		6
+#define TW_LEVELS		4
+
+/* Same row layout as vbh.c */
+#define ROW_SHIFT		16
+
+/* Private definitions -----------------------------------------------*/
+
+#define TW0_SIZE		(1U << TW0_BITS)
+#define TWN_SIZE		(1U << TWN_BITS)
+#define TW_NSLOT		(TW0_SIZE + (TW_LEVELS - 1) * TWN_SIZE)
+#define TW_RANGE		((uint64_t)1 << (TW0_BITS + \
+				    (TW_LEVELS - 1) * TWN_BITS))
+
+#define TW_LEVEL(s)		((s) < TW0_SIZE ? 0 : \
+				    1 + ((s) - TW0_SIZE) / TWN_SIZE)
+
+#define ROW_WIDTH		(1U << ROW_SHIFT)
+#define E(tw, n)		(&(tw)->rows[(n) >> ROW_SHIFT] \
+				    [(n) & (ROW_WIDTH - 1)])
+
+struct vtw_entry {
+	void			*p;
+	double			when;
+	unsigned		next;
+	unsigned		prev;
+	unsigned		slot;
+};
+
+struct vtw {
+	unsigned		magic;
+#define VTW_MAGIC		0x2d7e3a61
+	void			*priv;
+	vtw_update_t		*update;
+	double			tick;
+	uint64_t		cur;
+	unsigned		count;
+
+	struct vtw_entry	**rows;
+	unsigned		nrows;
+	unsigned		length;
+	unsigned		next;
+	unsigned		free;
+
+	unsigned		cnt[TW_LEVELS];
+	unsigned		head[TW_NSLOT];
+	uint64_t		map[TW0_SIZE / 64];
+};
+
+/* Implementation ----------------------------------------------------*/
+
+static uint64_t
+vtw_tick(const struct vtw *tw, double when)
+{
+	double d;
+
+	d = floor(when / tw->tick);
+	if (!(d > 0.))		/* also NAN */
+		return (0);
+	if (d >= (double)(UINT64_MAX >> 1))
+		return (UINT64_MAX >> 1);
+	return ((uint64_t)d);
+}
+
+static unsigned
+vtw_alloc(struct vtw *tw)
+{
+	struct vtw_entry *e;
+	unsigned u;
+
+	if (tw->free != VTW_NOIDX) {
+		u = tw->free;
+		e = E(tw, u);
+		tw->free = e->next;
+		return (u);
+	}
+	if (tw->next >= tw->length) {
+		if ((tw->length >> ROW_SHIFT) == tw->nrows) {
+			tw->nrows *= 2;
+			tw->rows = realloc(tw->rows,
+			    tw->nrows * sizeof *tw->rows);
+			AN(tw->rows);
+		}
+		tw->rows[tw->length >> ROW_SHIFT] =
+		    calloc(ROW_WIDTH, sizeof **tw->rows);
+		AN(tw->rows[tw->length >> ROW_SHIFT]);
+		tw->length += ROW_WIDTH;
+	}
+	assert(tw->next < UINT_MAX);
+	return (tw->next++);
+}
+
+static void
+vtw_link(struct vtw *tw, unsigned u)
+{
+	struct vtw_entry *e;
+	uint64_t t, d;
+	unsigned s;
+
+	e = E(tw, u);
+	t = vtw_tick(tw, e->when);
+	if (t < tw->cur)
+		t = tw->cur;
+	d = t - tw->cur;
+	if (d < TW0_SIZE) {
+		s = t & (TW0_SIZE - 1);
+		tw->map[s >> 6] |= (uint64_t)1 << (s & 63);
+	} else if (d < (1U << (TW0_BITS + TWN_BITS))) {
+		s = TW0_SIZE + ((t >> TW0_BITS) & (TWN_SIZE - 1));
+	} else if (d < (1U << (TW0_BITS + 2 * TWN_BITS))) {
+		s = TW0_SIZE + TWN_SIZE +
+		    ((t >> (TW0_BITS + TWN_BITS)) & (TWN_SIZE - 1));
+	} else {
+		if (d >= TW_RANGE)
+			t = tw->cur + TW_RANGE - 1;
+		s = TW0_SIZE + 2 * TWN_SIZE +
+		    ((t >> (TW0_BITS + 2 * TWN_BITS)) & (TWN_SIZE - 1));
+	}
+	assert(s < TW_NSLOT);
+	tw->cnt[TW_LEVEL(s)]++;
+	e->slot = s;
+	e->prev = VTW_NOIDX;
+	e->next = tw->head[s];
+	if (e->next != VTW_NOIDX)
+		E(tw, e->next)->prev = u;
+	tw->head[s] = u;
+}
+
+static void
+vtw_unlink(struct vtw *tw, unsigned u)
+{
+	struct vtw_entry *e;
+	unsigned s;
+
+	e = E(tw, u);
+	s = e->slot;
+	assert(s < TW_NSLOT);
+	if (e->prev != VTW_NOIDX)
+		E(tw, e->prev)->next = e->next;
+	else
+		tw->head[s] = e->next;
+	if (e->next != VTW_NOIDX)
+		E(tw, e->next)->prev = e->prev;
+	if (s < TW0_SIZE && tw->head[s] == VTW_NOIDX)
+		tw->map[s >> 6] &= ~((uint64_t)1 << (s & 63));
+	assert(tw->cnt[TW_LEVEL(s)] > 0);
+	tw->cnt[TW_LEVEL(s)]--;
+	e->slot = TW_NSLOT;
+}
+
+static void
+vtw_cascade(struct vtw *tw, unsigned s)
+{
+	unsigned u, v;
+
+	assert(s >= TW0_SIZE);
+	u = tw->head[s];
+	tw->head[s] = VTW_NOIDX;
+	while (u != VTW_NOIDX) {
+		v = E(tw, u)->next;
+		assert(tw->cnt[TW_LEVEL(s)] > 0);
+		tw->cnt[TW_LEVEL(s)]--;
+		vtw_link(tw, u);
+		u = v;
+	}
+}
+
+/*
+ * Advance the first wheel by one tick, cascading the outer wheels when
+ * it wraps.  The slot we leave must be empty.
+ */
+
+static void
+vtw_step(struct vtw *tw)
+{
+	uint64_t c;
+
+	assert(tw->head[tw->cur & (TW0_SIZE - 1)] == VTW_NOIDX);
+	c = ++tw->cur;
+	if (c & (TW0_SIZE - 1))
+		return;
+	c >>= TW0_BITS;
+	if ((c & (TWN_SIZE - 1)) == 0) {
+		if (((c >> TWN_BITS) & (TWN_SIZE - 1)) == 0)
+			vtw_cascade(tw, TW0_SIZE + 2 * TWN_SIZE +
+			    ((c >> (2 * TWN_BITS)) & (TWN_SIZE - 1)));
+		vtw_cascade(tw, TW0_SIZE + TWN_SIZE +
+		    ((c >> TWN_BITS) & (TWN_SIZE - 1)));
+	}
+	vtw_cascade(tw, TW0_SIZE + (c & (TWN_SIZE - 1)));
+}
+
+/*
+ * Find the first occupied slot of the first wheel at or after 'cur',
+ * without wrapping.  Returns TW0_SIZE if there is none.
+ */
+
+static unsigned
+vtw_scan(const struct vtw *tw)
+{
+	unsigned s, w;
+	uint64_t m;
+
+	s = tw->cur & (TW0_SIZE - 1);
+	w = s >> 6;
+	m = tw->map[w] & (~(uint64_t)0 << (s & 63));
+	while (m == 0) {
+		if (++w == TW0_SIZE / 64)
+			return (TW0_SIZE);
+		m = tw->map[w];
+	}
+	for (s = 0; !(m & 1); s++)
+		m >>= 1;
+	return (w * 64 + s);
+}
+
+struct vtw *
+VTW_new(void *priv, vtw_update_t *update_f, double tick, double now)
+{
+	struct vtw *tw;
+
+	assert(tick > 0.);
+	AN(update_f);
+	ALLOC_OBJ(tw, VTW_MAGIC);
+	if (tw == NULL)
+		return (tw);
+	tw->priv = priv;
+	tw->update = update_f;
+	tw->tick = tick;
+	tw->cur = vtw_tick(tw, now);
+	tw->nrows = 16;		/* A tiny-ish number */
+	tw->rows = calloc(tw->nrows, sizeof *tw->rows);
+	AN(tw->rows);
+	tw->next = VTW_NOIDX + 1;
+	tw->free = VTW_NOIDX;
+	return (tw);
+}
+
+void
+VTW_destroy(struct vtw **twp)
+{
+	struct vtw *tw;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(tw, twp, VTW_MAGIC);
+	AZ(tw->count);
+
+	for (u = 0; u < tw->length; u += ROW_WIDTH)
+		free(tw->rows[u >> ROW_SHIFT]);
+	free(tw->rows);
+	FREE_OBJ(tw);
+}
+
+void
+VTW_insert(struct vtw *tw, void *p, double when)
+{
+	struct vtw_entry *e;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	AN(p);
+	u = vtw_alloc(tw);
+	assert(u != VTW_NOIDX);
+	e = E(tw, u);
+	e->p = p;
+	e->when = when;
+	vtw_link(tw, u);
+	tw->count++;
+	tw->update(tw->priv, p, u);
+}
+
+void
+VTW_reorder(struct vtw *tw, unsigned idx, double when)
+{
+	struct vtw_entry *e;
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	assert(idx != VTW_NOIDX);
+	assert(idx < tw->next);
+	e = E(tw, idx);
+	AN(e->p);
+	vtw_unlink(tw, idx);
+	e->when = when;
+	vtw_link(tw, idx);
+}
+
+void
+VTW_delete(struct vtw *tw, unsigned idx)
+{
+	struct vtw_entry *e;
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	assert(idx != VTW_NOIDX);
+	assert(idx < tw->next);
+	e = E(tw, idx);
+	AN(e->p);
+	vtw_unlink(tw, idx);
+	tw->update(tw->priv, e->p, VTW_NOIDX);
+	e->p = NULL;
+	e->next = tw->free;
+	tw->free = idx;
+	assert(tw->count > 0);
+	tw->count--;
+}
+
+void *
+VTW_next(struct vtw *tw, double now, double *next)
+{
+	uint64_t t, base, b;
+	unsigned s, l, g;
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	AN(next);
+
+	t = vtw_tick(tw, now);
+	if (tw->count == 0) {
+		if (tw->cur < t)
+			tw->cur = t;
+		*next = 0.;
+		return (NULL);
+	}
+
+	while (1) {
+		base = tw->cur & ~(uint64_t)(TW0_SIZE - 1);
+		s = vtw_scan(tw);
+		if (s < TW0_SIZE && base + s < t) {
+			/* Items in slots before 'now' are due */
+			tw->cur = base + s;
+			return (E(tw, tw->head[s])->p);
+		}
+		if (s < TW0_SIZE) {
+			if (tw->cur < t)
+				tw->cur = t;
+			break;
+		}
+
+		/*
+		 * Nothing left in this rotation.  If the inner wheels are
+		 * empty, there is nothing to cascade until the next
+		 * rotation of the innermost wheel holding items.
+		 */
+		g = TW0_BITS;
+		for (l = 0; l < TW_LEVELS - 1 && tw->cnt[l] == 0; l++)
+			if (l > 0)
+				g += TWN_BITS;
+		b = ((tw->cur >> g) + 1) << g;
+		if (b > t) {
+			if (tw->cur < t)
+				tw->cur = t;
+			break;
+		}
+		tw->cur = b - 1;
+		vtw_step(tw);
+	}
+
+	s = vtw_scan(tw);
+	base = tw->cur & ~(uint64_t)(TW0_SIZE - 1);
+	if (s < TW0_SIZE)
+		*next = (base + s + 1) * tw->tick;
+	else
+		*next = (base + TW0_SIZE) * tw->tick;
+	return (NULL);
+}
+
+unsigned
+VTW_count(const struct vtw *tw)
+{
+
+	CHECK_OBJ_NOTNULL(tw, VTW_MAGIC);
+	return (tw->count);
+}
+
+#ifdef TEST_DRIVER
+
+#include <stdio.h>
+
+#include "vrnd.h"
+
+/* Test driver -------------------------------------------------------*/
+
+struct foo {
+	unsigned	magic;
+#define FOO_MAGIC	0x1a3b4e2f
+	unsigned	idx;
+	double		when;
+	double		due;
+};
+
+#define M 3001		/* Number of time steps */
+#define N 10007		/* Number of items */
+#define TICK 1.0
+
+static struct foo *ff[N];
+
+static void v_matchproto_(vtw_update_t)
+update(void *priv, void *a, unsigned u)
+{
+	struct foo *fp;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fp, a, FOO_MAGIC);
+	fp->idx = u;
+}
+
+static double
+random_when(double now)
+{
+	switch (VRND_RandomTestable() % 4) {
+	case 0:	return (now + VRND_RandomTestable() % 300);
+	case 1:	return (now + VRND_RandomTestable() % 100000);
+	case 2:	return (now + (double)VRND_RandomTestable() * 64);
+	default: return (now - VRND_RandomTestable() % 10);
+	}
+}
+
+static void
+vrnd_lock(void)
+{
+}
+
+int
+main(void)
+{
+	struct vtw *tw;
+	struct foo *fp;
+	double now, next;
+	unsigned u, v, n_due;
+
+	VRND_SeedAll();
+	VRND_SeedTestable(1);
+	VRND_Lock = vrnd_lock;
+	VRND_Unlock = vrnd_lock;
+
+	now = 1e9;
+	tw = VTW_new(NULL, update, TICK, now);
+	AN(tw);
+
+	for (u = 0; u < N; u++) {
+		ALLOC_OBJ(ff[u], FOO_MAGIC);
+		AN(ff[u]);
+		ff[u]->when = random_when(now);
+		ff[u]->due = fmax(ff[u]->when, now);
+		VTW_insert(tw, ff[u], ff[u]->when);
+		assert(ff[u]->idx != VTW_NOIDX);
+	}
+	assert(VTW_count(tw) == N);
+	fprintf(stderr, "%d inserts OK\n", N);
+
+	n_due = 0;
+	for (u = 0; u < M; u++) {
+		/* Random changes */
+		for (v = 0; v < N / 10; v++) {
+			fp = ff[VRND_RandomTestable() % N];
+			CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+			fp->when = random_when(now);
+			fp->due = fmax(fp->when, now);
+			if (fp->idx == VTW_NOIDX) {
+				VTW_insert(tw, fp, fp->when);
+			} else if (VRND_RandomTestable() & 1) {
+				VTW_reorder(tw, fp->idx, fp->when);
+			} else {
+				VTW_delete(tw, fp->idx);
+				assert(fp->idx == VTW_NOIDX);
+			}
+		}
+
+		/* Move time forward, with an occasional big leap */
+		if (u % 500 == 499)
+			now += (double)VRND_RandomTestable() * 32;
+		else
+			now += VRND_RandomTestable() % 1000;
+
+		/* Expire everything which is due */
+		while ((fp = VTW_next(tw, now, &next)) != NULL) {
+			CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+			assert(fp->when <= now);
+			VTW_delete(tw, fp->idx);
+			assert(fp->idx == VTW_NOIDX);
+			n_due++;
+		}
+		assert(next == 0. || next > now);
+
+		/*
+		 * Nothing may be overdue by more than one tick, items
+		 * inserted with a time in the past count from insertion.
+		 */
+		for (v = 0; v < N; v++) {
+			if (ff[v]->idx == VTW_NOIDX)
+				continue;
+			assert(ff[v]->due > now - TICK);
+			assert(next > 0.);
+			assert(ff[v]->due >= next - TICK);
+		}
+	}
+	fprintf(stderr, "%d steps OK, %u items expired\n", M, n_due);
+
+	for (u = 0; u < N; u++) {
+		if (ff[u]->idx != VTW_NOIDX)
+			VTW_delete(tw, ff[u]->idx);
+		FREE_OBJ(ff[u]);
+	}
+	AZ(VTW_count(tw));
+	VTW_destroy(&tw);
+	AZ(tw);
+	return (0);
+}
+#endif
@@ -0,0 +1,250 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ * Micro-benchmark of the timer wheel against the binary heap
+ *
+ * Usage: vtw_bench [items [tick]]
+ *
+ * For a number of synthetic TTL distributions, insert all items, rearm
+ * a fifth of them and then let them all expire, in the way the expiry
+ * thread would drive either index.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "miniobj.h"
+#include "vdef.h"
+#include "vas.h"
+#include "vbh.h"
+#include "vrnd.h"
+#include "vtim.h"
+#include "vtw.h"
+
+struct item {
+	unsigned	magic;
+#define ITEM_MAGIC	0x5b1e9c07
+	unsigned	idx;
+	double		when;
+};
+
+typedef double ttl_f(void);
+
+static double
+ttl_clustered(void)
+{
+	static const double ttls[] = { 120., 120., 120., 3600., 86400. };
+
+	return (ttls[VRND_RandomTestable() % 5]);
+}
+
+static double
+ttl_uniform(void)
+{
+
+	return (1. + VRND_RandomTestable() % 86400);
+}
+
+static double
+ttl_short(void)
+{
+
+	return (1. + VRND_RandomTestable() % 300);
+}
+
+static const struct dist {
+	const char	*name;
+	ttl_f		*func;
+} dists[] = {
+	{ "clustered",	ttl_clustered },
+	{ "uniform",	ttl_uniform },
+	{ "short",	ttl_short },
+};
+
+static int v_matchproto_(vbh_cmp_t)
+item_cmp(void *priv, const void *a, const void *b)
+{
+	const struct item *aa, *bb;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(aa, a, ITEM_MAGIC);
+	CAST_OBJ_NOTNULL(bb, b, ITEM_MAGIC);
+	return (aa->when < bb->when);
+}
+
+static void v_matchproto_(vbh_update_t)
+item_update(void *priv, void *p, unsigned u)
+{
+	struct item *it;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(it, p, ITEM_MAGIC);
+	it->idx = u;
+}
+
+/* Insertions arrive at 10k/s, rearms shift the TTL by up to a minute */
+#define T0	1e9
+#define T_OP	1e-4
+
+static void
+prep(struct item *items, unsigned n, const struct dist *d)
+{
+	unsigned u;
+
+	VRND_SeedTestable(1);
+	for (u = 0; u < n; u++) {
+		items[u].magic = ITEM_MAGIC;
+		items[u].idx = 0;
+		items[u].when = T0 + u * T_OP + d->func();
+	}
+}
+
+static double
+rearm_when(const struct item *it)
+{
+
+	return (it->when + (double)(VRND_RandomTestable() % 120) - 60.);
+}
+
+static void
+bench_vbh(struct item *items, unsigned n, double *r)
+{
+	struct vbh *bh;
+	struct item *it;
+	vtim_mono t0;
+	unsigned u;
+
+	bh = VBH_new(NULL, item_cmp, item_update);
+	AN(bh);
+
+	t0 = VTIM_mono();
+	for (u = 0; u < n; u++)
+		VBH_insert(bh, &items[u]);
+	r[0] = VTIM_mono() - t0;
+
+	t0 = VTIM_mono();
+	for (u = 0; u < n; u += 5) {
+		items[u].when = rearm_when(&items[u]);
+		VBH_reorder(bh, items[u].idx);
+	}
+	r[1] = VTIM_mono() - t0;
+
+	t0 = VTIM_mono();
+	while ((it = VBH_root(bh)) != NULL) {
+		CHECK_OBJ(it, ITEM_MAGIC);
+		VBH_delete(bh, it->idx);
+	}
+	r[2] = VTIM_mono() - t0;
+	VBH_destroy(&bh);
+}
+
+static void
+bench_vtw(struct item *items, unsigned n, double tick, double *r)
+{
+	struct vtw *tw;
+	struct item *it;
+	vtim_mono t0;
+	double now, next;
+	unsigned u;
+
+	tw = VTW_new(NULL, item_update, tick, T0);
+	AN(tw);
+
+	t0 = VTIM_mono();
+	for (u = 0; u < n; u++)
+		VTW_insert(tw, &items[u], items[u].when);
+	r[0] = VTIM_mono() - t0;
+
+	t0 = VTIM_mono();
+	for (u = 0; u < n; u += 5) {
+		items[u].when = rearm_when(&items[u]);
+		VTW_reorder(tw, items[u].idx, items[u].when);
+	}
+	r[1] = VTIM_mono() - t0;
+
+	t0 = VTIM_mono();
+	now = T0;
+	while (VTW_count(tw) > 0) {
+		it = VTW_next(tw, now, &next);
+		if (it == NULL) {
+			assert(next > now);
+			now = next;
+			continue;
+		}
+		CHECK_OBJ(it, ITEM_MAGIC);
+		VTW_delete(tw, it->idx);
+	}
+	r[2] = VTIM_mono() - t0;
+	VTW_destroy(&tw);
+}
+
+static void
+vrnd_lock(void)
+{
+}
+
+int
+main(int argc, char **argv)
+{
+	struct item *items;
+	const struct dist *d;
+	double rh[3], rw[3], tick = 1.;
+	unsigned n = 1000000;
+
+	if (argc > 1)
+		n = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		tick = strtod(argv[2], NULL);
+	if (n == 0 || !(tick > 0.)) {
+		fprintf(stderr, "Usage: %s [items [tick]]\n", argv[0]);
+		return (1);
+	}
+
+	VRND_Lock = vrnd_lock;
+	VRND_Unlock = vrnd_lock;
+
+	items = calloc(n, sizeof *items);
+	AN(items);
+
+	printf("%u items, tick %g s, ns per operation\n\n", n, tick);
+	printf("%-10s %-6s %10s %10s %10s\n",
+	    "ttl", "index", "insert", "rearm", "expire");
+	for (d = dists; d < dists + (sizeof dists / sizeof dists[0]); d++) {
+		prep(items, n, d);
+		bench_vbh(items, n, rh);
+		prep(items, n, d);
+		bench_vtw(items, n, tick, rw);
+		printf("%-10s %-6s %10.1f %10.1f %10.1f\n", d->name, "vbh",
+		    rh[0] * 1e9 / n, rh[1] * 5e9 / n, rh[2] * 1e9 / n);
+		printf("%-10s %-6s %10.1f %10.1f %10.1f\n", d->name, "vtw",
+		    rw[0] * 1e9 / n, rw[1] * 5e9 / n, rw[2] * 1e9 / n);
+	}
+	free(items);
+	return (0);
+}